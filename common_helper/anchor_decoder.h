@@ -0,0 +1,264 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef ANCHOR_DECODER_
+#define ANCHOR_DECODER_
+
+/* for general */
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/* for SIMD. SSE2 is always available on x64, and NEON on aarch64. Otherwise scalar */
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ANCHOR_DECODER_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define ANCHOR_DECODER_USE_NEON
+#endif
+
+/* for My modules */
+#include "common_helper.h"
+#include "bounding_box.h"
+
+/*
+ * Decoder of YOLO style anchor outputs (x, y, w, h, objectness, [class confidence] per anchor).
+ * The model specific parts are template parameters, and the table sizes are compile-time constants,
+ * so that each model gets its own unrolled decoder from the same code:
+ *   kClassNum   : number of classes
+ *   Layout      : kAnchorMajor   = [grid_h][grid_w][anchor][element] (elements of an anchor are contiguous. e.g. YOLOX, YOLOv7)
+ *                 kChannelMajor  = [anchor][element][grid_h][grid_w] (each element is a plane. e.g. YOLOPv2)
+ *   Activation  : kNone = the model outputs confidences, kSigmoid = the model outputs logits
+ *   BoxEncoding : kGridExp       = cx = (x + grid_x) * stride, w = exp(w) * stride (YOLOX)
+ *                 kGridAnchor    = cx = (x * 2 - 0.5 + grid_x) * stride, w = (w * 2)^2 * anchor_w (YOLOv5 style. e.g. YOLOPv2)
+ *                 kAbsolute      = cx = x, w = w in the input image (the grid is applied in the model. e.g. YOLOv7)
+ *   Score       : kObjectnessClass = the max class confidence of anchors whose objectness passes
+ *                 kObjectness      = the objectness itself (class_id = 0)
+ * Objectness is compared 4 anchors at a time, and the class argmax runs only for the survivors.
+ * With Activation::kSigmoid, objectness is compared as logit against Logit(threshold), and sigmoid is applied only for the survivors.
+ * Boxes are scaled by Param::scale_x/y (input image to the original image). label is not set.
+ */
+namespace AnchorDecoder {
+
+enum class Layout { kAnchorMajor, kChannelMajor };
+enum class Activation { kNone, kSigmoid };
+enum class BoxEncoding { kGridExp, kGridAnchor, kAbsolute };
+enum class Score { kObjectnessClass, kObjectness };
+
+typedef struct Param_ {
+    float threshold_objectness;
+    float threshold_class;      // not used for Score::kObjectness
+    float scale_x;
+    float scale_y;
+    Param_() : threshold_objectness(0), threshold_class(0), scale_x(1), scale_y(1) {}
+} Param;
+
+/* Bit mask of 4 values (bit i for p[i * kStep]) which are >= threshold */
+template <int32_t kStep>
+inline int32_t CompareGreaterEqual4(const float* p, float threshold)
+{
+#if defined(ANCHOR_DECODER_USE_SSE2)
+    const __m128 v = (kStep == 1) ? _mm_loadu_ps(p) : _mm_set_ps(p[3 * kStep], p[2 * kStep], p[kStep], p[0]);
+    return _mm_movemask_ps(_mm_cmpge_ps(v, _mm_set1_ps(threshold)));
+#elif defined(ANCHOR_DECODER_USE_NEON)
+    static const uint32_t kBit[4] = { 1, 2, 4, 8 };
+    float32x4_t v;
+    if (kStep == 1) {
+        v = vld1q_f32(p);
+    } else {
+        v = vdupq_n_f32(p[0]);
+        v = vld1q_lane_f32(p + kStep, v, 1);
+        v = vld1q_lane_f32(p + 2 * kStep, v, 2);
+        v = vld1q_lane_f32(p + 3 * kStep, v, 3);
+    }
+    return static_cast<int32_t>(vaddvq_u32(vandq_u32(vcgeq_f32(v, vdupq_n_f32(threshold)), vld1q_u32(kBit))));
+#else
+    int32_t mask = 0;
+    for (int32_t i = 0; i < 4; i++) {
+        if (p[i * kStep] >= threshold) mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+/* Max of kNum contiguous values */
+template <int32_t kNum>
+inline float GetMax(const float* p)
+{
+    int32_t i = 0;
+    float max_value = p[0];
+#if defined(ANCHOR_DECODER_USE_SSE2)
+    if (kNum >= 4) {
+        __m128 v_max = _mm_loadu_ps(p);
+        for (i = 4; i + 4 <= kNum; i += 4) v_max = _mm_max_ps(v_max, _mm_loadu_ps(p + i));
+        v_max = _mm_max_ps(v_max, _mm_shuffle_ps(v_max, v_max, _MM_SHUFFLE(2, 3, 0, 1)));
+        v_max = _mm_max_ps(v_max, _mm_shuffle_ps(v_max, v_max, _MM_SHUFFLE(1, 0, 3, 2)));
+        max_value = _mm_cvtss_f32(v_max);
+    }
+#elif defined(ANCHOR_DECODER_USE_NEON)
+    if (kNum >= 4) {
+        float32x4_t v_max = vld1q_f32(p);
+        for (i = 4; i + 4 <= kNum; i += 4) v_max = vmaxq_f32(v_max, vld1q_f32(p + i));
+        max_value = vmaxvq_f32(v_max);
+    }
+#endif
+    for (; i < kNum; i++) max_value = (std::max)(max_value, p[i]);
+    return max_value;
+}
+
+/* The first index of value in kNum contiguous values */
+template <int32_t kNum>
+inline int32_t FindFirst(const float* p, float value)
+{
+    int32_t i = 0;
+#if defined(ANCHOR_DECODER_USE_SSE2) || defined(ANCHOR_DECODER_USE_NEON)
+    for (; i + 4 <= kNum; i += 4) {
+#if defined(ANCHOR_DECODER_USE_SSE2)
+        int32_t mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(p + i), _mm_set1_ps(value)));
+#else
+        static const uint32_t kBit[4] = { 1, 2, 4, 8 };
+        int32_t mask = static_cast<int32_t>(vaddvq_u32(vandq_u32(vceqq_f32(vld1q_f32(p + i), vdupq_n_f32(value)), vld1q_u32(kBit))));
+#endif
+        if (mask) {
+            int32_t j = 0;
+            while (!(mask & (1 << j))) j++;
+            return i + j;
+        }
+    }
+#endif
+    for (; i < kNum; i++) {
+        if (p[i] == value) return i;
+    }
+    return 0;
+}
+
+
+template <int32_t kClassNum, Layout kLayout, Activation kActivation, BoxEncoding kBoxEncoding, Score kScore = Score::kObjectnessClass>
+class Decoder {
+public:
+    static constexpr int32_t kElementNum = kClassNum + 5;   // x, y, w, h, objectness, [class confidence]
+
+    /* Decode the table of a stride (kGridW x kGridH cells, kAnchorNum anchors per cell) and append boxes to bbox_list.
+     * anchor_size: (w, h) of each anchor in the input image for BoxEncoding::kGridAnchor. Otherwise nullptr.
+     * For BoxEncoding::kAbsolute, the table is a list of kGridW anchors (kStride = 1, kGridH = 1) */
+    template <int32_t kStride, int32_t kGridW, int32_t kGridH, int32_t kAnchorNum = 1>
+    static void Decode(const float* data, const Param& param, const float (*anchor_size)[2], std::vector<BoundingBox>& bbox_list)
+    {
+        const float threshold_objectness = (kActivation == Activation::kSigmoid) ? CommonHelper::Logit(param.threshold_objectness) : param.threshold_objectness;
+        if (kLayout == Layout::kAnchorMajor) {
+            constexpr int32_t kRowAnchorNum = kGridW * kAnchorNum;
+            for (int32_t grid_y = 0; grid_y < kGridH; grid_y++) {
+                const float* row = data + grid_y * kRowAnchorNum * kElementNum;
+                for (int32_t i_base = 0; i_base < kRowAnchorNum; i_base += 4) {
+                    int32_t mask = CompareObjectness<kElementNum>(row + i_base * kElementNum + 4, kRowAnchorNum - i_base, threshold_objectness);
+                    for (int32_t i = i_base; mask != 0; i++, mask >>= 1) {
+                        if (!(mask & 1)) continue;
+                        const int32_t anchor = i % kAnchorNum;
+                        DecodeAnchor<1, kStride>(row + i * kElementNum, i / kAnchorNum, grid_y, (anchor_size) ? anchor_size[anchor] : nullptr, param, bbox_list);
+                    }
+                }
+            }
+        } else {
+            constexpr int32_t kPlaneSize = kGridW * kGridH;
+            for (int32_t anchor = 0; anchor < kAnchorNum; anchor++) {
+                const float* plane_top = data + anchor * kElementNum * kPlaneSize;
+                for (int32_t grid_y = 0; grid_y < kGridH; grid_y++) {
+                    for (int32_t grid_x_base = 0; grid_x_base < kGridW; grid_x_base += 4) {
+                        const int32_t offset_base = grid_y * kGridW + grid_x_base;
+                        int32_t mask = CompareObjectness<1>(plane_top + 4 * kPlaneSize + offset_base, kGridW - grid_x_base, threshold_objectness);
+                        for (int32_t grid_x = grid_x_base; mask != 0; grid_x++, mask >>= 1) {
+                            if (!(mask & 1)) continue;
+                            DecodeAnchor<kPlaneSize, kStride>(plane_top + grid_y * kGridW + grid_x, grid_x, grid_y, (anchor_size) ? anchor_size[anchor] : nullptr, param, bbox_list);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    static inline float Activate(float x)
+    {
+        return (kActivation == Activation::kSigmoid) ? CommonHelper::Sigmoid(x) : x;
+    }
+
+    /* Bit mask of up to 4 anchors (objectness at p[i * kStep]) which are >= threshold. Compared as it is (logit for kSigmoid) */
+    template <int32_t kStep>
+    static inline int32_t CompareObjectness(const float* p, int32_t remaining_num, float threshold)
+    {
+        if (remaining_num >= 4) {
+            return CompareGreaterEqual4<kStep>(p, threshold);
+        }
+        int32_t mask = 0;
+        for (int32_t i = 0; i < remaining_num; i++) {
+            if (p[i * kStep] >= threshold) mask |= 1 << i;
+        }
+        return mask;
+    }
+
+    /* p points x of the anchor. Element e is at p[e * kStep] */
+    template <int32_t kStep, int32_t kStride>
+    static inline void DecodeAnchor(const float* p, int32_t grid_x, int32_t grid_y, const float* anchor_size, const Param& param, std::vector<BoundingBox>& bbox_list)
+    {
+        int32_t class_id = 0;
+        float score = 0;
+        if (kScore == Score::kObjectness) {
+            score = Activate(p[4 * kStep]);
+        } else {
+            if (kStep == 1 && kActivation == Activation::kNone) {
+                score = GetMax<kClassNum>(p + 5);
+                if (score > 0) class_id = FindFirst<kClassNum>(p + 5, score);
+            } else {
+                for (int32_t class_index = 0; class_index < kClassNum; class_index++) {
+                    const float confidence_of_class = Activate(p[(5 + class_index) * kStep]);
+                    if (confidence_of_class > score) {
+                        score = confidence_of_class;
+                        class_id = class_index;
+                    }
+                }
+            }
+            score = (std::max)(score, 0.0f);
+            if (score < param.threshold_class) return;
+        }
+
+        if (kBoxEncoding == BoxEncoding::kGridAnchor) {
+            /* in double as the reference implementation does, to get the same pixel */
+            const float cx = static_cast<float>((Activate(p[0]) * 2 - 0.5 + grid_x) * kStride);
+            const float cy = static_cast<float>((Activate(p[kStep]) * 2 - 0.5 + grid_y) * kStride);
+            const double w_root = Activate(p[2 * kStep]) * 2;
+            const double h_root = Activate(p[3 * kStep]) * 2;
+            const float w = static_cast<float>(w_root * w_root * anchor_size[0]);
+            const float h = static_cast<float>(h_root * h_root * anchor_size[1]);
+            bbox_list.push_back(BoundingBox(class_id, "", score,
+                static_cast<int32_t>((cx - w / 2.0) * param.scale_x), static_cast<int32_t>((cy - h / 2.0) * param.scale_y),
+                static_cast<int32_t>(w * param.scale_x), static_cast<int32_t>(h * param.scale_y)));
+        } else {
+            /* kStride is 1 for kAbsolute, and a power of 2 for kGridExp, so multiplying it to the scale doesn't change rounding */
+            const float scale_x = kStride * param.scale_x;
+            const float scale_y = kStride * param.scale_y;
+            const bool is_grid = (kBoxEncoding == BoxEncoding::kGridExp);
+            int32_t cx = static_cast<int32_t>((Activate(p[0]) + (is_grid ? grid_x : 0)) * scale_x);
+            int32_t cy = static_cast<int32_t>((Activate(p[kStep]) + (is_grid ? grid_y : 0)) * scale_y);
+            int32_t w = static_cast<int32_t>((is_grid ? std::exp(Activate(p[2 * kStep])) : Activate(p[2 * kStep])) * scale_x);
+            int32_t h = static_cast<int32_t>((is_grid ? std::exp(Activate(p[3 * kStep])) : Activate(p[3 * kStep])) * scale_y);
+            bbox_list.push_back(BoundingBox(class_id, "", score, cx - w / 2, cy - h / 2, w, h));
+        }
+    }
+};
+
+}
+
+#endif
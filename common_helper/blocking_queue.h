@@ -0,0 +1,84 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef BLOCKING_QUEUE_
+#define BLOCKING_QUEUE_
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/* FIFO queue to pass items b/w threads. Pop waits until an item comes or the queue is closed.
+ * max_size > 0: Push waits while the queue is full */
+template <typename T>
+class BlockingQueue {
+public:
+    explicit BlockingQueue(size_t max_size = 0) : max_size_(max_size), is_closed_(false) {}
+
+    /* return false when the queue is closed */
+    bool Push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_not_full_.wait(lock, [this] { return is_closed_ || max_size_ == 0 || item_list_.size() < max_size_; });
+        if (is_closed_) return false;
+        item_list_.push_back(item);
+        cv_not_empty_.notify_one();
+        return true;
+    }
+
+    /* return false when the queue is closed and empty */
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_not_empty_.wait(lock, [this] { return is_closed_ || !item_list_.empty(); });
+        if (item_list_.empty()) return false;
+        item = item_list_.front();
+        item_list_.pop_front();
+        cv_not_full_.notify_one();
+        return true;
+    }
+
+    /* Wake up all the waiting threads. Items already pushed can still be popped */
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_closed_ = true;
+        cv_not_empty_.notify_all();
+        cv_not_full_.notify_all();
+    }
+
+    /* Open again for reuse */
+    void Open()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_closed_ = false;
+    }
+
+    size_t Size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return item_list_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_not_empty_;
+    std::condition_variable cv_not_full_;
+    std::deque<T> item_list_;
+    size_t max_size_;
+    bool is_closed_;
+};
+
+#endif
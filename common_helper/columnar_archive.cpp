@@ -0,0 +1,389 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <functional>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* for My modules */
+#include "common_helper.h"
+#include "compact_result.h"
+#include "columnar_archive.h"
+
+/*** Macro ***/
+#define TAG "ColumnarArchive"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+using namespace ColumnarArchive;
+
+static constexpr size_t kMaxPendingBlockNum = 4;
+static const size_t kColumnElementSize[kColumnNum] = {
+    sizeof(int64_t), sizeof(double), sizeof(int32_t), sizeof(int16_t), sizeof(uint16_t),
+    sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float),
+};
+
+/*** Function ***/
+static size_t Align8(size_t size)
+{
+    return (size + 7) / 8 * 8;
+}
+
+static bool IsValidBlockHeader(const BlockHeader& header, size_t remaining_size)
+{
+    if (header.magic != kBlockMagic || header.block_size < sizeof(BlockHeader) || header.block_size > remaining_size) return false;
+    for (int32_t i = 0; i < kColumnNum; i++) {
+        if (header.column_offset[i] < sizeof(BlockHeader) || header.column_offset[i] + kColumnElementSize[i] * header.row_num > header.block_size) return false;
+    }
+    return true;
+}
+
+/*** Writer ***/
+Writer::Writer()
+    : fp_(nullptr), row_num_per_block_(0), row_num_(0), queue_(kMaxPendingBlockNum), is_write_error_(false)
+{
+}
+
+Writer::~Writer()
+{
+    if (fp_) Close();
+}
+
+int32_t Writer::Open(const std::string& filename, int32_t row_num_per_block)
+{
+    if (fp_) {
+        PRINT_E("Already opened\n");
+        return kRetErr;
+    }
+    if (row_num_per_block < 1) {
+        PRINT_E("Invalid row_num_per_block\n");
+        return kRetErr;
+    }
+
+    /* Append after the last valid block of the existing file. A broken block at the end is overwritten */
+    fp_ = fopen(filename.c_str(), "r+b");
+    if (fp_) {
+        FileHeader file_header;
+        if (fread(&file_header, sizeof(file_header), 1, fp_) != 1 || file_header.magic != kFileMagic || file_header.version != kVersion) {
+            PRINT_E("Not an archive file: %s\n", filename.c_str());
+            fclose(fp_);
+            fp_ = nullptr;
+            return kRetErr;
+        }
+        fseek(fp_, 0, SEEK_END);
+        const size_t file_size = static_cast<size_t>(ftell(fp_));
+        size_t offset = sizeof(FileHeader);
+        BlockHeader block_header;
+        while (fseek(fp_, static_cast<long>(offset), SEEK_SET) == 0 && fread(&block_header, sizeof(block_header), 1, fp_) == 1
+            && IsValidBlockHeader(block_header, file_size - offset)) {
+            offset += static_cast<size_t>(block_header.block_size);
+            row_num_ += block_header.row_num;
+        }
+        fseek(fp_, static_cast<long>(offset), SEEK_SET);
+    } else {
+        fp_ = fopen(filename.c_str(), "wb");
+        if (!fp_) {
+            PRINT_E("Failed to open: %s\n", filename.c_str());
+            return kRetErr;
+        }
+        FileHeader file_header;
+        memset(&file_header, 0, sizeof(file_header));
+        file_header.magic = kFileMagic;
+        file_header.version = kVersion;
+        file_header.column_num = kColumnNum;
+        fwrite(&file_header, sizeof(file_header), 1, fp_);
+    }
+
+    row_num_per_block_ = row_num_per_block;
+    block_.reset(new Block());
+    Reserve(*block_, row_num_per_block_);
+    is_write_error_ = false;
+    queue_.Open();
+    thread_ = std::thread(&Writer::ThreadWrite, this);
+    return kRetOk;
+}
+
+int32_t Writer::Close()
+{
+    if (!fp_) {
+        PRINT_E("Not opened\n");
+        return kRetErr;
+    }
+    Flush();
+    queue_.Close();
+    if (thread_.joinable()) thread_.join();
+    fclose(fp_);
+    fp_ = nullptr;
+    block_.reset();
+    return is_write_error_ ? kRetErr : kRetOk;
+}
+
+void Writer::Reserve(Block& block, int32_t row_num)
+{
+    block.frame_index.reserve(row_num);
+    block.timestamp.reserve(row_num);
+    block.track_id.reserve(row_num);
+    block.class_id.reserve(row_num);
+    block.flags.reserve(row_num);
+    block.score.reserve(row_num);
+    block.x.reserve(row_num);
+    block.y.reserve(row_num);
+    block.w.reserve(row_num);
+    block.h.reserve(row_num);
+}
+
+void Writer::Append(int64_t frame_index, double timestamp_ms, const CompactResult::Object& object)
+{
+    if (!block_) return;
+    Block& block = *block_;
+    block.frame_index.push_back(frame_index);
+    block.timestamp.push_back(timestamp_ms);
+    block.track_id.push_back(object.track_id);
+    block.class_id.push_back(object.class_id);
+    block.flags.push_back(object.flags);
+    block.score.push_back(object.score);
+    block.x.push_back(object.x);
+    block.y.push_back(object.y);
+    block.w.push_back(object.w);
+    block.h.push_back(object.h);
+    row_num_++;
+    if (static_cast<int32_t>(block.frame_index.size()) >= row_num_per_block_) Flush();
+}
+
+void Writer::Append(const CompactResult& result)
+{
+    for (const auto& object : result.object_list) {
+        Append(result.header.frame_index, result.header.timestamp_ms, object);
+    }
+}
+
+int32_t Writer::Flush()
+{
+    if (!block_) return kRetErr;
+    if (block_->frame_index.empty()) return kRetOk;
+    /* Waits if the thread is too slow to write */
+    queue_.Push(block_);
+    block_.reset(new Block());
+    Reserve(*block_, row_num_per_block_);
+    return kRetOk;
+}
+
+int64_t Writer::GetRowNum() const
+{
+    return row_num_;
+}
+
+void Writer::ThreadWrite()
+{
+    std::vector<uint8_t> buffer;
+    BlockPtr block;
+    while (queue_.Pop(block)) {
+        if (!WriteBlock(fp_, *block, buffer)) {
+            PRINT_E("Failed to write\n");
+            is_write_error_ = true;
+        }
+    }
+}
+
+bool Writer::WriteBlock(FILE* fp, const Block& block, std::vector<uint8_t>& buffer)
+{
+    const uint32_t row_num = static_cast<uint32_t>(block.frame_index.size());
+    const void* column_data[kColumnNum] = {
+        block.frame_index.data(), block.timestamp.data(), block.track_id.data(), block.class_id.data(), block.flags.data(),
+        block.score.data(), block.x.data(), block.y.data(), block.w.data(), block.h.data(),
+    };
+
+    BlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kBlockMagic;
+    header.row_num = row_num;
+    size_t offset = sizeof(BlockHeader);
+    for (int32_t i = 0; i < kColumnNum; i++) {
+        header.column_offset[i] = static_cast<uint32_t>(offset);
+        offset = Align8(offset + kColumnElementSize[i] * row_num);
+    }
+    header.block_size = offset;
+    header.frame_index_min = block.frame_index.front();
+    header.frame_index_max = block.frame_index.front();
+    header.timestamp_min = block.timestamp.front();
+    header.timestamp_max = block.timestamp.front();
+    for (uint32_t i = 0; i < row_num; i++) {
+        header.frame_index_min = (std::min)(header.frame_index_min, block.frame_index[i]);
+        header.frame_index_max = (std::max)(header.frame_index_max, block.frame_index[i]);
+        header.timestamp_min = (std::min)(header.timestamp_min, block.timestamp[i]);
+        header.timestamp_max = (std::max)(header.timestamp_max, block.timestamp[i]);
+        header.class_mask |= 1ULL << (static_cast<uint16_t>(block.class_id[i]) % 64);
+    }
+
+    buffer.assign(header.block_size, 0);
+    memcpy(buffer.data(), &header, sizeof(header));
+    for (int32_t i = 0; i < kColumnNum; i++) {
+        memcpy(buffer.data() + header.column_offset[i], column_data[i], kColumnElementSize[i] * row_num);
+    }
+    /* One write per block, so a killed writer leaves at most one broken block at the end */
+    return fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size() && fflush(fp) == 0;
+}
+
+/*** Reader ***/
+Reader::Reader()
+    : data_(nullptr), data_size_(0), row_num_(0)
+{
+}
+
+Reader::~Reader()
+{
+    Close();
+}
+
+int32_t Reader::Open(const std::string& filename)
+{
+    Close();
+#ifdef _WIN32
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        PRINT_E("Failed to open: %s\n", filename.c_str());
+        return kRetErr;
+    }
+    fseek(fp, 0, SEEK_END);
+    buffer_.resize(static_cast<size_t>(ftell(fp)));
+    fseek(fp, 0, SEEK_SET);
+    const size_t read_size = fread(buffer_.data(), 1, buffer_.size(), fp);
+    fclose(fp);
+    buffer_.resize(read_size);
+    data_ = buffer_.data();
+    data_size_ = buffer_.size();
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        PRINT_E("Failed to open: %s\n", filename.c_str());
+        if (fd >= 0) close(fd);
+        return kRetErr;
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        PRINT_E("mmap failed: %s\n", filename.c_str());
+        return kRetErr;
+    }
+    data_ = static_cast<const uint8_t*>(data);
+    data_size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    const FileHeader* file_header = reinterpret_cast<const FileHeader*>(data_);
+    if (data_size_ < sizeof(FileHeader) || file_header->magic != kFileMagic || file_header->version != kVersion) {
+        PRINT_E("Not an archive file: %s\n", filename.c_str());
+        Close();
+        return kRetErr;
+    }
+
+    /* Only the block headers are read here */
+    size_t offset = sizeof(FileHeader);
+    while (offset + sizeof(BlockHeader) <= data_size_) {
+        const BlockHeader* header = reinterpret_cast<const BlockHeader*>(data_ + offset);
+        if (!IsValidBlockHeader(*header, data_size_ - offset)) {
+            PRINT_E("Broken block at %zu is ignored\n", offset);
+            break;
+        }
+        block_offset_list_.push_back(offset);
+        row_num_ += header->row_num;
+        offset += static_cast<size_t>(header->block_size);
+    }
+    return kRetOk;
+}
+
+int32_t Reader::Close()
+{
+#ifndef _WIN32
+    if (data_) munmap(const_cast<uint8_t*>(data_), data_size_);
+#endif
+    buffer_.clear();
+    data_ = nullptr;
+    data_size_ = 0;
+    block_offset_list_.clear();
+    row_num_ = 0;
+    return kRetOk;
+}
+
+int32_t Reader::GetBlockNum() const
+{
+    return static_cast<int32_t>(block_offset_list_.size());
+}
+
+int64_t Reader::GetRowNum() const
+{
+    return row_num_;
+}
+
+const BlockHeader& Reader::GetBlockHeader(int32_t block_index) const
+{
+    return *reinterpret_cast<const BlockHeader*>(data_ + block_offset_list_[block_index]);
+}
+
+const void* Reader::GetColumn(int32_t block_index, int32_t column) const
+{
+    if (block_index < 0 || block_index >= GetBlockNum() || column < 0 || column >= kColumnNum) return nullptr;
+    return data_ + block_offset_list_[block_index] + GetBlockHeader(block_index).column_offset[column];
+}
+
+Reader::Row Reader::GetRow(int32_t block_index, uint32_t row_index) const
+{
+    Row row;
+    row.frame_index = static_cast<const int64_t*>(GetColumn(block_index, kColumnFrameIndex))[row_index];
+    row.timestamp_ms = static_cast<const double*>(GetColumn(block_index, kColumnTimestamp))[row_index];
+    row.object.track_id = static_cast<const int32_t*>(GetColumn(block_index, kColumnTrackId))[row_index];
+    row.object.class_id = static_cast<const int16_t*>(GetColumn(block_index, kColumnClassId))[row_index];
+    row.object.flags = static_cast<const uint16_t*>(GetColumn(block_index, kColumnFlags))[row_index];
+    row.object.score = static_cast<const float*>(GetColumn(block_index, kColumnScore))[row_index];
+    row.object.x = static_cast<const float*>(GetColumn(block_index, kColumnX))[row_index];
+    row.object.y = static_cast<const float*>(GetColumn(block_index, kColumnY))[row_index];
+    row.object.w = static_cast<const float*>(GetColumn(block_index, kColumnW))[row_index];
+    row.object.h = static_cast<const float*>(GetColumn(block_index, kColumnH))[row_index];
+    return row;
+}
+
+int64_t Reader::Select(double timestamp_min, double timestamp_max, int32_t class_id, const std::function<void(const Row& row)>& func) const
+{
+    int64_t matched_num = 0;
+    for (int32_t block_index = 0; block_index < GetBlockNum(); block_index++) {
+        const BlockHeader& header = GetBlockHeader(block_index);
+        if (header.timestamp_max < timestamp_min || header.timestamp_min >= timestamp_max) continue;
+        if (class_id >= 0 && (header.class_mask & (1ULL << (class_id % 64))) == 0) continue;
+
+        /* Scan the filter columns first */
+        const double* timestamp = static_cast<const double*>(GetColumn(block_index, kColumnTimestamp));
+        const int16_t* class_id_list = static_cast<const int16_t*>(GetColumn(block_index, kColumnClassId));
+        for (uint32_t i = 0; i < header.row_num; i++) {
+            if (timestamp[i] < timestamp_min || timestamp[i] >= timestamp_max) continue;
+            if (class_id >= 0 && class_id_list[i] != class_id) continue;
+            func(GetRow(block_index, i));
+            matched_num++;
+        }
+    }
+    return matched_num;
+}
@@ -0,0 +1,172 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef COLUMNAR_ARCHIVE_
+#define COLUMNAR_ARCHIVE_
+
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <functional>
+
+/* for My modules */
+#include "compact_result.h"
+#include "blocking_queue.h"
+
+/*
+ * Append-only columnar file of detection / tracking results. One row = one object in a frame.
+ * File = FileHeader, then blocks. Block = BlockHeader, then each column as an array of row_num values (aligned to 8 bytes).
+ * BlockHeader has the range of frame index / timestamp and the set of class ids in the block,
+ * so that a query skips blocks without touching their data, and reads only the columns it needs from the other blocks.
+ * A block which is broken at the end of the file (e.g. the writer was killed) is ignored by the reader.
+ */
+namespace ColumnarArchive
+{
+
+static constexpr uint32_t kFileMagic = 0x41434A50;     /* "PJCA" */
+static constexpr uint32_t kBlockMagic = 0x4B4C4243;    /* "CBLK" */
+static constexpr uint32_t kVersion = 1;
+
+enum {
+    kColumnFrameIndex = 0,  // int64_t
+    kColumnTimestamp,       // double [msec]
+    kColumnTrackId,         // int32_t
+    kColumnClassId,         // int16_t
+    kColumnFlags,           // uint16_t (CompactResult::kFlagPredicted)
+    kColumnScore,           // float
+    kColumnX,               // float
+    kColumnY,               // float
+    kColumnW,               // float
+    kColumnH,               // float
+    kColumnNum,
+};
+
+typedef struct FileHeader_ {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t column_num;
+    uint32_t reserved[13];
+} FileHeader;
+
+typedef struct BlockHeader_ {
+    uint32_t magic;
+    uint32_t row_num;
+    uint64_t block_size;        // including this header
+    int64_t  frame_index_min;
+    int64_t  frame_index_max;
+    double   timestamp_min;
+    double   timestamp_max;
+    uint64_t class_mask;        // bit (class_id % 64) is set if the class is in the block
+    uint32_t column_offset[kColumnNum];     // from the top of the block
+} BlockHeader;
+
+static_assert(sizeof(FileHeader) == 64, "Binary format of ColumnarArchive::FileHeader is changed");
+static_assert(sizeof(BlockHeader) == 96, "Binary format of ColumnarArchive::BlockHeader is changed");
+
+/* Rows are collected into a block, and full blocks are written to the file by a background thread */
+class Writer {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    Writer();
+    ~Writer();
+    int32_t Open(const std::string& filename, int32_t row_num_per_block = 65536);  /* append to the file if it exists */
+    int32_t Close();    /* write the remaining rows and wait for the thread */
+
+    void Append(int64_t frame_index, double timestamp_ms, const CompactResult::Object& object);
+    void Append(const CompactResult& result);   /* all the objects of a frame */
+    int32_t Flush();    /* pass the current rows to the thread as a block even if it's not full */
+
+    int64_t GetRowNum() const;
+
+private:
+    typedef struct Block_ {
+        std::vector<int64_t>  frame_index;
+        std::vector<double>   timestamp;
+        std::vector<int32_t>  track_id;
+        std::vector<int16_t>  class_id;
+        std::vector<uint16_t> flags;
+        std::vector<float>    score;
+        std::vector<float>    x;
+        std::vector<float>    y;
+        std::vector<float>    w;
+        std::vector<float>    h;
+    } Block;
+    typedef std::shared_ptr<Block> BlockPtr;
+
+    void ThreadWrite();
+    static void Reserve(Block& block, int32_t row_num);
+    static bool WriteBlock(FILE* fp, const Block& block, std::vector<uint8_t>& buffer);
+
+private:
+    FILE* fp_;
+    int32_t row_num_per_block_;
+    int64_t row_num_;
+    BlockPtr block_;
+    BlockingQueue<BlockPtr> queue_;
+    std::thread thread_;
+    bool is_write_error_;
+};
+
+/* Map the file to memory and read columns in place */
+class Reader {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Row_ {
+        int64_t  frame_index;
+        double   timestamp_ms;
+        CompactResult::Object object;
+    } Row;
+
+public:
+    Reader();
+    ~Reader();
+    int32_t Open(const std::string& filename);
+    int32_t Close();
+
+    int32_t GetBlockNum() const;
+    int64_t GetRowNum() const;
+    const BlockHeader& GetBlockHeader(int32_t block_index) const;
+    const void* GetColumn(int32_t block_index, int32_t column) const;   /* cast to the type of the column */
+
+    /* Call func for each row in [timestamp_min, timestamp_max) of the class (class_id < 0: all classes).
+     * Blocks out of the range are skipped by BlockHeader, and the other columns are read only for the matched rows */
+    int64_t Select(double timestamp_min, double timestamp_max, int32_t class_id, const std::function<void(const Row& row)>& func) const;
+
+private:
+    Row GetRow(int32_t block_index, uint32_t row_index) const;
+
+private:
+    const uint8_t* data_;
+    size_t data_size_;
+    std::vector<uint8_t> buffer_;   // for the platform without mmap
+    std::vector<size_t> block_offset_list_;
+    int64_t row_num_;
+};
+
+}
+
+#endif
@@ -157,6 +157,16 @@ bool CommonHelper::FindSourceImage(const std::string& input_name, cv::VideoCaptu
 }
 
 bool CommonHelper::InputKeyCommand(cv::VideoCapture& cap)
+{
+    bool ret_to_quit = InputKeyCommand([&cap](int32_t frame_offset) {
+        int32_t current_frame = static_cast<int32_t>(cap.get(cv::CAP_PROP_POS_FRAMES));
+        cap.set(cv::CAP_PROP_POS_FRAMES, current_frame + frame_offset);
+    });
+    if (ret_to_quit) cap.release();
+    return ret_to_quit;
+}
+
+bool CommonHelper::InputKeyCommand(const std::function<void(int32_t frame_offset)>& seek)
 {
     bool ret_to_quit = false;
     static bool is_pause = false;
@@ -165,7 +175,6 @@ bool CommonHelper::InputKeyCommand(cv::VideoCapture& cap)
         int32_t key = cv::waitKey(1) & 0xff;
         switch (key) {
         case 'q':
-            cap.release();
             ret_to_quit = true;
             break;
         case 'p':
@@ -175,17 +184,15 @@ bool CommonHelper::InputKeyCommand(cv::VideoCapture& cap)
             if (is_pause) {
                 is_process_one_frame = true;
             } else {
-                int32_t current_frame = static_cast<int32_t>(cap.get(cv::CAP_PROP_POS_FRAMES));
-                cap.set(cv::CAP_PROP_POS_FRAMES, current_frame + 100);
+                if (seek) seek(100);
             }
             break;
         case '<':
-            int32_t current_frame = static_cast<int32_t>(cap.get(cv::CAP_PROP_POS_FRAMES));
             if (is_pause) {
                 is_process_one_frame = true;
-                cap.set(cv::CAP_PROP_POS_FRAMES, current_frame - 2);
+                if (seek) seek(-2);
             } else {
-                cap.set(cv::CAP_PROP_POS_FRAMES, current_frame - 100);
+                if (seek) seek(-100);
             }
             break;
         }
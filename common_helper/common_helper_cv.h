@@ -20,6 +20,7 @@ limitations under the License.
 #include <string>
 #include <vector>
 #include <array>
+#include <functional>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
@@ -40,6 +41,7 @@ void CropResizeCvt(const cv::Mat& org, cv::Mat& dst, int32_t& crop_x, int32_t& c
 std::string CreateGStreamerPipeline(int capture_width, int capture_height, int display_width, int display_height, int framerate, int flip_method);
 bool FindSourceImage(const std::string& input_name, cv::VideoCapture& cap, int32_t width = 640, int32_t height = 480);
 bool InputKeyCommand(cv::VideoCapture& cap);
+bool InputKeyCommand(const std::function<void(int32_t frame_offset)>& seek);    /* seek relative to the next frame. nullptr if not seekable */
 cv::Mat CombineMat1to3(const cv::Mat& mat0, const cv::Mat& mat1, const cv::Mat& mat2);
 cv::Mat CombineMat1to3(int32_t rows, int32_t cols, float* data0, float* data1, float* data2);
 
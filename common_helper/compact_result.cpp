@@ -0,0 +1,132 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/* for general */
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* for My modules */
+#include "compact_result.h"
+
+constexpr uint32_t CompactResult::kMagic;     // for link error in Android Studio (clang)
+constexpr uint16_t CompactResult::kVersion;
+
+/* Each result is padded so that the next result in a stream is also aligned */
+static size_t CalculateSerializedSize(size_t object_num)
+{
+    static constexpr size_t kAlignment = alignof(CompactResult::Header);
+    const size_t size = sizeof(CompactResult::Header) + sizeof(CompactResult::Object) * object_num;
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+CompactResult::CompactResult()
+{
+    Clear();
+}
+
+void CompactResult::Clear()
+{
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.object_size = static_cast<uint16_t>(sizeof(Object));
+    object_list.clear();
+}
+
+size_t CompactResult::GetSerializedSize() const
+{
+    return CalculateSerializedSize(object_list.size());
+}
+
+size_t CompactResult::Serialize(uint8_t* buffer, size_t buffer_size) const
+{
+    const size_t size = GetSerializedSize();
+    if (buffer_size < size) return 0;
+    Header header_out = header;
+    header_out.magic = kMagic;
+    header_out.version = kVersion;
+    header_out.object_size = static_cast<uint16_t>(sizeof(Object));
+    header_out.object_num = static_cast<uint32_t>(object_list.size());
+    std::memcpy(buffer, &header_out, sizeof(Header));
+    if (!object_list.empty()) {
+        std::memcpy(buffer + sizeof(Header), object_list.data(), sizeof(Object) * object_list.size());
+    }
+    const size_t size_data = sizeof(Header) + sizeof(Object) * object_list.size();
+    std::memset(buffer + size_data, 0, size - size_data);
+    return size;
+}
+
+void CompactResult::Serialize(std::vector<uint8_t>& buffer) const
+{
+    const size_t offset = buffer.size();
+    buffer.resize(offset + GetSerializedSize());
+    Serialize(buffer.data() + offset, buffer.size() - offset);
+}
+
+bool CompactResult::Deserialize(const uint8_t* data, size_t size)
+{
+    /* data may not be aligned. Copy into the struct */
+    if (size < sizeof(Header)) return false;
+    Header header_in;
+    std::memcpy(&header_in, data, sizeof(Header));
+    if (header_in.magic != kMagic || header_in.version != kVersion || header_in.object_size != sizeof(Object)) return false;
+    if (header_in.object_num > (size - sizeof(Header)) / sizeof(Object)) return false;     /* no overflow even with 32-bit size_t */
+    header = header_in;
+    object_list.resize(header_in.object_num);
+    if (header_in.object_num > 0) {
+        std::memcpy(object_list.data(), data + sizeof(Header), sizeof(Object) * object_list.size());
+    }
+    return true;
+}
+
+
+CompactResultView::CompactResultView()
+{
+    header_ = nullptr;
+    object_list_ = nullptr;
+}
+
+bool CompactResultView::Set(const uint8_t* data, size_t size)
+{
+    header_ = nullptr;
+    object_list_ = nullptr;
+    if (size < sizeof(CompactResult::Header) || reinterpret_cast<uintptr_t>(data) % alignof(CompactResult::Header) != 0) return false;
+    const CompactResult::Header* header = reinterpret_cast<const CompactResult::Header*>(data);
+    if (header->magic != CompactResult::kMagic || header->version != CompactResult::kVersion || header->object_size != sizeof(CompactResult::Object)) return false;
+    if (header->object_num > (size - sizeof(CompactResult::Header)) / sizeof(CompactResult::Object)) return false;
+    header_ = header;
+    object_list_ = reinterpret_cast<const CompactResult::Object*>(data + sizeof(CompactResult::Header));
+    return true;
+}
+
+const CompactResult::Header& CompactResultView::GetHeader() const
+{
+    return *header_;
+}
+
+uint32_t CompactResultView::GetObjectNum() const
+{
+    return header_ ? header_->object_num : 0;
+}
+
+const CompactResult::Object* CompactResultView::GetObjectList() const
+{
+    return object_list_;
+}
+
+size_t CompactResultView::GetSize() const
+{
+    return header_ ? CalculateSerializedSize(header_->object_num) : 0;
+}
@@ -0,0 +1,100 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef COMPACT_RESULT_
+#define COMPACT_RESULT_
+
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+/*
+ * Variable length result of detection / tracking, and its binary format.
+ * The binary format is just Header followed by Object[object_num] in the host byte order (little endian on all the supported platforms),
+ * padded to a multiple of 8 bytes,
+ * so that it is written with two memcpy and read in place by CompactResultView without copy.
+ * Labels are not included. Use class_id with the label list of the model.
+ */
+class CompactResult {
+public:
+    static constexpr uint32_t kMagic = 0x53525043;  /* "CPRS" */
+    static constexpr uint16_t kVersion = 1;
+    enum {
+        kFlagSkipped = 1 << 0,      /* Header: inference was skipped and the previous result was reused */
+        kFlagPredicted = 1 << 0,    /* Object: not detected in this frame but predicted by the tracker */
+    };
+
+    typedef struct Header_ {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t object_size;       // sizeof(Object), to check compatibility
+        uint32_t object_num;
+        uint32_t flags;
+        int64_t  frame_index;
+        double   timestamp_ms;
+        float    time_pre_process;  // [msec]
+        float    time_inference;    // [msec]
+        float    time_post_process; // [msec]
+        float    time_gate;         // [msec]
+    } Header;
+
+    typedef struct Object_ {
+        int32_t  track_id;          // -1: not tracked
+        int16_t  class_id;
+        uint16_t flags;
+        float    score;
+        float    x;
+        float    y;
+        float    w;
+        float    h;
+    } Object;
+
+public:
+    CompactResult();
+    void Clear();
+
+    size_t GetSerializedSize() const;
+    size_t Serialize(uint8_t* buffer, size_t buffer_size) const;  /* return the written size. 0 if the buffer is too small */
+    void Serialize(std::vector<uint8_t>& buffer) const;            /* append to the buffer */
+    bool Deserialize(const uint8_t* data, size_t size);
+
+public:
+    Header header;                  // magic, version, object_size and object_num are set by Serialize
+    std::vector<Object> object_list;
+};
+
+static_assert(sizeof(CompactResult::Header) == 48, "Binary format of CompactResult::Header is changed");
+static_assert(sizeof(CompactResult::Object) == 28, "Binary format of CompactResult::Object is changed");
+static_assert(std::is_trivially_copyable<CompactResult::Header>::value && std::is_trivially_copyable<CompactResult::Object>::value, "CompactResult must be trivially copyable");
+
+
+/* Read a serialized result in place. data must be aligned to 8 bytes and kept while the view is used */
+class CompactResultView {
+public:
+    CompactResultView();
+    bool Set(const uint8_t* data, size_t size);     /* return false if the data is broken or not compatible */
+
+    const CompactResult::Header& GetHeader() const;
+    uint32_t GetObjectNum() const;
+    const CompactResult::Object* GetObjectList() const;
+    size_t GetSize() const;     /* size of this result in data, to read the next result in a stream */
+
+private:
+    const CompactResult::Header* header_;
+    const CompactResult::Object* object_list_;
+};
+
+#endif
@@ -0,0 +1,171 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef ENGINE_POOL_
+#define ENGINE_POOL_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "mpmc_queue.h"
+
+/*
+ * Own K engines, and run tasks from many callers on them in parallel.
+ * Each engine is used by one worker thread only, so an engine doesn't need to be thread safe.
+ * A task receives an engine and writes the result to variables owned by the caller.
+ * T must have Initialize(work_dir, num_threads) and Finalize() (e.g. DetectionEngine)
+ *
+ * e.g.
+ *   EnginePool<DetectionEngine> pool;
+ *   pool.Initialize(4, work_dir, 1);
+ *   DetectionEngine::Result result;       // in each caller thread
+ *   pool.Run([&](DetectionEngine& engine) { return engine.Process(mat, result); });
+ */
+template <typename T>
+class EnginePool {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+    typedef std::function<int32_t(T& engine)> Task;
+
+public:
+    explicit EnginePool(int32_t queue_size = 256) : queue_(queue_size), is_running_(false), pending_num_(0), sleeping_num_(0) {}
+    ~EnginePool() { Finalize(); }
+
+    int32_t Initialize(int32_t engine_num, const std::string& work_dir, int32_t num_threads)
+    {
+        if (is_running_) return kRetErr;
+        for (int32_t i = 0; i < engine_num; i++) {
+            std::unique_ptr<T> engine(new T());
+            if (engine->Initialize(work_dir, num_threads) != T::kRetOk) {
+                engine->Finalize();
+                for (auto& engine_initialized : engine_list_) engine_initialized->Finalize();
+                engine_list_.clear();
+                return kRetErr;
+            }
+            engine_list_.push_back(std::move(engine));
+        }
+        is_running_ = true;
+        for (auto& engine : engine_list_) {
+            thread_list_.push_back(std::thread(&EnginePool::Worker, this, engine.get()));
+        }
+        return kRetOk;
+    }
+
+    /* Tasks already submitted are processed before the workers stop */
+    int32_t Finalize()
+    {
+        if (!is_running_) return kRetOk;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_running_ = false;
+        }
+        cv_.notify_all();
+        for (auto& thread : thread_list_) thread.join();
+        thread_list_.clear();
+
+        int32_t ret = kRetOk;
+        for (auto& engine : engine_list_) {
+            if (engine->Finalize() != T::kRetOk) ret = kRetErr;
+        }
+        engine_list_.clear();
+        return ret;
+    }
+
+    int32_t GetEngineNum() const
+    {
+        return static_cast<int32_t>(engine_list_.size());
+    }
+
+    /* Return immediately. The future gets the return value of the task. Wait while the queue is full */
+    std::future<int32_t> Submit(const Task& task)
+    {
+        Job* job = new Job();
+        job->task = task;
+        std::future<int32_t> future = job->promise.get_future();
+
+        /* Count the job before checking is_running_. A worker exits only when it sees !is_running_ and pending_num_ == 0,
+         * so either the worker sees this job and stays, or this function sees !is_running_ and rejects the job */
+        pending_num_++;
+        if (!is_running_) {
+            pending_num_--;
+            job->promise.set_value(kRetErr);
+            delete job;
+            return future;
+        }
+        while (!queue_.TryPush(job)) {
+            std::this_thread::yield();
+        }
+
+        /* Take the lock only when a worker is sleeping, so that the wake up is not lost */
+        if (sleeping_num_ > 0) {
+            { std::lock_guard<std::mutex> lock(mutex_); }
+            cv_.notify_one();
+        }
+        return future;
+    }
+
+    /* Wait until the task is done, and return its return value */
+    int32_t Run(const Task& task)
+    {
+        return Submit(task).get();
+    }
+
+private:
+    struct Job {
+        Task task;
+        std::promise<int32_t> promise;
+    };
+
+    void Worker(T* engine)
+    {
+        while (true) {
+            Job* job = nullptr;
+            if (queue_.TryPop(job)) {
+                pending_num_--;
+                job->promise.set_value(job->task(*engine));
+                delete job;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!is_running_ && pending_num_ == 0) break;
+            sleeping_num_++;
+            cv_.wait(lock, [this] { return !is_running_ || pending_num_ > 0; });
+            sleeping_num_--;
+        }
+    }
+
+private:
+    MpmcQueue<Job*> queue_;
+    std::vector<std::unique_ptr<T>> engine_list_;
+    std::vector<std::thread> thread_list_;
+
+    std::mutex mutex_;              // only for sleep / wake up of workers
+    std::condition_variable cv_;
+    std::atomic<bool> is_running_;
+    std::atomic<int32_t> pending_num_;
+    std::atomic<int32_t> sleeping_num_;
+};
+
+#endif
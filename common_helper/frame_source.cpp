@@ -0,0 +1,438 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <sys/stat.h>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "common_helper_cv.h"
+#include "blocking_queue.h"
+#include "raw_frame_file.h"
+#include "frame_source.h"
+
+/*** Macro ***/
+#define TAG "FrameSource"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/*** Function ***/
+static bool IsVideoFile(const std::string& name)
+{
+    return name.find(".mp4") != std::string::npos || name.find(".avi") != std::string::npos || name.find(".webm") != std::string::npos;
+}
+
+static bool IsImageFile(const std::string& name)
+{
+    return name.find(".jpg") != std::string::npos || name.find(".png") != std::string::npos || name.find(".bmp") != std::string::npos;
+}
+
+static bool IsRawFrameFile(const std::string& name)
+{
+    return name.find(".raw") != std::string::npos;
+}
+
+static bool IsDirectory(const std::string& name)
+{
+    struct stat st;
+    return stat(name.c_str(), &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+}
+
+static bool ReadFile(const std::string& filename, std::vector<uint8_t>& data)
+{
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (!ifs) return false;
+    data.resize(static_cast<size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    return static_cast<bool>(ifs.read(reinterpret_cast<char*>(data.data()), data.size()));
+}
+
+static int32_t ScaleToImreadFlag(int32_t scale)
+{
+    return (scale == 8) ? cv::IMREAD_REDUCED_COLOR_8 : (scale == 4) ? cv::IMREAD_REDUCED_COLOR_4 : (scale == 2) ? cv::IMREAD_REDUCED_COLOR_2 : cv::IMREAD_COLOR;
+}
+
+
+/*** Video file ***/
+class FrameSourceVideoFile : public FrameSource {
+public:
+    FrameSourceVideoFile() : scale_(1) {}
+    int32_t Open(const std::string& input_name, const Config& config)
+    {
+        cap_ = cv::VideoCapture(input_name);
+        if (!cap_.isOpened()) {
+            printf("Invalid input source: %s\n", input_name.c_str());
+            return kRetErr;
+        }
+        const int32_t width = static_cast<int32_t>(cap_.get(cv::CAP_PROP_FRAME_WIDTH));
+        const int32_t height = static_cast<int32_t>(cap_.get(cv::CAP_PROP_FRAME_HEIGHT));
+        const int32_t scale = SelectScale(width, height, config.target_width, config.target_height);
+        if (scale > 1) {
+            /* Scale before videoconvert, so that color conversion and copy to the app run at the reduced size */
+            char pipeline[1024];
+            snprintf(pipeline, sizeof(pipeline), "filesrc location=\"%s\" ! decodebin ! videoscale ! video/x-raw,width=%d,height=%d ! videoconvert ! video/x-raw,format=BGR ! appsink",
+                input_name.c_str(), width / scale, height / scale);
+            cv::VideoCapture cap_scaled(pipeline, cv::CAP_GSTREAMER);
+            if (cap_scaled.isOpened()) {
+                cap_ = cap_scaled;
+                scale_ = scale;
+            } else {
+                PRINT("Scaled decode is not available. Decode at full size\n");
+            }
+        }
+        return kRetOk;
+    }
+
+    bool Read(cv::Mat& mat, double& timestamp_ms) override
+    {
+        /* read() reuses the buffer of mat if the size is the same */
+        if (!cap_.read(mat)) return false;
+        timestamp_ms = cap_.get(cv::CAP_PROP_POS_MSEC);
+        return true;
+    }
+    bool IsSequence() const override { return true; }
+    int32_t GetScale() const override { return scale_; }
+    int64_t GetPosition() const override { return static_cast<int64_t>(cap_.get(cv::CAP_PROP_POS_FRAMES)); }
+    bool Seek(int64_t position) override
+    {
+        return cap_.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>((std::max)(position, static_cast<int64_t>(0))));
+    }
+
+private:
+    cv::VideoCapture cap_;
+    int32_t scale_;
+};
+
+
+/*** Camera (and other sources of cv::VideoCapture such as stream url) ***/
+class FrameSourceCamera : public FrameSource {
+public:
+    int32_t Open(const std::string& input_name, const Config& config)
+    {
+        /* The capture size is set by FindSourceImage */
+        if (!CommonHelper::FindSourceImage(input_name, cap_)) return kRetErr;
+        return cap_.isOpened() ? kRetOk : kRetErr;
+    }
+
+    bool Read(cv::Mat& mat, double& timestamp_ms) override
+    {
+        if (!cap_.read(mat)) return false;
+        timestamp_ms = cap_.get(cv::CAP_PROP_POS_MSEC);
+        return true;
+    }
+    bool IsSequence() const override { return true; }
+    int32_t GetScale() const override { return 1; }
+
+private:
+    cv::VideoCapture cap_;
+};
+
+
+/*** Image file or image directory ***/
+class FrameSourceImage : public FrameSource {
+public:
+    FrameSourceImage() : is_directory_(false), index_(0), scale_(1), target_width_(0), target_height_(0) {}
+    int32_t Open(const std::string& input_name, const Config& config)
+    {
+        target_width_ = config.target_width;
+        target_height_ = config.target_height;
+        is_directory_ = IsDirectory(input_name);
+        if (is_directory_) {
+            std::vector<cv::String> file_list;
+            cv::glob(input_name + "/*", file_list, false);
+            for (const auto& file : file_list) {
+                if (IsImageFile(file)) filename_list_.push_back(file);
+            }
+            std::sort(filename_list_.begin(), filename_list_.end());
+        } else {
+            filename_list_.push_back(input_name);
+            /* A still image is decoded once and copied for each Read */
+            if (!Decode(input_name, mat_still_)) {
+                printf("Invalid input source: %s\n", input_name.c_str());
+                return kRetErr;
+            }
+        }
+        if (filename_list_.empty()) {
+            printf("Invalid input source: %s\n", input_name.c_str());
+            return kRetErr;
+        }
+        return kRetOk;
+    }
+
+    bool Read(cv::Mat& mat, double& timestamp_ms) override
+    {
+        timestamp_ms = -1;
+        if (!is_directory_) {
+            mat_still_.copyTo(mat);
+            return true;
+        }
+        while (index_ < filename_list_.size()) {
+            if (Decode(filename_list_[index_++], mat)) return true;
+            PRINT_E("Failed to decode: %s\n", filename_list_[index_ - 1].c_str());
+        }
+        return false;
+    }
+    bool IsSequence() const override { return is_directory_; }
+    int32_t GetScale() const override { return scale_; }
+    int64_t GetPosition() const override { return is_directory_ ? static_cast<int64_t>(index_) : -1; }
+    bool Seek(int64_t position) override
+    {
+        if (!is_directory_) return false;
+        const int64_t num = static_cast<int64_t>(filename_list_.size());
+        index_ = static_cast<size_t>((std::min)((std::max)(position, static_cast<int64_t>(0)), num));
+        return true;
+    }
+
+private:
+    bool Decode(const std::string& filename, cv::Mat& mat)
+    {
+        if (!ReadFile(filename, data_)) return false;
+        int32_t width = 0;
+        int32_t height = 0;
+        scale_ = GetJpegSize(data_, width, height) ? SelectScale(width, height, target_width_, target_height_) : 1;
+        /* imdecode with dst reuses the buffer of mat if the size is the same */
+        cv::imdecode(data_, ScaleToImreadFlag(scale_), &mat);
+        return !mat.empty();
+    }
+
+private:
+    bool is_directory_;
+    std::vector<std::string> filename_list_;
+    size_t index_;
+    std::vector<uint8_t> data_;
+    cv::Mat mat_still_;
+    int32_t scale_;
+    int32_t target_width_;
+    int32_t target_height_;
+};
+
+
+/*** Raw frame file ***/
+class FrameSourceRaw : public FrameSource {
+public:
+    FrameSourceRaw() : index_(0) {}
+    int32_t Open(const std::string& input_name, const Config& config)
+    {
+        return reader_.Open(input_name) == RawFrameFile::Reader::kRetOk ? kRetOk : kRetErr;
+    }
+
+    bool Read(cv::Mat& mat, double& timestamp_ms) override
+    {
+        /* No decode. The frame is copied from the mapped file (read only) because the caller draws on it.
+         * copyTo reuses the buffer of mat if the size is the same */
+        const cv::Mat mat_mapped = reader_.GetFrame(index_);
+        if (mat_mapped.empty()) return false;
+        mat_mapped.copyTo(mat);
+        timestamp_ms = reader_.GetTimestamp(index_);
+        index_++;
+        return true;
+    }
+    bool IsSequence() const override { return true; }
+    int32_t GetScale() const override { return 1; }
+    int64_t GetPosition() const override { return index_; }
+    bool Seek(int64_t position) override
+    {
+        index_ = (std::min)((std::max)(position, static_cast<int64_t>(0)), reader_.GetFrameNum());
+        return true;
+    }
+
+private:
+    RawFrameFile::Reader reader_;
+    int64_t index_;
+};
+
+
+/*** Read ahead by a background thread, on top of another source ***/
+class FrameSourceReadAhead : public FrameSource {
+public:
+    FrameSourceReadAhead(FrameSource* source, int32_t read_ahead_num)
+        : source_(source), slot_list_(read_ahead_num + 1), queue_free_(0), queue_filled_(0), index_given_(-1), is_end_(false), scale_(source->GetScale()), position_(source->GetPosition())
+    {
+        /* The thread fills up to read_ahead_num slots, and the caller has one */
+        for (int32_t i = 0; i < static_cast<int32_t>(slot_list_.size()); i++) queue_free_.Push(i);
+        thread_ = std::thread(&FrameSourceReadAhead::ThreadRead, this);
+    }
+    ~FrameSourceReadAhead() override
+    {
+        StopThread();
+    }
+
+    bool Read(cv::Mat& mat, double& timestamp_ms) override
+    {
+        if (index_given_ >= 0) {
+            queue_free_.Push(index_given_);
+            index_given_ = -1;
+        }
+        int32_t index = -1;
+        if (is_end_ || !queue_filled_.Pop(index) || index < 0) {
+            is_end_ = true;
+            mat = cv::Mat();
+            return false;
+        }
+        index_given_ = index;
+        mat = slot_list_[index].mat;
+        timestamp_ms = slot_list_[index].timestamp_ms;
+        scale_ = slot_list_[index].scale;
+        position_ = slot_list_[index].position;
+        return true;
+    }
+    bool IsSequence() const override { return source_->IsSequence(); }
+    int32_t GetScale() const override { return scale_; }
+    int64_t GetPosition() const override { return position_; }
+    bool Seek(int64_t position) override
+    {
+        /* The source is accessed only by the thread, so stop it before seeking. The frames read in advance are discarded */
+        StopThread();
+        int32_t index = -1;
+        while (queue_free_.Pop(index)) {}
+        while (queue_filled_.Pop(index)) {}
+        queue_free_.Open();
+        queue_filled_.Open();
+        for (int32_t i = 0; i < static_cast<int32_t>(slot_list_.size()); i++) {
+            if (i != index_given_) queue_free_.Push(i);     /* the frame given to the caller is valid until the next Read */
+        }
+        bool ret = source_->Seek(position);
+        position_ = source_->GetPosition();
+        is_end_ = false;
+        thread_ = std::thread(&FrameSourceReadAhead::ThreadRead, this);
+        return ret;
+    }
+
+private:
+    typedef struct Slot_ {
+        cv::Mat mat;
+        double  timestamp_ms;
+        int32_t scale;          // the source is accessed only by the thread, so the scale and position of each frame are kept here
+        int64_t position;       // position of the source after reading this frame
+        Slot_() : timestamp_ms(-1), scale(1), position(-1) {}
+    } Slot;
+
+    void ThreadRead()
+    {
+        int32_t index = -1;
+        while (queue_free_.Pop(index)) {
+            Slot& slot = slot_list_[index];
+            if (!source_->Read(slot.mat, slot.timestamp_ms)) {
+                queue_filled_.Push(-1);     /* end */
+                break;
+            }
+            slot.scale = source_->GetScale();
+            slot.position = source_->GetPosition();
+            if (!queue_filled_.Push(index)) break;  /* stopped */
+        }
+    }
+
+    void StopThread()
+    {
+        queue_free_.Close();
+        queue_filled_.Close();
+        if (thread_.joinable()) thread_.join();
+    }
+
+private:
+    std::unique_ptr<FrameSource> source_;
+    std::vector<Slot> slot_list_;
+    BlockingQueue<int32_t> queue_free_;
+    BlockingQueue<int32_t> queue_filled_;
+    int32_t index_given_;
+    bool is_end_;
+    int32_t scale_;
+    int64_t position_;
+    std::thread thread_;
+};
+
+
+/*** FrameSource ***/
+template <typename T>
+static FrameSource* OpenSource(const std::string& input_name, const FrameSource::Config& config)
+{
+    std::unique_ptr<T> source(new T());
+    if (source->Open(input_name, config) != FrameSource::kRetOk) return nullptr;
+    return source.release();
+}
+
+FrameSource* FrameSource::Create(const std::string& input_name, const Config& config)
+{
+    FrameSource* source = nullptr;
+    bool is_file = false;
+    if (IsRawFrameFile(input_name)) {
+        source = OpenSource<FrameSourceRaw>(input_name, config);
+    } else if (IsVideoFile(input_name)) {
+        source = OpenSource<FrameSourceVideoFile>(input_name, config);
+        is_file = true;
+    } else if (IsImageFile(input_name)) {
+        source = OpenSource<FrameSourceImage>(input_name, config);
+    } else if (IsDirectory(input_name)) {
+        source = OpenSource<FrameSourceImage>(input_name, config);
+        is_file = true;
+    } else {
+        source = OpenSource<FrameSourceCamera>(input_name, config);
+    }
+
+    if (source && is_file && config.read_ahead_num > 0) {
+        source = new FrameSourceReadAhead(source, config.read_ahead_num);
+    }
+    return source;
+}
+
+int32_t FrameSource::SelectScale(int32_t width, int32_t height, int32_t target_width, int32_t target_height)
+{
+    if (width <= 0 || height <= 0 || target_width <= 0 || target_height <= 0) return 1;
+    /* Compare long side with long side, so that rotation (e.g. EXIF orientation) doesn't matter */
+    const int32_t long_side = (std::max)(width, height);
+    const int32_t short_side = (std::min)(width, height);
+    const int32_t target_long_side = (std::max)(target_width, target_height);
+    const int32_t target_short_side = (std::min)(target_width, target_height);
+    for (int32_t scale = 8; scale > 1; scale /= 2) {
+        if (long_side / scale >= target_long_side && short_side / scale >= target_short_side) return scale;
+    }
+    return 1;
+}
+
+bool FrameSource::GetJpegSize(const std::vector<uint8_t>& data, int32_t& width, int32_t& height)
+{
+    if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;  /* SOI */
+    size_t pos = 2;
+    while (pos + 4 <= data.size()) {
+        if (data[pos] != 0xFF) return false;
+        while (pos < data.size() && data[pos] == 0xFF) pos++;   /* fill bytes */
+        if (pos + 3 > data.size()) return false;
+        const uint8_t marker = data[pos++];
+        if (marker == 0xD9 || marker == 0xDA) return false;     /* EOI, SOS: no frame header */
+        if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) continue;  /* no length */
+        const size_t length = (static_cast<size_t>(data[pos]) << 8) | data[pos + 1];
+        if (length < 2) return false;
+        /* SOF0 - SOF15 except DHT, JPG, DAC */
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 7 > data.size()) return false;
+            height = (data[pos + 3] << 8) | data[pos + 4];
+            width = (data[pos + 5] << 8) | data[pos + 6];
+            return width > 0 && height > 0;
+        }
+        pos += length;
+    }
+    return false;
+}
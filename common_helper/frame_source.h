@@ -0,0 +1,78 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef FRAME_SOURCE_
+#define FRAME_SOURCE_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Input frames from video file, camera, image file, image directory or raw frame file (RawFrameFile).
+ * Create one with FrameSource::Create, which selects the implementation by input_name.
+ *
+ * Decode at reduced size: with the target size (= the input size of the model), frames are decoded at 1/2, 1/4 or 1/8 size
+ * as long as they are still bigger than the target, so that the full size frame is not decoded and then shrunk by the pre process.
+ *   JPEG  : DCT scaling of the decoder (cv::IMREAD_REDUCED_COLOR_*)
+ *   Video : scaled in the GStreamer pipeline before color conversion, if OpenCV has GStreamer. Otherwise full size
+ *   Others: full size (the decoder can't scale)
+ * Results on the frame are in the coordinates of the reduced frame. Multiply by GetScale() for the original size.
+ * The scale can be different for each image of an image directory.
+ *
+ * Read ahead: frames of video file and image directory are decoded by a background thread up to read_ahead_num frames in advance,
+ * into buffers which are recycled, so that the caller doesn't wait for decode.
+ * Camera is not read ahead to keep the latency. Raw frame file is already decoded and mapped (copied for each Read).
+ * Seek discards the frames read in advance and restarts the background thread from the new position.
+ */
+class FrameSource {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Config_ {
+        int32_t target_width;       // 0 = full size
+        int32_t target_height;      // 0 = full size
+        int32_t read_ahead_num;     // 0 = decode in the caller thread
+        Config_() : target_width(0), target_height(0), read_ahead_num(4) {}
+    } Config;
+
+public:
+    static FrameSource* Create(const std::string& input_name, const Config& config = Config());     /* return nullptr on error */
+    virtual ~FrameSource() {}
+
+    /* Return false at the end. The frame is valid until the next Read, because the buffer is reused (clone it to keep).
+     * A still image is returned repeatedly (decoded once) */
+    virtual bool Read(cv::Mat& mat, double& timestamp_ms) = 0;
+    virtual bool IsSequence() const = 0;    /* false for a still image */
+    virtual int32_t GetScale() const = 0;   /* 1, 2, 4 or 8, of the frame returned by the last Read */
+
+    /* Position is the index of the frame returned by the next Read. Seek returns false if the source can't seek (camera, still image) */
+    virtual int64_t GetPosition() const { return -1; }
+    virtual bool Seek(int64_t position) { return false; }
+
+    static int32_t SelectScale(int32_t width, int32_t height, int32_t target_width, int32_t target_height);
+    static bool GetJpegSize(const std::vector<uint8_t>& data, int32_t& width, int32_t& height);    /* parse the header only. false if not JPEG */
+
+protected:
+    FrameSource() {}
+};
+
+#endif
@@ -0,0 +1,88 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "motion_gate.h"
+
+
+MotionGate::MotionGate()
+{
+    Reset();
+}
+
+MotionGate::~MotionGate()
+{
+}
+
+void MotionGate::SetConfig(const Config& config)
+{
+    config_ = config;
+    Reset();
+}
+
+void MotionGate::Reset()
+{
+    mat_reference_.release();
+    cnt_skip_ = 0;
+    time_check_ = 0;
+}
+
+bool MotionGate::Check(const cv::Mat& mat)
+{
+    if (config_.max_interval <= 1 || mat.empty()) return true;
+
+    const auto& t0 = std::chrono::steady_clock::now();
+    cv::Mat mat_small;
+    const int32_t height = (std::max)(1, mat.rows * config_.width / mat.cols);
+    cv::resize(mat, mat_small, cv::Size(config_.width, height), 0, 0, cv::INTER_AREA);
+    if (mat_small.channels() == 3) cv::cvtColor(mat_small, mat_small, cv::COLOR_BGR2GRAY);
+
+    bool is_changed = true;
+    if (!mat_reference_.empty() && mat_reference_.size() == mat_small.size() && cnt_skip_ + 1 < config_.max_interval) {
+        cv::Mat mat_diff;
+        cv::absdiff(mat_small, mat_reference_, mat_diff);
+        const int32_t changed_num = cv::countNonZero(mat_diff > config_.threshold_diff);
+        is_changed = changed_num > config_.threshold_changed_ratio * mat_diff.total();
+    }
+
+    if (is_changed) {
+        mat_reference_ = mat_small;
+        cnt_skip_ = 0;
+    } else {
+        cnt_skip_++;
+    }
+    const auto& t1 = std::chrono::steady_clock::now();
+    time_check_ = static_cast<std::chrono::duration<double>>(t1 - t0).count() * 1000.0;
+    return is_changed;
+}
+
+int32_t MotionGate::GetSkipCount() const
+{
+    return cnt_skip_;
+}
+
+double MotionGate::GetTimeCheck() const
+{
+    return time_check_;
+}
@@ -0,0 +1,60 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef MOTION_GATE_
+#define MOTION_GATE_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * Check if the scene changed from the last inferred frame, so that inference can be skipped for a static scene.
+ * The frame is downsampled so that each pixel is the mean luminance of a block, and blocks are compared with the reference frame.
+ * The reference is updated only when inference is needed, so slow changes are also accumulated.
+ */
+class MotionGate {
+public:
+    typedef struct Config_ {
+        int32_t width;                  // width of the downsampled frame (= the number of blocks in a row)
+        float   threshold_diff;         // a block is changed when its mean luminance differs more than this value [0 - 255]
+        float   threshold_changed_ratio;    // the scene is changed when the ratio of changed blocks exceeds this value
+        int32_t max_interval;           // inference runs at least every this frames. 0, 1 = every frame (gate is disabled)
+        Config_() : width(64), threshold_diff(10.0F), threshold_changed_ratio(0.002F), max_interval(0) {}
+    } Config;
+
+public:
+    MotionGate();
+    ~MotionGate();
+    void SetConfig(const Config& config);
+    void Reset();
+
+    /* return true when inference is needed. The frame becomes the reference in that case */
+    bool Check(const cv::Mat& mat);
+
+    int32_t GetSkipCount() const;   // the number of frames skipped since the last inference
+    double GetTimeCheck() const;    // [msec] processing time of the last Check
+
+private:
+    Config config_;
+    cv::Mat mat_reference_;
+    int32_t cnt_skip_;
+    double time_check_;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef MPMC_QUEUE_
+#define MPMC_QUEUE_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+/* Bounded lock-free queue for multiple producers and multiple consumers (D. Vyukov's algorithm)
+ * Each cell has a sequence number which tells whether the cell is ready to be written or read in the current lap.
+ * capacity is rounded up to a power of 2 */
+template <typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        mask_ = size - 1;
+        cell_list_ = std::vector<Cell>(size);
+        for (size_t i = 0; i < size; i++) {
+            cell_list_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        pos_enqueue_.store(0, std::memory_order_relaxed);
+        pos_dequeue_.store(0, std::memory_order_relaxed);
+    }
+
+    /* return false when the queue is full */
+    bool TryPush(const T& item)
+    {
+        Cell* cell;
+        size_t pos = pos_enqueue_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cell_list_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (pos_enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = pos_enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* return false when the queue is empty */
+    bool TryPop(T& item)
+    {
+        Cell* cell;
+        size_t pos = pos_dequeue_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cell_list_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (pos_dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = pos_dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        item = cell->item;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t GetCapacity() const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T item;
+        Cell() : sequence(0), item() {}
+        Cell(const Cell& cell) : sequence(cell.sequence.load()), item(cell.item) {}
+    };
+
+    /* keep producers and consumers on different cache lines */
+    alignas(64) std::vector<Cell> cell_list_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> pos_enqueue_;
+    alignas(64) std::atomic<size_t> pos_dequeue_;
+};
+
+#endif
@@ -0,0 +1,256 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "raw_frame_file.h"
+
+/*** Macro ***/
+#define TAG "RawFrameFile"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+using namespace RawFrameFile;
+
+static constexpr size_t kAlign = 64;
+
+/*** Function ***/
+static size_t AlignSize(size_t size)
+{
+    return (size + kAlign - 1) / kAlign * kAlign;
+}
+
+/*** Writer ***/
+Writer::Writer()
+    : fp_(nullptr)
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+Writer::~Writer()
+{
+    if (fp_) Close();
+}
+
+int32_t Writer::Open(const std::string& filename)
+{
+    if (fp_) {
+        PRINT_E("Already opened\n");
+        return kRetErr;
+    }
+    fp_ = fopen(filename.c_str(), "wb");
+    if (!fp_) {
+        PRINT_E("Failed to open: %s\n", filename.c_str());
+        return kRetErr;
+    }
+    memset(&header_, 0, sizeof(header_));
+    header_.magic = kMagic;
+    header_.version = kVersion;
+    /* The size is written at the first frame, and the number of frames is written at Close */
+    fwrite(&header_, sizeof(header_), 1, fp_);
+    return kRetOk;
+}
+
+int32_t Writer::Write(const cv::Mat& mat, int64_t frame_index, double timestamp_ms)
+{
+    if (!fp_ || mat.empty()) return kRetErr;
+    if (header_.frame_num == 0) {
+        header_.width = mat.cols;
+        header_.height = mat.rows;
+        header_.type = mat.type();
+        header_.step = static_cast<int32_t>(mat.cols * mat.elemSize());
+        header_.frame_stride = AlignSize(sizeof(FrameHeader) + static_cast<size_t>(header_.step) * header_.height);
+        buffer_.assign(static_cast<size_t>(header_.frame_stride), 0);
+
+        /* Write the size now, so that the file can be read even if the writer is killed before Close (frame_num is still 0) */
+        fseek(fp_, 0, SEEK_SET);
+        const bool is_header_ok = fwrite(&header_, sizeof(header_), 1, fp_) == 1;
+        fflush(fp_);
+        fseek(fp_, 0, SEEK_END);
+        if (!is_header_ok) {
+            PRINT_E("Failed to write\n");
+            return kRetErr;
+        }
+    }
+    if (mat.type() != header_.type) {
+        PRINT_E("Type of the frame is different from the first frame\n");
+        return kRetErr;
+    }
+
+    FrameHeader* frame_header = reinterpret_cast<FrameHeader*>(buffer_.data());
+    frame_header->frame_index = frame_index;
+    frame_header->timestamp_ms = timestamp_ms;
+    cv::Mat mat_dst(header_.height, header_.width, header_.type, buffer_.data() + sizeof(FrameHeader), header_.step);
+    if (mat.cols == header_.width && mat.rows == header_.height) {
+        mat.copyTo(mat_dst);
+    } else {
+        cv::resize(mat, mat_dst, mat_dst.size());
+    }
+    if (fwrite(buffer_.data(), 1, buffer_.size(), fp_) != buffer_.size()) {
+        PRINT_E("Failed to write\n");
+        return kRetErr;
+    }
+    header_.frame_num++;
+    return kRetOk;
+}
+
+int32_t Writer::Close()
+{
+    if (!fp_) {
+        PRINT_E("Not opened\n");
+        return kRetErr;
+    }
+    fseek(fp_, 0, SEEK_SET);
+    const bool is_ok = fwrite(&header_, sizeof(header_), 1, fp_) == 1;
+    fclose(fp_);
+    fp_ = nullptr;
+    return is_ok ? kRetOk : kRetErr;
+}
+
+int64_t Writer::GetFrameNum() const
+{
+    return static_cast<int64_t>(header_.frame_num);
+}
+
+/*** Reader ***/
+Reader::Reader()
+    : data_(nullptr), data_size_(0), frame_num_(0)
+{
+    memset(&header_, 0, sizeof(header_));
+}
+
+Reader::~Reader()
+{
+    Close();
+}
+
+int32_t Reader::Open(const std::string& filename)
+{
+    Close();
+#ifdef _WIN32
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        PRINT_E("Failed to open: %s\n", filename.c_str());
+        return kRetErr;
+    }
+    fseek(fp, 0, SEEK_END);
+    buffer_.resize(static_cast<size_t>(_ftelli64(fp)));
+    fseek(fp, 0, SEEK_SET);
+    buffer_.resize(fread(buffer_.data(), 1, buffer_.size(), fp));
+    fclose(fp);
+    data_ = buffer_.data();
+    data_size_ = buffer_.size();
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        PRINT_E("Failed to open: %s\n", filename.c_str());
+        if (fd >= 0) close(fd);
+        return kRetErr;
+    }
+    /* Pages are loaded on demand, and shared with the page cache */
+    void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        PRINT_E("mmap failed: %s\n", filename.c_str());
+        return kRetErr;
+    }
+    data_ = static_cast<uint8_t*>(data);
+    data_size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    if (data_size_ >= sizeof(Header)) memcpy(&header_, data_, sizeof(Header));
+    if (data_size_ < sizeof(Header) || header_.magic != kMagic || header_.version != kVersion) {
+        PRINT_E("Not a raw frame file: %s\n", filename.c_str());
+        Close();
+        return kRetErr;
+    }
+    if (header_.frame_stride < sizeof(FrameHeader) + static_cast<uint64_t>(header_.step) * header_.height) {
+        frame_num_ = 0;
+    } else {
+        frame_num_ = static_cast<int64_t>((data_size_ - sizeof(Header)) / header_.frame_stride);
+        if (header_.frame_num > 0) frame_num_ = (std::min)(frame_num_, static_cast<int64_t>(header_.frame_num));
+    }
+    return kRetOk;
+}
+
+int32_t Reader::Close()
+{
+#ifndef _WIN32
+    if (data_) munmap(data_, data_size_);
+#endif
+    buffer_.clear();
+    data_ = nullptr;
+    data_size_ = 0;
+    frame_num_ = 0;
+    return kRetOk;
+}
+
+int64_t Reader::GetFrameNum() const
+{
+    return frame_num_;
+}
+
+const FrameHeader* Reader::GetFrameHeader(int64_t index) const
+{
+    if (index < 0 || index >= frame_num_) return nullptr;
+    return reinterpret_cast<const FrameHeader*>(data_ + sizeof(Header) + header_.frame_stride * static_cast<uint64_t>(index));
+}
+
+cv::Mat Reader::GetFrame(int64_t index) const
+{
+    if (index < 0 || index >= frame_num_) return cv::Mat();
+    uint8_t* pixel = data_ + sizeof(Header) + header_.frame_stride * static_cast<uint64_t>(index) + sizeof(FrameHeader);
+    return cv::Mat(header_.height, header_.width, header_.type, pixel, header_.step);
+}
+
+int64_t Reader::GetFrameIndex(int64_t index) const
+{
+    const FrameHeader* frame_header = GetFrameHeader(index);
+    return frame_header ? frame_header->frame_index : -1;
+}
+
+double Reader::GetTimestamp(int64_t index) const
+{
+    const FrameHeader* frame_header = GetFrameHeader(index);
+    return frame_header ? frame_header->timestamp_ms : -1;
+}
+
+int32_t Reader::GetWidth() const
+{
+    return header_.width;
+}
+
+int32_t Reader::GetHeight() const
+{
+    return header_.height;
+}
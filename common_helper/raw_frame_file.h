@@ -0,0 +1,115 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef RAW_FRAME_FILE_
+#define RAW_FRAME_FILE_
+
+/* for general */
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/*
+ * File of decoded frames, to benchmark pipelines without decode time.
+ * File = Header, then frames. Frame = FrameHeader + pixels (rows are not padded), aligned to 64 bytes.
+ * All the frames have the same size and type as the first frame.
+ */
+namespace RawFrameFile
+{
+
+static constexpr uint32_t kMagic = 0x46524A50;     /* "PJRF" */
+static constexpr uint32_t kVersion = 1;
+
+typedef struct Header_ {
+    uint32_t magic;
+    uint32_t version;
+    int32_t  width;
+    int32_t  height;
+    int32_t  type;          // cv::Mat type
+    int32_t  step;          // bytes per row
+    uint64_t frame_stride;  // bytes from a frame to the next frame
+    uint64_t frame_num;     // 0 if the writer didn't close the file. The reader uses the file size then
+    uint32_t reserved[6];
+} Header;
+
+typedef struct FrameHeader_ {
+    int64_t  frame_index;   // in the source
+    double   timestamp_ms;
+    uint32_t reserved[12];
+} FrameHeader;
+
+static_assert(sizeof(Header) == 64, "Binary format of RawFrameFile::Header is changed");
+static_assert(sizeof(FrameHeader) == 64, "Binary format of RawFrameFile::FrameHeader is changed");
+
+class Writer {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    Writer();
+    ~Writer();
+    int32_t Open(const std::string& filename);
+    int32_t Write(const cv::Mat& mat, int64_t frame_index, double timestamp_ms);   /* resized to the size of the first frame if different */
+    int32_t Close();
+    int64_t GetFrameNum() const;
+
+private:
+    FILE* fp_;
+    Header header_;
+    std::vector<uint8_t> buffer_;
+};
+
+/* Frames are served as cv::Mat views on the mapped file without copy.
+ * The mapping is read only. Don't write to the view (copy it to draw the result) */
+class Reader {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+public:
+    Reader();
+    ~Reader();
+    int32_t Open(const std::string& filename);
+    int32_t Close();
+
+    int64_t GetFrameNum() const;
+    cv::Mat GetFrame(int64_t index) const;      /* read only view. empty if index is out of range. Valid until Close */
+    int64_t GetFrameIndex(int64_t index) const; /* frame index in the source */
+    double GetTimestamp(int64_t index) const;   /* [msec] */
+    int32_t GetWidth() const;
+    int32_t GetHeight() const;
+
+private:
+    const FrameHeader* GetFrameHeader(int64_t index) const;
+
+private:
+    uint8_t* data_;
+    size_t data_size_;
+    std::vector<uint8_t> buffer_;   // for the platform without mmap
+    Header header_;
+    int64_t frame_num_;
+};
+
+}
+
+#endif
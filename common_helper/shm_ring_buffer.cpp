@@ -0,0 +1,273 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/* for shared memory */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* for My modules */
+#include "common_helper.h"
+#include "shm_ring_buffer.h"
+
+/*** Macro ***/
+#define TAG "ShmRingBuffer"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+static constexpr size_t kAlign = 64;
+
+/*** Function ***/
+static size_t AlignSize(size_t size)
+{
+    return (size + kAlign - 1) / kAlign * kAlign;
+}
+
+ShmRingBuffer::ShmRingBuffer()
+    : is_owner_(false), memory_(nullptr), memory_size_(0), slot_stride_(0), control_(nullptr), slot_top_(nullptr)
+    , cached_read_index_(0), cached_write_index_(0)
+{
+}
+
+ShmRingBuffer::~ShmRingBuffer()
+{
+    Finalize();
+}
+
+int32_t ShmRingBuffer::Map(const std::string& name, size_t size, bool is_create)
+{
+    int fd = -1;
+    if (is_create) {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            PRINT_E("ftruncate failed: %s\n", name.c_str());
+            close(fd);
+            shm_unlink(name.c_str());
+            return kRetErr;
+        }
+    } else {
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            size = static_cast<size_t>(st.st_size);
+        }
+    }
+    if (fd < 0) {
+        PRINT_E("shm_open failed: %s\n", name.c_str());
+        return kRetErr;
+    }
+    if (size < sizeof(Control)) {
+        close(fd);
+        return kRetErr;
+    }
+
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);      /* the mapping remains */
+    if (memory == MAP_FAILED) {
+        PRINT_E("mmap failed: %s\n", name.c_str());
+        if (is_create) shm_unlink(name.c_str());
+        return kRetErr;
+    }
+    name_ = name;
+    is_owner_ = is_create;
+    memory_ = static_cast<uint8_t*>(memory);
+    memory_size_ = size;
+    return kRetOk;
+}
+
+int32_t ShmRingBuffer::Create(const std::string& name, uint32_t slot_num, uint32_t slot_size)
+{
+    Finalize();
+    if (slot_num == 0 || slot_size == 0) {
+        PRINT_E("Invalid size\n");
+        return kRetErr;
+    }
+    slot_stride_ = AlignSize(sizeof(SlotHeader) + slot_size);
+    if (Map(name, AlignSize(sizeof(Control)) + slot_stride_ * slot_num, true) != kRetOk) {
+        return kRetErr;
+    }
+
+    /* ftruncate fills zero. Construct Control in place, and publish it by magic at last */
+    control_ = new (memory_) Control();
+    control_->version = kVersion;
+    control_->slot_num = slot_num;
+    control_->slot_size = slot_size;
+    control_->is_closed.store(0, std::memory_order_relaxed);
+    control_->open_num.store(0, std::memory_order_relaxed);
+    control_->write_index.store(0, std::memory_order_relaxed);
+    control_->read_index.store(0, std::memory_order_relaxed);
+    control_->magic.store(kMagic, std::memory_order_release);
+    slot_top_ = memory_ + AlignSize(sizeof(Control));
+    cached_read_index_ = 0;
+    cached_write_index_ = 0;
+    return kRetOk;
+}
+
+int32_t ShmRingBuffer::Open(const std::string& name)
+{
+    Finalize();
+    if (Map(name, 0, false) != kRetOk) {
+        return kRetErr;
+    }
+    Control* control = reinterpret_cast<Control*>(memory_);
+    if (control->magic.load(std::memory_order_acquire) != kMagic || control->version != kVersion) {
+        Finalize();
+        return kRetErr;
+    }
+    /* Don't trust the values in the shared memory. Check without overflow */
+    const size_t slot_stride = AlignSize(sizeof(SlotHeader) + control->slot_size);
+    if (control->slot_num == 0 || control->slot_size == 0 || AlignSize(sizeof(Control)) > memory_size_
+        || control->slot_num > (memory_size_ - AlignSize(sizeof(Control))) / slot_stride) {
+        PRINT_E("Broken shared memory: %s\n", name.c_str());
+        Finalize();
+        return kRetErr;
+    }
+    control_ = control;
+    slot_stride_ = slot_stride;
+    slot_top_ = memory_ + AlignSize(sizeof(Control));
+    cached_read_index_ = control_->read_index.load(std::memory_order_acquire);
+    cached_write_index_ = control_->write_index.load(std::memory_order_acquire);
+    control_->open_num.fetch_add(1, std::memory_order_acq_rel);
+    return kRetOk;
+}
+
+int32_t ShmRingBuffer::Finalize()
+{
+    if (memory_) {
+        munmap(memory_, memory_size_);
+        if (is_owner_) shm_unlink(name_.c_str());
+    }
+    name_.clear();
+    is_owner_ = false;
+    memory_ = nullptr;
+    memory_size_ = 0;
+    slot_stride_ = 0;
+    control_ = nullptr;
+    slot_top_ = nullptr;
+    return kRetOk;
+}
+
+ShmRingBuffer::SlotHeader* ShmRingBuffer::GetSlot(uint64_t index) const
+{
+    return reinterpret_cast<SlotHeader*>(slot_top_ + slot_stride_ * (index % control_->slot_num));
+}
+
+uint8_t* ShmRingBuffer::AcquireWrite()
+{
+    if (!control_) return nullptr;
+    const uint64_t write_index = control_->write_index.load(std::memory_order_relaxed);
+    if (write_index - cached_read_index_ >= control_->slot_num) {
+        cached_read_index_ = control_->read_index.load(std::memory_order_acquire);
+        if (write_index - cached_read_index_ >= control_->slot_num) return nullptr;
+    }
+    return reinterpret_cast<uint8_t*>(GetSlot(write_index)) + sizeof(SlotHeader);
+}
+
+int32_t ShmRingBuffer::CommitWrite(uint32_t data_size, uint64_t sequence)
+{
+    if (!control_ || data_size > control_->slot_size) return kRetErr;
+    const uint64_t write_index = control_->write_index.load(std::memory_order_relaxed);
+    SlotHeader* slot = GetSlot(write_index);
+    slot->sequence = sequence;
+    slot->data_size = data_size;
+    control_->write_index.store(write_index + 1, std::memory_order_release);
+    return kRetOk;
+}
+
+void ShmRingBuffer::Close()
+{
+    if (control_) control_->is_closed.store(1, std::memory_order_release);
+}
+
+bool ShmRingBuffer::WaitForConsumer(int32_t timeout_ms) const
+{
+    if (!control_) return false;
+    const auto& time_start = std::chrono::steady_clock::now();
+    while (control_->open_num.load(std::memory_order_acquire) == 0
+        || control_->read_index.load(std::memory_order_acquire) != control_->write_index.load(std::memory_order_relaxed)) {
+        if (std::chrono::steady_clock::now() - time_start >= std::chrono::milliseconds(timeout_ms)) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+uint8_t* ShmRingBuffer::AcquireRead(uint32_t& data_size, uint64_t& sequence)
+{
+    if (!control_) return nullptr;
+    const uint64_t read_index = control_->read_index.load(std::memory_order_relaxed);
+    if (read_index == cached_write_index_) {
+        cached_write_index_ = control_->write_index.load(std::memory_order_acquire);
+        if (read_index == cached_write_index_) return nullptr;
+    }
+    SlotHeader* slot = GetSlot(read_index);
+    data_size = slot->data_size;
+    sequence = slot->sequence;
+    return reinterpret_cast<uint8_t*>(slot) + sizeof(SlotHeader);
+}
+
+uint8_t* ShmRingBuffer::AcquireRead(uint32_t& data_size, uint64_t& sequence, int32_t timeout_ms)
+{
+    const auto& time_start = std::chrono::steady_clock::now();
+    while (true) {
+        uint8_t* data = AcquireRead(data_size, sequence);
+        if (data || !control_ || IsClosed()) return data;
+        if (std::chrono::steady_clock::now() - time_start >= std::chrono::milliseconds(timeout_ms)) return nullptr;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+int32_t ShmRingBuffer::ReleaseRead()
+{
+    if (!control_) return kRetErr;
+    const uint64_t read_index = control_->read_index.load(std::memory_order_relaxed);
+    if (read_index == cached_write_index_) return kRetErr;  /* nothing acquired */
+    control_->read_index.store(read_index + 1, std::memory_order_release);
+    return kRetOk;
+}
+
+bool ShmRingBuffer::IsClosed() const
+{
+    if (!control_) return true;
+    /* Check is_closed first, so that data written before Close is not missed */
+    if (control_->is_closed.load(std::memory_order_acquire) == 0) return false;
+    return control_->read_index.load(std::memory_order_relaxed) == control_->write_index.load(std::memory_order_acquire);
+}
+
+uint32_t ShmRingBuffer::GetSlotNum() const
+{
+    return control_ ? control_->slot_num : 0;
+}
+
+uint32_t ShmRingBuffer::GetSlotSize() const
+{
+    return control_ ? control_->slot_size : 0;
+}
+
+uint32_t ShmRingBuffer::GetUsedSlotNum() const
+{
+    if (!control_) return 0;
+    return static_cast<uint32_t>(control_->write_index.load(std::memory_order_acquire) - control_->read_index.load(std::memory_order_acquire));
+}
@@ -0,0 +1,107 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef SHM_RING_BUFFER_
+#define SHM_RING_BUFFER_
+
+/* for general */
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+
+/*
+ * Single producer / single consumer ring buffer on POSIX shared memory (shm_open + mmap), to pass data b/w processes without copy.
+ * The buffer has slot_num fixed size slots. The producer writes data into a slot directly and publishes it by CommitWrite,
+ * and the consumer reads (or even modifies) the data in the slot directly until ReleaseRead.
+ * The write / read indices are lock-free atomics in the shared memory, so the processes don't need any lock or system call per data.
+ * Each data has a sequence number given by the producer, so that the consumer can detect dropped data.
+ */
+class ShmRingBuffer {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+    static constexpr uint32_t kMagic = 0x46525348;  /* "HSRF" */
+    static constexpr uint32_t kVersion = 2;
+
+private:
+    /* Layout in the shared memory: Control, then slot_num x (SlotHeader + data), each aligned to the cache line */
+    typedef struct Control_ {
+        std::atomic<uint32_t> magic;    // set at last by the creator, so that Open doesn't see a half initialized buffer
+        uint32_t version;
+        uint32_t slot_num;
+        uint32_t slot_size;
+        std::atomic<uint32_t> is_closed;
+        std::atomic<uint32_t> open_num;     // number of Open by consumers
+        alignas(64) std::atomic<uint64_t> write_index;  // written only by the producer
+        alignas(64) std::atomic<uint64_t> read_index;   // written only by the consumer
+    } Control;
+
+    typedef struct SlotHeader_ {
+        uint64_t sequence;
+        uint32_t data_size;
+        uint32_t reserved;
+    } SlotHeader;
+
+public:
+    ShmRingBuffer();
+    ~ShmRingBuffer();
+
+    /* The creator owns the shared memory and removes it in Finalize. A stale one of the same name is removed */
+    int32_t Create(const std::string& name, uint32_t slot_num, uint32_t slot_size);
+    /* Attach to the shared memory created by another process. Fails until the creator completes initialization */
+    int32_t Open(const std::string& name);
+    int32_t Finalize();
+
+    /* Producer. AcquireWrite returns nullptr when all the slots are used by the consumer (the caller drops or retries) */
+    uint8_t* AcquireWrite();
+    int32_t CommitWrite(uint32_t data_size, uint64_t sequence);
+    void Close();           // tell the consumer that no more data comes
+    /* Wait until a consumer has opened the buffer and read all the data, so that the data is not lost by Finalize (unlink).
+     * Return false on timeout */
+    bool WaitForConsumer(int32_t timeout_ms) const;
+
+    /* Consumer. AcquireRead returns nullptr when there is no data. The data is valid until ReleaseRead */
+    uint8_t* AcquireRead(uint32_t& data_size, uint64_t& sequence);
+    uint8_t* AcquireRead(uint32_t& data_size, uint64_t& sequence, int32_t timeout_ms);   /* wait for data by polling */
+    int32_t ReleaseRead();
+    bool IsClosed() const;  // true after the producer closed it and all the data were read
+
+    uint32_t GetSlotNum() const;
+    uint32_t GetSlotSize() const;
+    uint32_t GetUsedSlotNum() const;
+
+private:
+    int32_t Map(const std::string& name, size_t size, bool is_create);
+    SlotHeader* GetSlot(uint64_t index) const;
+
+private:
+    std::string name_;
+    bool is_owner_;
+    uint8_t* memory_;
+    size_t memory_size_;
+    size_t slot_stride_;
+    Control* control_;
+    uint8_t* slot_top_;
+
+    /* Local copies of the other side's index, to avoid reading the shared cache line for every data */
+    uint64_t cached_read_index_;
+    uint64_t cached_write_index_;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "ShmRingBuffer needs lock-free 64-bit atomics to share them b/w processes");
+
+#endif
@@ -0,0 +1,109 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "task_graph.h"
+
+/*** Function ***/
+TaskGraph::TaskGraph(int32_t thread_num) : remaining_task_num_(0), is_exit_(false)
+{
+    for (int32_t i = 0; i < thread_num; i++) {
+        thread_list_.push_back(std::thread(&TaskGraph::ThreadWorker, this));
+    }
+}
+
+TaskGraph::~TaskGraph()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_exit_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : thread_list_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+int32_t TaskGraph::AddTask(const Task& task, const std::vector<int32_t>& dependency_list)
+{
+    const int32_t id = static_cast<int32_t>(node_list_.size());
+    Node node;
+    node.task = task;
+    node.dependency_num = 0;
+    node.remaining_dependency_num = 0;
+    for (int32_t dependency : dependency_list) {
+        if (dependency < 0 || dependency >= id) continue;   /* only tasks added before, so that the graph has no cycle */
+        node_list_[dependency].next_list.push_back(id);
+        node.dependency_num++;
+    }
+    node_list_.push_back(node);
+    return id;
+}
+
+void TaskGraph::Run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    remaining_task_num_ = static_cast<int32_t>(node_list_.size());
+    for (int32_t id = 0; id < static_cast<int32_t>(node_list_.size()); id++) {
+        node_list_[id].remaining_dependency_num = node_list_[id].dependency_num;
+        if (node_list_[id].dependency_num == 0) ready_list_.push_back(id);
+    }
+    cv_.notify_all();
+
+    while (remaining_task_num_ > 0) {
+        if (!ExecuteOne(lock)) {
+            cv_.wait(lock, [this] { return remaining_task_num_ == 0 || !ready_list_.empty(); });
+        }
+    }
+}
+
+void TaskGraph::ThreadWorker()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return is_exit_ || !ready_list_.empty(); });
+        if (is_exit_) break;
+        ExecuteOne(lock);
+    }
+}
+
+bool TaskGraph::ExecuteOne(std::unique_lock<std::mutex>& lock)
+{
+    if (ready_list_.empty()) return false;
+    const int32_t id = ready_list_.front();
+    ready_list_.pop_front();
+
+    lock.unlock();
+    node_list_[id].task();
+    lock.lock();
+
+    int32_t ready_num = 0;
+    for (int32_t next : node_list_[id].next_list) {
+        if (--node_list_[next].remaining_dependency_num == 0) {
+            ready_list_.push_back(next);
+            ready_num++;
+        }
+    }
+    remaining_task_num_--;
+    if (ready_num > 0 || remaining_task_num_ == 0) cv_.notify_all();
+    return true;
+}
@@ -0,0 +1,73 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef TASK_GRAPH_
+#define TASK_GRAPH_
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Run tasks with dependencies on worker threads. Tasks without dependency between them run at the same time.
+ * Build the graph once, then call Run for each frame. Run returns when all the tasks are done.
+ * The caller thread of Run also executes tasks, so thread_num = 1 is enough for two branches.
+ * Tasks communicate through variables owned by the user (e.g. the context of a pipeline).
+ *
+ * e.g.
+ *   TaskGraph graph(1);
+ *   int32_t id_seg = graph.AddTask([&]() { ... });
+ *   int32_t id_det = graph.AddTask([&]() { ... });
+ *   graph.AddTask([&]() { ... }, { id_seg, id_det });   // join
+ *   graph.Run();
+ */
+class TaskGraph {
+public:
+    typedef std::function<void(void)> Task;
+
+public:
+    explicit TaskGraph(int32_t thread_num);
+    ~TaskGraph();
+
+    /* Return the id of the task. dependency_list is ids of tasks which must finish before this task. Don't call while Run */
+    int32_t AddTask(const Task& task, const std::vector<int32_t>& dependency_list = std::vector<int32_t>());
+    void Run();
+    int32_t GetThreadNum() const { return static_cast<int32_t>(thread_list_.size()); }
+
+private:
+    typedef struct Node_ {
+        Task                 task;
+        std::vector<int32_t> next_list;        // tasks which depend on this task
+        int32_t              dependency_num;
+        int32_t              remaining_dependency_num;
+    } Node;
+
+    void ThreadWorker();
+    bool ExecuteOne(std::unique_lock<std::mutex>& lock);    /* false if no task is ready */
+
+private:
+    std::vector<Node> node_list_;
+    std::vector<std::thread> thread_list_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<int32_t> ready_list_;
+    int32_t remaining_task_num_;
+    bool is_exit_;
+};
+
+#endif
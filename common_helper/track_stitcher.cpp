@@ -0,0 +1,155 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/* for general */
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+/* for My modules */
+#include "bounding_box.h"
+#include "hungarian_algorithm.h"
+#include "track_stitcher.h"
+
+
+constexpr float TrackStitcher::kCostMax;  // for link error in Android Studio (clang)
+TrackStitcher::TrackStitcher(float threshold_iou)
+{
+    threshold_iou_ = threshold_iou;
+}
+
+TrackStitcher::~TrackStitcher()
+{
+}
+
+static int32_t GetGlobalId(std::map<int32_t, int32_t>& id_map, int32_t local_id, int32_t& global_id_sequence_num)
+{
+    auto it = id_map.find(local_id);
+    if (it != id_map.end()) return it->second;
+    id_map[local_id] = global_id_sequence_num;
+    return global_id_sequence_num++;
+}
+
+void TrackStitcher::Stitch(const std::vector<Chunk>& chunk_list, std::vector<Record>& record_list)
+{
+    record_list.clear();
+    int32_t global_id_sequence_num = 0;
+    std::map<int32_t, int32_t> id_map_prev;     /* local id in the previous chunk -> global id */
+    for (size_t i_chunk = 0; i_chunk < chunk_list.size(); i_chunk++) {
+        const Chunk& chunk = chunk_list[i_chunk];
+
+        /*** Take over ids from the previous chunk ***/
+        std::map<int32_t, int32_t> id_map;
+        if (i_chunk > 0) {
+            std::vector<std::pair<int32_t, int32_t>> matched_list;
+            MatchTracks(chunk_list[i_chunk - 1], chunk, matched_list);
+            for (const auto& matched : matched_list) {
+                id_map[matched.second] = GetGlobalId(id_map_prev, matched.first, global_id_sequence_num);
+            }
+        }
+
+        /*** Use the middle of the overlap as the boundary b/w chunks ***/
+        int64_t frame_output_start = chunk.frame_start;
+        int64_t frame_output_end = chunk.frame_end;
+        if (i_chunk > 0) {
+            frame_output_start = (chunk.frame_start + chunk_list[i_chunk - 1].frame_end) / 2;
+        }
+        if (i_chunk + 1 < chunk_list.size()) {
+            frame_output_end = (chunk_list[i_chunk + 1].frame_start + chunk.frame_end) / 2;
+        }
+
+        for (const auto& record : chunk.record_list) {
+            if (record.frame_index < frame_output_start || record.frame_index >= frame_output_end) continue;
+            Record record_global = record;
+            record_global.track_id = GetGlobalId(id_map, record.track_id, global_id_sequence_num);
+            record_list.push_back(record_global);
+        }
+        id_map_prev.swap(id_map);
+    }
+}
+
+void TrackStitcher::MatchTracks(const Chunk& chunk_prev, const Chunk& chunk_next, std::vector<std::pair<int32_t, int32_t>>& matched_list)
+{
+    matched_list.clear();
+    const int64_t frame_overlap_start = chunk_next.frame_start;
+    const int64_t frame_overlap_end = chunk_prev.frame_end;
+    if (frame_overlap_end <= frame_overlap_start) return;
+
+    /*** Collect records in the overlap for each frame ***/
+    const size_t overlap_num = static_cast<size_t>(frame_overlap_end - frame_overlap_start);
+    std::vector<std::vector<const Record*>> record_prev_list(overlap_num);
+    std::vector<std::vector<const Record*>> record_next_list(overlap_num);
+    std::map<int32_t, int32_t> track_index_prev;    /* local id -> index for cost matrix */
+    std::map<int32_t, int32_t> track_index_next;
+    for (const auto& record : chunk_prev.record_list) {
+        if (record.frame_index < frame_overlap_start || record.frame_index >= frame_overlap_end) continue;
+        record_prev_list[record.frame_index - frame_overlap_start].push_back(&record);
+        if (track_index_prev.count(record.track_id) == 0) {
+            const int32_t index = static_cast<int32_t>(track_index_prev.size());
+            track_index_prev[record.track_id] = index;
+        }
+    }
+    for (const auto& record : chunk_next.record_list) {
+        if (record.frame_index < frame_overlap_start || record.frame_index >= frame_overlap_end) continue;
+        record_next_list[record.frame_index - frame_overlap_start].push_back(&record);
+        if (track_index_next.count(record.track_id) == 0) {
+            const int32_t index = static_cast<int32_t>(track_index_next.size());
+            track_index_next[record.track_id] = index;
+        }
+    }
+    if (track_index_prev.empty() || track_index_next.empty()) return;
+
+    /*** Average IoU over the frames where both tracks exist ***/
+    const size_t size_prev = track_index_prev.size();
+    const size_t size_next = track_index_next.size();
+    std::vector<std::vector<float>> iou_sum(size_prev, std::vector<float>(size_next, 0));
+    std::vector<std::vector<int32_t>> iou_cnt(size_prev, std::vector<int32_t>(size_next, 0));
+    for (size_t i = 0; i < overlap_num; i++) {
+        for (const auto* record_prev : record_prev_list[i]) {
+            for (const auto* record_next : record_next_list[i]) {
+                const int32_t index_prev = track_index_prev[record_prev->track_id];
+                const int32_t index_next = track_index_next[record_next->track_id];
+                iou_sum[index_prev][index_next] += BoundingBoxUtils::CalculateIoU(record_prev->bbox, record_next->bbox);
+                iou_cnt[index_prev][index_next]++;
+            }
+        }
+    }
+
+    size_t size_cost_matrix = (std::max)(size_prev, size_next);  /* HungarianAlgorithm expects a square matrix */
+    std::vector<std::vector<float>> cost_matrix(size_cost_matrix, std::vector<float>(size_cost_matrix, kCostMax));
+    for (size_t i_prev = 0; i_prev < size_prev; i_prev++) {
+        for (size_t i_next = 0; i_next < size_next; i_next++) {
+            if (iou_cnt[i_prev][i_next] == 0) continue;
+            float iou = iou_sum[i_prev][i_next] / iou_cnt[i_prev][i_next];
+            if (iou >= threshold_iou_) cost_matrix[i_prev][i_next] = kCostMax - iou;
+        }
+    }
+
+    std::vector<int32_t> next_index_for_prev(size_cost_matrix, -1);
+    std::vector<int32_t> prev_index_for_next(size_cost_matrix, -1);
+    HungarianAlgorithm<float> solver(cost_matrix);
+    solver.Solve(next_index_for_prev, prev_index_for_next);
+
+    for (const auto& prev : track_index_prev) {
+        int32_t index_next = next_index_for_prev[prev.second];
+        if (index_next < 0 || index_next >= static_cast<int32_t>(size_next) || cost_matrix[prev.second][index_next] >= kCostMax) continue;
+        for (const auto& next : track_index_next) {
+            if (next.second == index_next) matched_list.push_back(std::make_pair(prev.first, next.first));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef TRACK_STITCHER_
+#define TRACK_STITCHER_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* for My modules */
+#include "bounding_box.h"
+
+/*
+ * Merge track results of time chunks which were processed by independent trackers.
+ * Adjacent chunks must overlap. Tracks in the overlap are matched by IoU, and the matched track in the later chunk takes over the id.
+ * In the overlap, the earlier chunk is used for the first half and the later chunk for the second half,
+ * so that the later tracker has some frames to warm up before its result is used.
+ */
+class TrackStitcher {
+private:
+    static constexpr float kCostMax = 1.0F;
+
+public:
+    typedef struct Record_ {
+        int64_t     frame_index;
+        int32_t     track_id;
+        BoundingBox bbox;
+    } Record;
+
+    typedef struct Chunk_ {
+        int64_t frame_start;            // the first frame of the chunk
+        int64_t frame_end;              // the last frame + 1 of the chunk, including the overlap with the next chunk
+        std::vector<Record> record_list;    // track_id is local in the chunk
+        Chunk_() : frame_start(0), frame_end(0) {}
+    } Chunk;
+
+public:
+    TrackStitcher(float threshold_iou = 0.3F);
+    ~TrackStitcher();
+
+    /* chunk_list must be sorted by frame_start. record_list is sorted by frame, and track_id is global */
+    void Stitch(const std::vector<Chunk>& chunk_list, std::vector<Record>& record_list);
+
+private:
+    void MatchTracks(const Chunk& chunk_prev, const Chunk& chunk_next, std::vector<std::pair<int32_t, int32_t>>& matched_list);
+
+private:
+    float threshold_iou_;
+};
+
+#endif
@@ -37,6 +37,7 @@ Track::Track(const int32_t id, const BoundingBox& bbox_det)
     data_history_.push_back(data);
 
     kf_ = CreateKalmanFilter_UniformLinearMotion(bbox_det);
+    kf_q_per_frame_ = kf_.Q;
 
     cnt_detected_ = 1;
     cnt_undetected_ = 0;
@@ -47,8 +48,13 @@ Track::~Track()
 {
 }
 
-BoundingBox Track::Predict()
+BoundingBox Track::Predict(float dt)
 {
+    /* x(t) = x(t-1) + v * dt. Noise is also accumulated for dt */
+    kf_.F(0, 4) = dt;
+    kf_.F(1, 5) = dt;
+    kf_.F(2, 6) = dt;
+    kf_.Q = kf_q_per_frame_ * dt;
     kf_.Predict();
 
     BoundingBox bbox = GetLatestBoundingBox();
@@ -127,6 +133,28 @@ const int32_t Track::GetDetectedCount() const
     return cnt_detected_;
 }
 
+const double Track::GetPositionUncertainty() const
+{
+    /* standard deviation of the estimated center position [px] */
+    return std::sqrt(kf_.P(0, 0) + kf_.P(1, 1));
+}
+
+BoundingBox Track::GetPredictedBoundingBox(float dt) const
+{
+    SimpleMatrix F = kf_.F;
+    F(0, 4) = dt;
+    F(1, 5) = dt;
+    F(2, 6) = dt;
+    BoundingBox bbox = GetLatestBoundingBox();
+    BoundingBox bbox_pred = KalmanStatus2Bbox(F * kf_.X);
+    bbox.x = bbox_pred.x;
+    bbox.y = bbox_pred.y;
+    bbox.w = bbox_pred.w;
+    bbox.h = bbox_pred.h;
+    bbox.score = 0.0F;
+    return bbox;
+}
+
 
 static constexpr int32_t kNumObserve = 4;   /* (cx, cy, area, aspect) */
 static constexpr int32_t kNumStatus = 7;    /* (cx, cy, area, aspect, vx, vy, vz)   (v = speed)*/
@@ -217,7 +245,7 @@ SimpleMatrix Track::Bbox2KalmanObserved(const BoundingBox& bbox)
     return Z;
 }
 
-BoundingBox Track::KalmanStatus2Bbox(const SimpleMatrix& X)
+BoundingBox Track::KalmanStatus2Bbox(const SimpleMatrix& X) const
 {
     BoundingBox bbox;
     bbox.w = static_cast<int32_t>(std::sqrt(X(2, 0) * X(3, 0)));
@@ -273,12 +301,19 @@ float Tracker::CalculateSimilarity(const BoundingBox& bbox0, const BoundingBox&
     return kCostMax - iou;
 }
 
-void Tracker::Update(const std::vector<BoundingBox>& det_list)
+void Tracker::Predict(float dt)
+{
+    for (auto& track : track_list_) {
+        track.Predict(dt);
+    }
+}
+
+void Tracker::Update(const std::vector<BoundingBox>& det_list, float dt)
 {
     /*** Predict the position at the current frame using the previous status for all tracked bbox ***/
     std::vector<BoundingBox> bbox_pred_list;
     for (auto& track : track_list_) {
-        BoundingBox bbox_prd = track.Predict();
+        BoundingBox bbox_prd = track.Predict(dt);
         bbox_pred_list.push_back(bbox_prd);
     }
 
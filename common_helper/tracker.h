@@ -44,7 +44,7 @@ public:
     Track(const int32_t id, const BoundingBox& bbox_det);
     ~Track();
 
-    BoundingBox Predict();
+    BoundingBox Predict(float dt = 1.0F);     /* dt: time from the previous frame. 1.0 = one frame at the nominal frame rate */
     void Update(const BoundingBox& bbox_det);
     void UpdateNoDetect();
 
@@ -55,16 +55,19 @@ public:
     const int32_t GetId() const;
     const int32_t GetUndetectedCount() const;
     const int32_t GetDetectedCount() const;
+    const double GetPositionUncertainty() const;
+    BoundingBox GetPredictedBoundingBox(float dt = 1.0F) const;     /* position at the next frame. the status is not changed */
 
 private:
     KalmanFilter CreateKalmanFilter_UniformLinearMotion(const BoundingBox& bbox_start);
     SimpleMatrix Bbox2KalmanObserved(const BoundingBox& bbox);
     SimpleMatrix Bbox2KalmanStatus(const BoundingBox& bbox);
-    BoundingBox KalmanStatus2Bbox(const SimpleMatrix& X);
+    BoundingBox KalmanStatus2Bbox(const SimpleMatrix& X) const;
 
 private:
     std::deque<Data> data_history_;
     KalmanFilter kf_;
+    SimpleMatrix kf_q_per_frame_;
     int32_t id_;
     int32_t cnt_detected_;
     int32_t cnt_undetected_;
@@ -80,7 +83,8 @@ public:
     ~Tracker();
     void Reset();
 
-    void Update(const std::vector<BoundingBox>& det_list);
+    void Update(const std::vector<BoundingBox>& det_list, float dt = 1.0F);
+    void Predict(float dt = 1.0F);    /* for a frame without detection. just predict the position of the tracked objects */
 
     std::vector<Track>& GetTrackList();
 
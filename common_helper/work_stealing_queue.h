@@ -0,0 +1,82 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef WORK_STEALING_QUEUE_
+#define WORK_STEALING_QUEUE_
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+/* Each worker has its own deque. A worker takes items from the front of its own deque,
+ * and steals from the back of other workers' deques when its own deque is empty */
+template <typename T>
+class WorkStealingQueue {
+public:
+    explicit WorkStealingQueue(int32_t worker_num)
+    {
+        for (int32_t i = 0; i < worker_num; i++) {
+            deque_list_.push_back(std::unique_ptr<Deque>(new Deque()));
+        }
+    }
+
+    int32_t GetWorkerNum() const
+    {
+        return static_cast<int32_t>(deque_list_.size());
+    }
+
+    void Push(int32_t worker_id, const T& item)
+    {
+        Deque& d = *deque_list_[worker_id % GetWorkerNum()];
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.item_list.push_back(item);
+    }
+
+    /* return false when all the deques are empty. is_stolen is set if the item came from another worker */
+    bool Pop(int32_t worker_id, T& item, bool* is_stolen = nullptr)
+    {
+        if (is_stolen) *is_stolen = false;
+        {
+            Deque& d = *deque_list_[worker_id];
+            std::lock_guard<std::mutex> lock(d.mutex);
+            if (!d.item_list.empty()) {
+                item = d.item_list.front();
+                d.item_list.pop_front();
+                return true;
+            }
+        }
+        for (int32_t i = 1; i < GetWorkerNum(); i++) {
+            Deque& d = *deque_list_[(worker_id + i) % GetWorkerNum()];
+            std::lock_guard<std::mutex> lock(d.mutex);
+            if (!d.item_list.empty()) {
+                item = d.item_list.back();
+                d.item_list.pop_back();
+                if (is_stolen) *is_stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Deque {
+        std::mutex mutex;
+        std::deque<T> item_list;
+    };
+    std::vector<std::unique_ptr<Deque>> deque_list_;
+};
+
+#endif
@@ -26,6 +26,15 @@ typedef struct {
     double time_post_process;  // [msec]
 } Result;
 
+/* Handle of a pipeline. Create one for each pipeline to run multiple pipelines in parallel threads */
+struct Context;
+
+Context* Create(const InputParam& input_param);     /* return nullptr on error */
+int32_t Destroy(Context* context);
+int32_t Process(Context* context, cv::Mat& mat, Result& result);
+int32_t Command(Context* context, int32_t cmd);
+
+/* Use the default instance */
 int32_t Initialize(const InputParam& input_param);
 int32_t Process(cv::Mat& mat, Result& result);
 int32_t Finalize(void);
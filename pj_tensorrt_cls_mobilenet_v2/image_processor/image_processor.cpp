@@ -26,14 +26,23 @@
 #define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
-/*** Global variable ***/
-std::unique_ptr<ClassificationEngine> s_classification_engine;
+/*** Type ***/
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<ClassificationEngine> engine;
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    Context() : time_previous(std::chrono::steady_clock::now()) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -41,60 +50,98 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
     CommonHelper::DrawText(mat, text, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 }
 
-int32_t ImageProcessor::Initialize(const InputParam& input_param)
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
 {
-    if (s_classification_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
+    std::unique_ptr<Context> context(new Context());
+    context->engine.reset(new ClassificationEngine());
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != ClassificationEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
     }
+    return context.release();
+}
 
-    s_classification_engine.reset(new ClassificationEngine());
-    if (s_classification_engine->Initialize(input_param.work_dir, input_param.num_threads) != ClassificationEngine::kRetOk) {
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
-    return 0;
+
+    int32_t ret = 0;
+    if (context->engine->Finalize() != ClassificationEngine::kRetOk) {
+        ret = -1;
+    }
+    delete context;
+    return ret;
 }
 
-int32_t ImageProcessor::Finalize(void)
+
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
 {
-    if (!s_classification_engine) {
-        PRINT_E("Not initialized\n");
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
-    if (s_classification_engine->Finalize() != ClassificationEngine::kRetOk) {
+    switch (cmd) {
+    case 0:
+    default:
+        PRINT_E("command(%d) is not supported\n", cmd);
         return -1;
     }
-
-    return 0;
 }
 
 
-int32_t ImageProcessor::Command(int32_t cmd)
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
 {
-    if (!s_classification_engine) {
+    if (s_context) {
+        PRINT_E("Already initialized\n");
+        return -1;
+    }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
+}
+
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
+}
 
-    switch (cmd) {
-    case 0:
-    default:
-        PRINT_E("command(%d) is not supported\n", cmd);
+int32_t ImageProcessor::Command(int32_t cmd)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
         return -1;
     }
+    return Command(s_context, cmd);
 }
 
 
-int32_t ImageProcessor::Process(cv::Mat& mat, Result& result)
+int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
 {
-    if (!s_classification_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    return Process(s_context, mat, result);
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
 
     ClassificationEngine::Result cls_result;
-    if (s_classification_engine->Process(mat, cls_result) != ClassificationEngine::kRetOk) {
+    if (context->engine->Process(mat, cls_result) != ClassificationEngine::kRetOk) {
         return -1;
     }
 
@@ -103,7 +150,7 @@ int32_t ImageProcessor::Process(cv::Mat& mat, Result& result)
     snprintf(text, sizeof(text), "Result: %s (score = %.3f)",  cls_result.class_name.c_str(), cls_result.score);
     CommonHelper::DrawText(mat, text, cv::Point(0, 20), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
-    DrawFps(mat, cls_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    DrawFps(context->time_previous, mat, cls_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
     /* Return the results */
     result.class_id = cls_result.class_id;
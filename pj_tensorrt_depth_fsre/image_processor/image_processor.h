@@ -32,14 +32,27 @@ namespace ImageProcessor
 typedef struct {
     char     work_dir[256];
     int32_t  num_threads;
+    int32_t  motion_gate_max_interval;          /* reuse the previous result while the scene is static, up to this number of frames. 0 = disable */
+    float    motion_gate_threshold;             /* [0 - 255] luminance difference of a block to be regarded as changed */
 } InputParam;
 
 typedef struct {
     double time_pre_process;   // [msec]
     double time_inference;    // [msec]
     double time_post_process;  // [msec]
+    int32_t is_skipped;        // 1: inference was skipped and the previous result was reused
+    double time_gate;          // [msec] time to check the scene change
 } Result;
 
+/* Handle of a pipeline. Create one for each pipeline to run multiple pipelines in parallel threads */
+struct Context;
+
+Context* Create(const InputParam& input_param);     /* return nullptr on error */
+int32_t Destroy(Context* context);
+int32_t Process(Context* context, cv::Mat& mat, Result& result);
+int32_t Command(Context* context, int32_t cmd);
+
+/* Use the default instance */
 int32_t Initialize(const InputParam& input_param);
 int32_t Process(cv::Mat& mat, Result& result);
 int32_t Finalize(void);
@@ -44,6 +44,8 @@ int32_t main(int argc, char* argv[])
     double total_time_pre_process = 0;
     double total_time_inference = 0;
     double total_time_post_process = 0;
+    double total_time_gate = 0;
+    int32_t skipped_frame_num = 0;
 
     /* Find source image */
     std::string input_name = (argc > 1) ? argv[1] : DEFAULT_INPUT_IMAGE;
@@ -56,7 +58,9 @@ int32_t main(int argc, char* argv[])
     cv::VideoWriter writer;
 
     /* Initialize image processor library */
-    ImageProcessor::InputParam input_param = { WORK_DIR, 4 };
+    /* Skip inference while the scene is static, up to N frames */
+    int32_t motion_gate_max_interval = (argc > 2) ? std::atoi(argv[2]) : 0;
+    ImageProcessor::InputParam input_param = { WORK_DIR, 4, motion_gate_max_interval, 10.0F };
     if (ImageProcessor::Initialize(input_param) != 0) {
         printf("Initialization Error\n");
         return -1;
@@ -108,6 +112,7 @@ int32_t main(int argc, char* argv[])
         printf("    Pre processing:  %9.3lf [msec]\n", result.time_pre_process);
         printf("    Inference:       %9.3lf [msec]\n", result.time_inference);
         printf("    Post processing: %9.3lf [msec]\n", result.time_post_process);
+        printf("    Motion gate:     %9.3lf [msec]%s\n", result.time_gate, result.is_skipped ? " (skipped)" : "");
         printf("=== Finished %d frame ===\n\n", frame_cnt);
 
         if (frame_cnt > 0) {    /* do not count the first process because it may include initialize process */
@@ -117,6 +122,8 @@ int32_t main(int argc, char* argv[])
             total_time_pre_process += result.time_pre_process;
             total_time_inference += result.time_inference;
             total_time_post_process += result.time_post_process;
+            total_time_gate += result.time_gate;
+            skipped_frame_num += result.is_skipped;
         }
     }
 
@@ -131,6 +138,8 @@ int32_t main(int argc, char* argv[])
         printf("    Pre processing:  %9.3lf [msec]\n", total_time_pre_process / frame_cnt);
         printf("    Inference:       %9.3lf [msec]\n", total_time_inference / frame_cnt);
         printf("    Post processing: %9.3lf [msec]\n", total_time_post_process / frame_cnt);
+        printf("    Motion gate:     %9.3lf [msec]\n", total_time_gate / frame_cnt);
+        printf("  Skipped frames:    %9d / %d\n", skipped_frame_num, frame_cnt);
     }
 
     /* Fianlize image processor library */
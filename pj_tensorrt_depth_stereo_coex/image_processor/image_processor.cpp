@@ -18,6 +18,7 @@
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "motion_gate.h"
 #include "depth_stereo_engine.h"
 #include "image_processor.h"
 
@@ -26,14 +27,25 @@
 #define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
-/*** Global variable ***/
-std::unique_ptr<DepthStereoEngine> s_engine;
+/*** Type ***/
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<DepthStereoEngine> engine;
+    MotionGate motion_gate;
+    DepthStereoEngine::Result ss_result_previous;
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    Context() : time_previous(std::chrono::steady_clock::now()) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -41,63 +53,114 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
     CommonHelper::DrawText(mat, text, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 }
 
-int32_t ImageProcessor::Initialize(const InputParam& input_param)
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
 {
-    if (s_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
+    std::unique_ptr<Context> context(new Context());
+    MotionGate::Config motion_gate_config;
+    motion_gate_config.max_interval = input_param.motion_gate_max_interval;
+    motion_gate_config.threshold_diff = input_param.motion_gate_threshold;
+    context->motion_gate.SetConfig(motion_gate_config);
+
+    context->engine.reset(new DepthStereoEngine());
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != DepthStereoEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
     }
+    return context.release();
+}
 
-    s_engine.reset(new DepthStereoEngine());
-    if (s_engine->Initialize(input_param.work_dir, input_param.num_threads) != DepthStereoEngine::kRetOk) {
-        s_engine->Finalize();
-        s_engine.reset();
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
-    return 0;
+
+    int32_t ret = 0;
+    if (context->engine->Finalize() != DepthStereoEngine::kRetOk) {
+        ret = -1;
+    }
+    delete context;
+    return ret;
 }
 
-int32_t ImageProcessor::Finalize(void)
+
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
-    if (s_engine->Finalize() != DepthStereoEngine::kRetOk) {
+    switch (cmd) {
+    case 0:
+    default:
+        PRINT_E("command(%d) is not supported\n", cmd);
         return -1;
     }
-
-    return 0;
 }
 
 
-int32_t ImageProcessor::Command(int32_t cmd)
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
 {
-    if (!s_engine) {
+    if (s_context) {
+        PRINT_E("Already initialized\n");
+        return -1;
+    }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
+}
+
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
+}
 
-    switch (cmd) {
-    case 0:
-    default:
-        PRINT_E("command(%d) is not supported\n", cmd);
+int32_t ImageProcessor::Command(int32_t cmd)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
         return -1;
     }
+    return Command(s_context, cmd);
 }
 
 
-int32_t ImageProcessor::Process(cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_result, Result& result)
+int32_t ImageProcessor::Process(cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_result, ImageProcessor::Result& result)
 {
-    if (!s_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    return Process(s_context, mat_left, mat_right, mat_result, result);
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat& mat_result, ImageProcessor::Result& result)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
 
+    /* Reuse the previous result while the scene is static */
     DepthStereoEngine::Result ss_result;
-    if (s_engine->Process(mat_left, mat_right, ss_result) != DepthStereoEngine::kRetOk) {
-        return -1;
+    const bool is_inference_needed = context->motion_gate.Check(mat_left);
+    if (is_inference_needed) {
+        if (context->engine->Process(mat_left, mat_right, ss_result) != DepthStereoEngine::kRetOk) {
+            return -1;
+        }
+        context->ss_result_previous = ss_result;
+    } else {
+        ss_result = context->ss_result_previous;
+        ss_result.time_pre_process = 0;
+        ss_result.time_inference = 0;
+        ss_result.time_post_process = 0;
     }
 
     /* Convert to colored depth map */
@@ -112,12 +175,14 @@ int32_t ImageProcessor::Process(cv::Mat& mat_left, cv::Mat& mat_right, cv::Mat&
     cv::vconcat(mat_left, mat_new, mat_result);
     // cv::resize(mat_result, mat_result, cv::Size(), 0.5, 0.5);   // just to fit to my display
 
-    DrawFps(mat_result, ss_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    DrawFps(context->time_previous, mat_result, ss_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
     /* Return the results */
     result.time_pre_process = ss_result.time_pre_process;
     result.time_inference = ss_result.time_inference;
     result.time_post_process = ss_result.time_post_process;
+    result.is_skipped = is_inference_needed ? 0 : 1;
+    result.time_gate = context->motion_gate.GetTimeCheck();
 
     return 0;
 }
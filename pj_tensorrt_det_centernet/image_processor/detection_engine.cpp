@@ -25,6 +25,15 @@ limitations under the License.
 #include <chrono>
 #include <fstream>
 
+/* for SIMD. SSE2 is always available on x64, and NEON on aarch64. Otherwise scalar */
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PEAK_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PEAK_USE_NEON
+#endif
+
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
 
@@ -56,8 +65,107 @@ limitations under the License.
 
 #define LABEL_NAME   "label_coco_80.txt"
 
+static constexpr int32_t kTopK = 100;   /* K of ctdet_decode in the reference */
+
 
 /*** Function ***/
+typedef struct Peak_ {
+    float   score_logit;
+    int32_t class_id;
+    int32_t index;      /* y * hm_w + x */
+} Peak;
+
+/* Bounded heap of the top K peaks. front() is the lowest */
+static inline void PushPeak(std::vector<Peak>& heap, const Peak& peak)
+{
+    static const auto kGreater = [](const Peak& lhs, const Peak& rhs) { return lhs.score_logit > rhs.score_logit; };
+    if (static_cast<int32_t>(heap.size()) < kTopK) {
+        heap.push_back(peak);
+        std::push_heap(heap.begin(), heap.end(), kGreater);
+    } else if (peak.score_logit > heap.front().score_logit) {
+        std::pop_heap(heap.begin(), heap.end(), kGreater);
+        heap.back() = peak;
+        std::push_heap(heap.begin(), heap.end(), kGreater);
+    }
+}
+
+/* The pixel is a peak if it's over the threshold and not less than any of the 3x3 neighbors (= _nms of the reference, which keeps hmax == heat) */
+static inline bool IsPeak(const float* hm, int32_t hm_w, int32_t hm_h, int32_t x, int32_t y, float threshold)
+{
+    const float value = hm[y * hm_w + x];
+    if (!(value > threshold)) return false;
+    for (int32_t yy = (std::max)(y - 1, 0); yy <= (std::min)(y + 1, hm_h - 1); yy++) {
+        for (int32_t xx = (std::max)(x - 1, 0); xx <= (std::min)(x + 1, hm_w - 1); xx++) {
+            if (hm[yy * hm_w + xx] > value) return false;
+        }
+    }
+    return true;
+}
+
+/* IsPeak for 4 pixels from x at a time (bit i for x + i). x - 1 and x + 4 must be inside the row. row_prev / row_next are nullptr at the border */
+static inline int32_t GetPeakMask4(const float* row_prev, const float* row, const float* row_next, int32_t x, float threshold)
+{
+#if defined(PEAK_USE_SSE2)
+    const __m128 value = _mm_loadu_ps(row + x);
+    const __m128 is_over = _mm_cmpgt_ps(value, _mm_set1_ps(threshold));
+    if (_mm_movemask_ps(is_over) == 0) return 0;
+    __m128 neighbor_max = _mm_max_ps(_mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1));
+    for (const float* r : { row_prev, row_next }) {
+        if (!r) continue;
+        neighbor_max = _mm_max_ps(neighbor_max, _mm_max_ps(_mm_loadu_ps(r + x - 1), _mm_max_ps(_mm_loadu_ps(r + x), _mm_loadu_ps(r + x + 1))));
+    }
+    return _mm_movemask_ps(_mm_and_ps(is_over, _mm_cmpge_ps(value, neighbor_max)));
+#elif defined(PEAK_USE_NEON)
+    static const uint32_t kBit[4] = { 1, 2, 4, 8 };
+    const float32x4_t value = vld1q_f32(row + x);
+    const uint32x4_t is_over = vcgtq_f32(value, vdupq_n_f32(threshold));
+    if (vmaxvq_u32(is_over) == 0) return 0;
+    float32x4_t neighbor_max = vmaxq_f32(vld1q_f32(row + x - 1), vld1q_f32(row + x + 1));
+    for (const float* r : { row_prev, row_next }) {
+        if (!r) continue;
+        neighbor_max = vmaxq_f32(neighbor_max, vmaxq_f32(vld1q_f32(r + x - 1), vmaxq_f32(vld1q_f32(r + x), vld1q_f32(r + x + 1))));
+    }
+    return static_cast<int32_t>(vaddvq_u32(vandq_u32(vandq_u32(is_over, vcgeq_f32(value, neighbor_max)), vld1q_u32(kBit))));
+#else
+    int32_t mask = 0;
+    for (int32_t i = 0; i < 4; i++) {
+        const float value = row[x + i];
+        if (!(value > threshold)) continue;
+        bool is_peak = row[x + i - 1] <= value && row[x + i + 1] <= value;
+        for (const float* r : { row_prev, row_next }) {
+            if (r) is_peak = is_peak && r[x + i - 1] <= value && r[x + i] <= value && r[x + i + 1] <= value;
+        }
+        if (is_peak) mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+/* Find peaks in the heat map of a class, and keep the top K of all classes in heap.
+ * Once the heap is full, the lowest score in it is used as the threshold */
+static void ExtractPeak(const float* hm, int32_t class_id, int32_t hm_w, int32_t hm_h, float threshold_logit, std::vector<Peak>& heap)
+{
+    for (int32_t y = 0; y < hm_h; y++) {
+        const float* row = hm + y * hm_w;
+        const float* row_prev = (y > 0) ? row - hm_w : nullptr;
+        const float* row_next = (y < hm_h - 1) ? row + hm_w : nullptr;
+        auto threshold = [&]() { return (static_cast<int32_t>(heap.size()) < kTopK) ? threshold_logit : (std::max)(threshold_logit, heap.front().score_logit); };
+
+        /* The left and right border is checked one by one, and the others 4 pixels at a time */
+        if (IsPeak(hm, hm_w, hm_h, 0, y, threshold())) PushPeak(heap, { row[0], class_id, y * hm_w });
+        int32_t x = 1;
+        for (; x + 4 < hm_w; x += 4) {
+            int32_t mask = GetPeakMask4(row_prev, row, row_next, x, threshold());
+            for (int32_t i = 0; mask != 0; i++, mask >>= 1) {
+                if (mask & 1) PushPeak(heap, { row[x + i], class_id, y * hm_w + x + i });
+            }
+        }
+        for (; x < hm_w; x++) {
+            if (IsPeak(hm, hm_w, hm_h, x, y, threshold())) PushPeak(heap, { row[x], class_id, y * hm_w + x });
+        }
+    }
+}
+
 int32_t DetectionEngine::Initialize(const std::string& work_dir, const int32_t num_threads)
 {
     /* Set model information */
@@ -120,6 +228,12 @@ int32_t DetectionEngine::Finalize()
     return kRetOk;
 }
 
+void DetectionEngine::GetInputSize(int32_t& width, int32_t& height) const
+{
+    width = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetWidth();
+    height = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetHeight();
+}
+
 int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 {
     if (!inference_helper_) {
@@ -176,34 +290,35 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
     const float scale_h = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
 
     /* https://github.com/xingyizhou/CenterNet/blob/master/src/lib/models/decode.py#L472 */
-    std::vector<BoundingBox> bbox_list;
+    /* Peaks (3x3 local max) in logit, and the top K of all classes. Only them read the regressors */
+    std::vector<Peak> peak_heap;
+    peak_heap.reserve(kTopK);
     for (int32_t class_id = 0; class_id < hm_c; class_id++) {
-        for (int32_t hm_y = 0; hm_y < hm_h; hm_y++) {
-            for (int32_t hm_x = 0; hm_x < hm_w; hm_x++) {
-                const float score_logit = *hm_list;
-                hm_list++;
-                if (score_logit > threshold_score_logit) {
-                    const int32_t index_x = hm_w * hm_y + hm_x;
-                    const int32_t index_y = index_x + hm_h * hm_w;
-                    const float width = reg_wh_list[index_x];
-                    const float height = reg_wh_list[index_y];
-                    const float cx = hm_x + reg_xy_list[index_x];  /* no need to add +0.5f according to sample code */
-                    const float cy = hm_y + reg_xy_list[index_y];
-                    const float x0 = cx - width / 2.0f;
-                    const float y0 = cy - height / 2.0f;
-
-                    BoundingBox bbox;
-                    bbox.class_id = class_id;
-                    bbox.label = label_list_[class_id];
-                    bbox.score = CommonHelper::Sigmoid(score_logit);
-                    bbox.x = static_cast<int32_t>(x0 * 4 * scale_w);
-                    bbox.y = static_cast<int32_t>(y0 * 4 * scale_h);
-                    bbox.w = static_cast<int32_t>(width * 4 * scale_w);
-                    bbox.h = static_cast<int32_t>(height * 4 * scale_h);
-                    bbox_list.push_back(bbox);
-                }
-            }
-        }
+        ExtractPeak(hm_list + class_id * hm_h * hm_w, class_id, hm_w, hm_h, threshold_score_logit, peak_heap);
+    }
+
+    std::vector<BoundingBox> bbox_list;
+    for (const auto& peak : peak_heap) {
+        const int32_t hm_x = peak.index % hm_w;
+        const int32_t hm_y = peak.index / hm_w;
+        const int32_t index_x = peak.index;
+        const int32_t index_y = index_x + hm_h * hm_w;
+        const float width = reg_wh_list[index_x];
+        const float height = reg_wh_list[index_y];
+        const float cx = hm_x + reg_xy_list[index_x];  /* no need to add +0.5f according to sample code */
+        const float cy = hm_y + reg_xy_list[index_y];
+        const float x0 = cx - width / 2.0f;
+        const float y0 = cy - height / 2.0f;
+
+        BoundingBox bbox;
+        bbox.class_id = peak.class_id;
+        bbox.label = label_list_[peak.class_id];
+        bbox.score = CommonHelper::Sigmoid(peak.score_logit);
+        bbox.x = static_cast<int32_t>(x0 * 4 * scale_w);
+        bbox.y = static_cast<int32_t>(y0 * 4 * scale_h);
+        bbox.w = static_cast<int32_t>(width * 4 * scale_w);
+        bbox.h = static_cast<int32_t>(height * 4 * scale_h);
+        bbox_list.push_back(bbox);
     }
 
     /* Adjust bounding box */
@@ -213,7 +328,7 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
         bbox.label = label_list_[bbox.class_id];
     }
 
-    /* NMS */
+    /* NMS. Peaks of the same object are already suppressed. This removes overlaps of up to K boxes only */
     std::vector<BoundingBox> bbox_nms_list;
     BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
 
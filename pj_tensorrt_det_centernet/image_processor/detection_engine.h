@@ -63,6 +63,7 @@ public:
     int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
     int32_t Finalize(void);
     int32_t Process(const cv::Mat& original_mat, Result& result);
+    void GetInputSize(int32_t& width, int32_t& height) const;
     void SetThreshold(float threshold_box_confidence, float threshold_class_confidence, float threshold_nms_iou) {
         threshold_class_confidence_ = threshold_class_confidence;
         threshold_nms_iou_ = threshold_nms_iou;
@@ -32,6 +32,8 @@ limitations under the License.
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "compact_result.h"
+#include "columnar_archive.h"
 #include "bounding_box.h"
 #include "detection_engine.h"
 #include "tracker.h"
@@ -43,14 +45,40 @@ limitations under the License.
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
 /*** Global variable ***/
-std::unique_ptr<DetectionEngine> s_engine;
-Tracker s_tracker;
+/* For detection interval */
+static constexpr double kNominalFps = 30.0;                 /* dt for the tracker is 1.0 at this frame rate */
+static constexpr double kAdaptiveUncertaintyRatio = 0.1;    /* run detection when the position uncertainty exceeds this ratio of the object size */
+
+/*** Type ***/
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<DetectionEngine> engine;
+    Tracker tracker;
+
+    /* For detection interval */
+    int32_t detection_interval;
+    bool is_adaptive_detection_interval;
+    int32_t frame_cnt_from_detection;
+    double timestamp_previous;
+
+    int64_t frame_index;
+
+    /* For archive of the tracking result */
+    std::unique_ptr<ColumnarArchive::Writer> archive_writer;
+    CompactResult archive_result;
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    Context() : detection_interval(1), is_adaptive_detection_interval(false), frame_cnt_from_detection(0), timestamp_previous(-1), frame_index(-1), time_previous(std::chrono::steady_clock::now()) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -61,51 +89,75 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
 static cv::Scalar GetColorForId(int32_t id)
 {
     static constexpr int32_t kMaxNum = 100;
-    static std::vector<cv::Scalar> color_list;
-    if (color_list.empty()) {
+    /* created only once even when called from multiple threads */
+    static const std::vector<cv::Scalar> color_list = []() {
+        std::vector<cv::Scalar> list;
         std::srand(123);
         for (int32_t i = 0; i < kMaxNum; i++) {
-            color_list.push_back(CommonHelper::CreateCvColor(std::rand() % 255, std::rand() % 255, std::rand() % 255));
+            list.push_back(CommonHelper::CreateCvColor(std::rand() % 255, std::rand() % 255, std::rand() % 255));
         }
-    }
+        return list;
+    }();
     return color_list[id % kMaxNum];
 }
 
-int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+static bool IsDetectionFrame(ImageProcessor::Context* context)
 {
-    if (s_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
+    if (context->frame_cnt_from_detection + 1 >= context->detection_interval) return true;
+    if (context->is_adaptive_detection_interval) {
+        for (auto& track : context->tracker.GetTrackList()) {
+            /* confirm a new track as soon as possible */
+            if (track.GetDetectedCount() < 2) return true;
+            /* the predicted position is not reliable any more */
+            const auto& bbox = track.GetLatestBoundingBox();
+            if (track.GetPositionUncertainty() > kAdaptiveUncertaintyRatio * (std::min)(bbox.w, bbox.h)) return true;
+        }
     }
+    return false;
+}
 
-    s_engine.reset(new DetectionEngine());
-    if (s_engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
-        s_engine->Finalize();
-        s_engine.reset();
-        return -1;
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
+{
+    std::unique_ptr<Context> context(new Context());
+    context->detection_interval = (std::max)(1, input_param.detection_interval);
+    context->is_adaptive_detection_interval = input_param.is_adaptive_detection_interval != 0;
+
+    context->engine.reset(new DetectionEngine());
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
     }
-    return 0;
+
+    if (input_param.archive_path[0] != '\0') {
+        context->archive_writer.reset(new ColumnarArchive::Writer());
+        if (context->archive_writer->Open(input_param.archive_path) != ColumnarArchive::Writer::kRetOk) {
+            context->engine->Finalize();
+            return nullptr;
+        }
+    }
+    return context.release();
 }
 
-int32_t ImageProcessor::Finalize(void)
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
-    if (s_engine->Finalize() != DetectionEngine::kRetOk) {
-        return -1;
+    int32_t ret = 0;
+    if (context->engine->Finalize() != DetectionEngine::kRetOk) {
+        ret = -1;
     }
-
-    return 0;
+    delete context;
+    return ret;
 }
 
 
-int32_t ImageProcessor::Command(int32_t cmd)
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
@@ -117,22 +169,95 @@ int32_t ImageProcessor::Command(int32_t cmd)
     }
 }
 
+int32_t ImageProcessor::GetInputSize(ImageProcessor::Context* context, int32_t& width, int32_t& height)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+    context->engine->GetInputSize(width, height);
+    return 0;
+}
+
+
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+{
+    if (s_context) {
+        PRINT_E("Already initialized\n");
+        return -1;
+    }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
+}
 
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
+}
 
-int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
+int32_t ImageProcessor::Command(int32_t cmd)
 {
-    if (!s_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    return Command(s_context, cmd);
+}
 
-    DetectionEngine::Result det_result;
-    if (s_engine->Process(mat, det_result) != DetectionEngine::kRetOk) {
+int32_t ImageProcessor::GetInputSize(int32_t& width, int32_t& height)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
         return -1;
     }
+    return GetInputSize(s_context, width, height);
+}
 
-    /* Display target area  */
-    cv::rectangle(mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
+int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    return Process(s_context, mat, result, timestamp_ms);
+}
+
+
+static int32_t ProcessFrame(ImageProcessor::Context* context, cv::Mat& mat, double timestamp_ms, DetectionEngine::Result& det_result)
+{
+    context->frame_index++;
+
+    /* Time from the previous frame for the tracker */
+    if (timestamp_ms < 0) {
+        timestamp_ms = static_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    float dt = 1.0F;
+    if (context->timestamp_previous >= 0 && timestamp_ms > context->timestamp_previous) {
+        dt = static_cast<float>((timestamp_ms - context->timestamp_previous) * kNominalFps / 1000.0);
+    }
+    context->timestamp_previous = timestamp_ms;
+
+    /* Run detection every N frames. Otherwise, the tracker just predicts the position */
+    const bool is_detection_frame = IsDetectionFrame(context);
+    if (is_detection_frame) {
+        if (context->engine->Process(mat, det_result) != DetectionEngine::kRetOk) {
+            return -1;
+        }
+        context->tracker.Update(det_result.bbox_list, dt);
+        context->frame_cnt_from_detection = 0;
+
+        /* Display target area  */
+        cv::rectangle(mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
+    } else {
+        context->tracker.Predict(dt);
+        context->frame_cnt_from_detection++;
+    }
 
     /* Display detection result (black rectangle) */
     int32_t num_det = 0;
@@ -142,9 +267,8 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     }
 
     /* Display tracking result  */
-    s_tracker.Update(det_result.bbox_list);
     int32_t num_track = 0;
-    auto& track_list = s_tracker.GetTrackList();
+    auto& track_list = context->tracker.GetTrackList();
     for (auto& track : track_list) {
         if (track.GetDetectedCount() < 2) continue;
         const auto& bbox = track.GetLatestData().bbox;
@@ -161,13 +285,17 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
         }
         num_track++;
     }
-    CommonHelper::DrawText(mat, "DET: " + std::to_string(num_det) + ", TRACK: " + std::to_string(num_track), cv::Point(0, 20), 0.7, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
+    CommonHelper::DrawText(mat, "DET: " + (is_detection_frame ? std::to_string(num_det) : std::string("-")) + ", TRACK: " + std::to_string(num_track), cv::Point(0, 20), 0.7, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
+
+    DrawFps(context->time_previous, mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
-    DrawFps(mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    return 0;
+}
 
-    /* Return the results */
+static void SetResult(ImageProcessor::Context* context, const DetectionEngine::Result& det_result, ImageProcessor::Result& result)
+{
     int32_t bbox_num = 0;
-    for (auto& track : track_list) {
+    for (auto& track : context->tracker.GetTrackList()) {
         const auto& bbox = track.GetLatestData().bbox;
         result.object_list[bbox_num].class_id = bbox.class_id;
         snprintf(result.object_list[bbox_num].label, sizeof(result.object_list[bbox_num].label), "%s", bbox.label.c_str());
@@ -184,7 +312,67 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     result.time_pre_process = det_result.time_pre_process;
     result.time_inference = det_result.time_inference;
     result.time_post_process = det_result.time_post_process;
+}
 
+static void SetCompactResult(ImageProcessor::Context* context, const DetectionEngine::Result& det_result, CompactResult& result)
+{
+    result.Clear();
+    result.header.frame_index = context->frame_index;
+    result.header.timestamp_ms = context->timestamp_previous;
+    result.header.time_pre_process = static_cast<float>(det_result.time_pre_process);
+    result.header.time_inference = static_cast<float>(det_result.time_inference);
+    result.header.time_post_process = static_cast<float>(det_result.time_post_process);
+    for (auto& track : context->tracker.GetTrackList()) {
+        const auto& bbox = track.GetLatestData().bbox;
+        CompactResult::Object object;
+        object.track_id = track.GetId();
+        object.class_id = static_cast<int16_t>(bbox.class_id);
+        object.flags = bbox.score == 0 ? CompactResult::kFlagPredicted : 0;
+        object.score = bbox.score;
+        object.x = static_cast<float>(bbox.x);
+        object.y = static_cast<float>(bbox.y);
+        object.w = static_cast<float>(bbox.w);
+        object.h = static_cast<float>(bbox.h);
+        result.object_list.push_back(object);
+    }
+}
+
+static void ArchiveResult(ImageProcessor::Context* context, const DetectionEngine::Result& det_result)
+{
+    if (!context->archive_writer) return;
+    SetCompactResult(context, det_result, context->archive_result);
+    context->archive_writer->Append(context->archive_result);
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    DetectionEngine::Result det_result;
+    if (ProcessFrame(context, mat, timestamp_ms, det_result) != 0) {
+        return -1;
+    }
+    SetResult(context, det_result, result);
+    ArchiveResult(context, det_result);
+    return 0;
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, CompactResult& result, double timestamp_ms)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    DetectionEngine::Result det_result;
+    if (ProcessFrame(context, mat, timestamp_ms, det_result) != 0) {
+        return -1;
+    }
+    SetCompactResult(context, det_result, result);
+    ArchiveResult(context, det_result);
     return 0;
 }
 
@@ -31,6 +31,7 @@ limitations under the License.
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "anchor_decoder.h"
 #include "inference_helper.h"
 #include "inference_helper_tensorrt.h"      // to call SetDlaCore
 #include "detection_engine.h"
@@ -43,19 +44,30 @@ limitations under the License.
 /* Model parameters */
 #if 0
 #define MODEL_NAME  "yolov7-tiny_384x640.onnx"
-#define INPUT_DIMS  { 1, 3, 384, 640 }
+static constexpr int32_t kInputWidth = 640;
+static constexpr int32_t kInputHeight = 384;
 #else
 #define MODEL_NAME  "yolov7_736x1280.onnx"
-#define INPUT_DIMS  { 1, 3, 736, 1280 }
+static constexpr int32_t kInputWidth = 1280;
+static constexpr int32_t kInputHeight = 736;
 #endif
+#define INPUT_DIMS  { 1, 3, kInputHeight, kInputWidth }
 #define TENSORTYPE  TensorInfo::kTensorTypeFp32
 #define INPUT_NAME  "images"
 #define IS_NCHW     true
 #define IS_RGB      true
 #define OUTPUT_NAME "output"
+/* Set true for the model exported with --end2end (NMS is in the model. EfficientNMS_TRT) */
+#define IS_END2END  false
+#define OUTPUT_NAME_NUM_DETS    "num_dets"      /* [1, 1] int32 */
+#define OUTPUT_NAME_DET_BOXES   "det_boxes"     /* [1, N, 4] x0, y0, x1, y1 in the input image */
+#define OUTPUT_NAME_DET_SCORES  "det_scores"    /* [1, N] */
+#define OUTPUT_NAME_DET_CLASSES "det_classes"   /* [1, N] int32 */
 
 static constexpr int32_t kNumberOfClass = 80;
-static constexpr int32_t kElementNumOfAnchor = kNumberOfClass + 5;    // x, y, w, h, bbox confidence, [class confidence]
+static constexpr int32_t kAnchorBoxNum = 3 * ((kInputWidth / 8) * (kInputHeight / 8) + (kInputWidth / 16) * (kInputHeight / 16) + (kInputWidth / 32) * (kInputHeight / 32));
+/* The output is a list of boxes already decoded in the input image (x, y, w, h, bbox confidence, [class confidence]) */
+typedef AnchorDecoder::Decoder<kNumberOfClass, AnchorDecoder::Layout::kAnchorMajor, AnchorDecoder::Activation::kNone, AnchorDecoder::BoxEncoding::kAbsolute> Decoder;
 
 #define LABEL_NAME   "label_coco_80.txt"
 
@@ -83,7 +95,15 @@ int32_t DetectionEngine::Initialize(const std::string& work_dir, const int32_t n
 
     /* Set output tensor info */
     output_tensor_info_list_.clear();
-    output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME, TENSORTYPE));
+    is_end2end_ = IS_END2END;
+    if (is_end2end_) {
+        output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME_NUM_DETS, TensorInfo::kTensorTypeInt32));
+        output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME_DET_BOXES, TENSORTYPE));
+        output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME_DET_SCORES, TENSORTYPE));
+        output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME_DET_CLASSES, TensorInfo::kTensorTypeInt32));
+    } else {
+        output_tensor_info_list_.push_back(OutputTensorInfo(OUTPUT_NAME, TENSORTYPE));
+    }
 
     /* Create and Initialize Inference Helper */
     //inference_helper_.reset(InferenceHelper::Create(InferenceHelper::kOnnxRuntime));
@@ -121,34 +141,34 @@ int32_t DetectionEngine::Finalize()
     return kRetOk;
 }
 
+void DetectionEngine::GetInputSize(int32_t& width, int32_t& height) const
+{
+    width = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetWidth();
+    height = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetHeight();
+}
+
 
-void DetectionEngine::GetBoundingBox(const float* data, int32_t anchor_box_num, float scale_x, float  scale_y, std::vector<BoundingBox>& bbox_list)
+void DetectionEngine::GetBoundingBoxEnd2End(int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, std::vector<BoundingBox>& bbox_list)
 {
-    int32_t index = 0;
-    for (int32_t i = 0; i < anchor_box_num; i++) {
-        float box_confidence = data[index + 4];
-        if (box_confidence >= threshold_box_confidence_) {
-            int32_t class_id = 0;
-            float confidence = 0;
-            for (int32_t class_index = 0; class_index < kNumberOfClass; class_index++) {
-                float confidence_of_class = data[index + 5 + class_index];
-                if (confidence_of_class > confidence) {
-                    confidence = confidence_of_class;
-                    class_id = class_index;
-                }
-            }
-
-            if (confidence >= threshold_class_confidence_) {
-                int32_t cx = static_cast<int32_t>(data[index + 0] * scale_x);
-                int32_t cy = static_cast<int32_t>(data[index + 1] * scale_y);
-                int32_t w = static_cast<int32_t>(data[index + 2] * scale_x);
-                int32_t h = static_cast<int32_t>(data[index + 3] * scale_y);
-                int32_t x = cx - w / 2;
-                int32_t y = cy - h / 2;
-                bbox_list.push_back(BoundingBox(class_id, "", confidence, x, y, w, h));
-            }
-        }
-        index += kElementNumOfAnchor;
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t num_dets = *static_cast<const int32_t*>(output_tensor_info_list_[0].data);
+    const float* boxes = output_tensor_info_list_[1].GetDataAsFloat();
+    const float* scores = output_tensor_info_list_[2].GetDataAsFloat();
+    const int32_t* classes = static_cast<const int32_t*>(output_tensor_info_list_[3].data);
+    const int32_t max_dets = output_tensor_info_list_[2].tensor_dims[1];
+    const float scale_x = static_cast<float>(crop_w) / input_tensor_info.GetWidth();      /* scale to original image */
+    const float scale_y = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
+
+    for (int32_t i = 0; i < (std::min)(num_dets, max_dets); i++) {
+        /* The model has its own score threshold. Apply the threshold of this engine too */
+        if (scores[i] < threshold_class_confidence_) continue;
+        const int32_t class_id = classes[i];
+        if (class_id < 0 || class_id >= static_cast<int32_t>(label_list_.size())) continue;
+        int32_t x0 = static_cast<int32_t>(boxes[i * 4 + 0] * scale_x);
+        int32_t y0 = static_cast<int32_t>(boxes[i * 4 + 1] * scale_y);
+        int32_t x1 = static_cast<int32_t>(boxes[i * 4 + 2] * scale_x);
+        int32_t y1 = static_cast<int32_t>(boxes[i * 4 + 3] * scale_y);
+        bbox_list.push_back(BoundingBox(class_id, label_list_[class_id], scores[i], x0 + crop_x, y0 + crop_y, x1 - x0, y1 - y0));
     }
 }
 
@@ -197,24 +217,35 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 
     /*** PostProcess ***/
     const auto& t_post_process0 = std::chrono::steady_clock::now();
-    /* Get boundig box */
-    std::vector<BoundingBox> bbox_list;
-    float* output_data = output_tensor_info_list_[0].GetDataAsFloat();
-    int32_t anchor_box_num = output_tensor_info_list_[0].tensor_dims[1];
-    float scale_x = static_cast<float>(crop_w) / input_tensor_info.GetWidth();      /* scale to original image */
-    float scale_y = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
-    GetBoundingBox(output_data, anchor_box_num, scale_x, scale_y, bbox_list);
-
-    /* Adjust bounding box */
-    for (auto& bbox : bbox_list) {
-        bbox.x += crop_x;
-        bbox.y += crop_y;
-        bbox.label = label_list_[bbox.class_id];
-    }
-
-    /* NMS */
     std::vector<BoundingBox> bbox_nms_list;
-    BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
+    if (is_end2end_) {
+        /* Boxes are already suppressed in the model */
+        GetBoundingBoxEnd2End(crop_x, crop_y, crop_w, crop_h, bbox_nms_list);
+    } else {
+        /* Get boundig box */
+        std::vector<BoundingBox> bbox_list;
+        float* output_data = output_tensor_info_list_[0].GetDataAsFloat();
+        if (output_tensor_info_list_[0].tensor_dims[1] != kAnchorBoxNum) {
+            PRINT_E("Unexpected number of boxes: %d\n", output_tensor_info_list_[0].tensor_dims[1]);
+            return kRetErr;
+        }
+        AnchorDecoder::Param param;
+        param.threshold_objectness = threshold_box_confidence_;
+        param.threshold_class = threshold_class_confidence_;
+        param.scale_x = static_cast<float>(crop_w) / input_tensor_info.GetWidth();      /* scale to original image */
+        param.scale_y = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
+        Decoder::Decode<1, kAnchorBoxNum, 1>(output_data, param, nullptr, bbox_list);
+
+        /* Adjust bounding box */
+        for (auto& bbox : bbox_list) {
+            bbox.x += crop_x;
+            bbox.y += crop_y;
+            bbox.label = label_list_[bbox.class_id];
+        }
+
+        /* NMS */
+        BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
+    }
 
     const auto& t_post_process1 = std::chrono::steady_clock::now();
 
@@ -59,11 +59,13 @@ public:
         threshold_box_confidence_ = 0.2f;
         threshold_class_confidence_ = 0.2f;
         threshold_nms_iou_ = 0.6f;
+        is_end2end_ = false;
     }
     ~DetectionEngine() {}
     int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
     int32_t Finalize(void);
     int32_t Process(const cv::Mat& original_mat, Result& result);
+    void GetInputSize(int32_t& width, int32_t& height) const;
     void SetThreshold(float threshold_box_confidence, float threshold_class_confidence, float threshold_nms_iou) {
         threshold_box_confidence_ = threshold_box_confidence;
         threshold_class_confidence_ = threshold_class_confidence;
@@ -72,7 +74,7 @@ public:
 
 private:
     int32_t ReadLabel(const std::string& filename, std::vector<std::string>& label_list);
-    void GetBoundingBox(const float* data, int32_t anchor_box_num, float scale_x, float  scale_y, std::vector<BoundingBox>& bbox_list);
+    void GetBoundingBoxEnd2End(int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, std::vector<BoundingBox>& bbox_list);
 
 private:
     std::unique_ptr<InferenceHelper> inference_helper_;
@@ -83,6 +85,7 @@ private:
     float threshold_box_confidence_;
     float threshold_class_confidence_;
     float threshold_nms_iou_;
+    bool is_end2end_;   /* the model has NMS and outputs the final detections */
 };
 
 #endif
@@ -22,6 +22,9 @@ limitations under the License.
 #include <vector>
 #include <array>
 
+/* for My modules */
+#include "compact_result.h"
+
 namespace cv {
     class Mat;
 };
@@ -34,6 +37,9 @@ namespace ImageProcessor
 typedef struct {
     char     work_dir[256];
     int32_t  num_threads;
+    int32_t  detection_interval;                /* run detection every N frames, and use the position predicted by the tracker in between. 0, 1 = every frame */
+    int32_t  is_adaptive_detection_interval;    /* 1: run detection earlier than N frames when tracks become uncertain */
+    char     archive_path[256];                 /* append the tracking result of each frame to this file (ColumnarArchive). "" = disable */
 } InputParam;
 
 typedef struct {
@@ -52,10 +58,22 @@ typedef struct {
     double time_post_process;  // [msec]
 } Result;
 
+/* Handle of a pipeline. Create one for each pipeline to run multiple pipelines in parallel threads */
+struct Context;
+
+Context* Create(const InputParam& input_param);     /* return nullptr on error */
+int32_t Destroy(Context* context);
+int32_t Process(Context* context, cv::Mat& mat, Result& result, double timestamp_ms = -1);    /* timestamp_ms < 0: use the current time */
+int32_t Process(Context* context, cv::Mat& mat, CompactResult& result, double timestamp_ms = -1);     /* variable length result without labels */
+int32_t Command(Context* context, int32_t cmd);
+int32_t GetInputSize(Context* context, int32_t& width, int32_t& height);    /* input size of the model, to prepare frames close to it */
+
+/* Use the default instance */
 int32_t Initialize(const InputParam& input_param);
-int32_t Process(cv::Mat& mat, Result& result);
+int32_t Process(cv::Mat& mat, Result& result, double timestamp_ms = -1);
 int32_t Finalize(void);
 int32_t Command(int32_t cmd);
+int32_t GetInputSize(int32_t& width, int32_t& height);
 
 }
 
@@ -16,7 +16,9 @@ limitations under the License.
 /* for general */
 #include <cstdint>
 #include <cstdlib>
+#include <cstdio>
 #include <string>
+#include <memory>
 #include <algorithm>
 #include <chrono>
 
@@ -25,6 +27,7 @@ limitations under the License.
 
 /* for My modules */
 #include "common_helper_cv.h"
+#include "frame_source.h"
 #include "image_processor.h"
 
 /*** Macro ***/
@@ -44,43 +47,52 @@ int32_t main(int argc, char* argv[])
     double total_time_inference = 0;
     double total_time_post_process = 0;
 
-    /* Find source image */
+    /* Initialize image processor library */
+    /* Run detection every N frames (N < 0: run detection earlier than |N| frames when tracks become uncertain) */
+    int32_t detection_interval = (argc > 2) ? std::atoi(argv[2]) : 1;
+    ImageProcessor::InputParam input_param = { WORK_DIR, 4, std::abs(detection_interval), detection_interval < 0 ? 1 : 0 };
+    /* Save the tracking result to the columnar archive file */
+    snprintf(input_param.archive_path, sizeof(input_param.archive_path), "%s", (argc > 3) ? argv[3] : "");
+    if (ImageProcessor::Initialize(input_param) != 0) {
+        printf("Initialization Error\n");
+        return -1;
+    }
+
+    /* Find source image. Frames are decoded at the reduced size close to the model input if possible
+     * *.raw (created by main_convert_raw) is used without decode, to measure the pipeline only */
     std::string input_name = (argc > 1) ? argv[1] : DEFAULT_INPUT_IMAGE;
-    cv::VideoCapture cap;   /* if cap is not opened, src is still image */
-    if (!CommonHelper::FindSourceImage(input_name, cap)) {
+    int32_t model_input_width = 0;
+    int32_t model_input_height = 0;
+    ImageProcessor::GetInputSize(model_input_width, model_input_height);
+    FrameSource::Config frame_source_config;
+    frame_source_config.target_width = model_input_width;
+    frame_source_config.target_height = model_input_height;
+    std::unique_ptr<FrameSource> frame_source(FrameSource::Create(input_name, frame_source_config));  /* if it's not sequence, src is still image */
+    if (!frame_source) {
+        ImageProcessor::Finalize();
         return -1;
     }
 
     /* Create video writer to save output video */
     cv::VideoWriter writer;
-    // writer = cv::VideoWriter("out.mp4", cv::VideoWriter::fourcc('M', 'P', '4', 'V'), (std::max)(10.0, cap.get(cv::CAP_PROP_FPS)), cv::Size(static_cast<int32_t>(cap.get(cv::CAP_PROP_FRAME_WIDTH)), static_cast<int32_t>(cap.get(cv::CAP_PROP_FRAME_HEIGHT))));
-
-    /* Initialize image processor library */
-    ImageProcessor::InputParam input_param = { WORK_DIR, 4 };
-    if (ImageProcessor::Initialize(input_param) != 0) {
-        printf("Initialization Error\n");
-        return -1;
-    }
+    // writer = cv::VideoWriter("out.mp4", cv::VideoWriter::fourcc('M', 'P', '4', 'V'), 30, cv::Size(width, height));
 
     /*** Process for each frame ***/
     int32_t frame_cnt = 0;
-    for (frame_cnt = 0; cap.isOpened() || frame_cnt < LOOP_NUM_FOR_TIME_MEASUREMENT; frame_cnt++) {
+    for (frame_cnt = 0; frame_source->IsSequence() || frame_cnt < LOOP_NUM_FOR_TIME_MEASUREMENT; frame_cnt++) {
         const auto& time_all0 = std::chrono::steady_clock::now();
         /* Read image */
         const auto& time_cap0 = std::chrono::steady_clock::now();
         cv::Mat image;
-        if (cap.isOpened()) {
-            cap.read(image);
-        } else {
-            image = cv::imread(input_name);
-        }
-        if (image.empty()) break;
+        double timestamp_ms = -1;
+        if (!frame_source->Read(image, timestamp_ms)) break;
+        if (frame_cnt == 0 && frame_source->GetScale() > 1) printf("Decode at 1/%d size\n", frame_source->GetScale());
         const auto& time_cap1 = std::chrono::steady_clock::now();
 
         /* Call image processor library */
         const auto& time_image_process0 = std::chrono::steady_clock::now();
         ImageProcessor::Result result;
-        ImageProcessor::Process(image, result);
+        ImageProcessor::Process(image, result, timestamp_ms);
         const auto& time_image_process1 = std::chrono::steady_clock::now();
 
         /* Display result */
@@ -88,10 +100,12 @@ int32_t main(int argc, char* argv[])
         cv::imshow("test", image);
 
         /* Input key command */
-        if (cap.isOpened()) {
+        if (frame_source->IsSequence()) {
             /* this code needs to be before calculating processing time because cv::waitKey includes image output */
-            /* however, when 'q' key is pressed (cap.released()), processing time significantly incraeases. So escape from the loop before calculating time */
-            if (CommonHelper::InputKeyCommand(cap)) break;
+            /* however, when 'q' key is pressed, processing time significantly incraeases. So escape from the loop before calculating time */
+            if (CommonHelper::InputKeyCommand([&frame_source](int32_t frame_offset) {
+                frame_source->Seek(frame_source->GetPosition() + frame_offset);
+            })) break;
         };
 
         /* Print processing time */
@@ -31,6 +31,7 @@ limitations under the License.
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "anchor_decoder.h"
 #include "inference_helper.h"
 #include "inference_helper_tensorrt.h"      // to call SetDlaCore
 #include "detection_engine.h"
@@ -44,15 +45,18 @@ limitations under the License.
 #define MODEL_NAME  "yolox_nano_480x640.onnx"
 #define TENSORTYPE  TensorInfo::kTensorTypeFp32
 #define INPUT_NAME  "images"
-#define INPUT_DIMS  { 1, 3, 480, 640 }
+#define INPUT_DIMS  { 1, 3, kInputHeight, kInputWidth }    /* set the first dim to N when the model is exported with batch size N */
 #define IS_NCHW     true
 #define IS_RGB      true
 #define OUTPUT_NAME "output"
 
+static constexpr int32_t kInputWidth = 640;
+static constexpr int32_t kInputHeight = 480;
 static constexpr int32_t kGridScaleList[] = { 8, 16, 32 };
 static constexpr int32_t kGridChannel = 1;
 static constexpr int32_t kNumberOfClass = 80;
 static constexpr int32_t kElementNumOfAnchor = kNumberOfClass + 5;    // x, y, w, h, bbox confidence, [class confidence]
+typedef AnchorDecoder::Decoder<kNumberOfClass, AnchorDecoder::Layout::kAnchorMajor, AnchorDecoder::Activation::kNone, AnchorDecoder::BoxEncoding::kGridExp> Decoder;
 
 #define LABEL_NAME   "label_coco_80.txt"
 
@@ -117,56 +121,245 @@ int32_t DetectionEngine::Finalize()
     return kRetOk;
 }
 
+void DetectionEngine::GetInputSize(int32_t& width, int32_t& height) const
+{
+    width = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetWidth();
+    height = input_tensor_info_list_.empty() ? 0 : input_tensor_info_list_[0].GetHeight();
+}
+
+
+/* Decoder of each stride, specialized with the grid size */
+template <int32_t kGridScale>
+static void DecodeGrid(const float* data, const AnchorDecoder::Param& param, std::vector<BoundingBox>& bbox_list)
+{
+    Decoder::Decode<kGridScale, kInputWidth / kGridScale, kInputHeight / kGridScale, kGridChannel>(data, param, nullptr, bbox_list);
+}
+
+typedef void (*DecodeGridFunc)(const float* data, const AnchorDecoder::Param& param, std::vector<BoundingBox>& bbox_list);
+static constexpr DecodeGridFunc kDecodeGridList[] = { DecodeGrid<kGridScaleList[0]>, DecodeGrid<kGridScaleList[1]>, DecodeGrid<kGridScaleList[2]> };
+static_assert(sizeof(kDecodeGridList) / sizeof(kDecodeGridList[0]) == sizeof(kGridScaleList) / sizeof(kGridScaleList[0]), "a decoder for each grid scale");
+
+
+void DetectionEngine::DecodeOutput(const float* output_data, int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, std::vector<BoundingBox>& bbox_nms_list)
+{
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+
+    /* Get boundig box. Each stride has its own table, so they are decoded in parallel and then concatenated in order */
+    static constexpr int32_t kGridScaleNum = sizeof(kGridScaleList) / sizeof(kGridScaleList[0]);
+    std::array<const float*, kGridScaleNum> data_list;
+    for (int32_t i = 0; i < kGridScaleNum; i++) {
+        data_list[i] = output_data;
+        output_data += (kInputWidth / kGridScaleList[i]) * (kInputHeight / kGridScaleList[i]) * kGridChannel * kElementNumOfAnchor;
+    }
+    AnchorDecoder::Param param;
+    param.threshold_objectness = threshold_box_confidence_;
+    param.threshold_class = threshold_class_confidence_;
+    param.scale_x = static_cast<float>(crop_w) / input_tensor_info.GetWidth();      /* scale to original image */
+    param.scale_y = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
+    std::array<std::vector<BoundingBox>, kGridScaleNum> bbox_list_of_scale;
+#pragma omp parallel for
+    for (int32_t i = 0; i < kGridScaleNum; i++) {
+        kDecodeGridList[i](data_list[i], param, bbox_list_of_scale[i]);
+    }
+    std::vector<BoundingBox> bbox_list;
+    for (const auto& bbox_list_part : bbox_list_of_scale) {
+        bbox_list.insert(bbox_list.end(), bbox_list_part.begin(), bbox_list_part.end());
+    }
 
-void DetectionEngine::GetBoundingBox(const float* data, float scale_x, float  scale_y, int32_t grid_w, int32_t grid_h, std::vector<BoundingBox>& bbox_list)
-{
-    int32_t index = 0;
-    for (int32_t grid_y = 0; grid_y < grid_h; grid_y++) {
-        for (int32_t grid_x = 0; grid_x < grid_w; grid_x++) {
-            for (int32_t grid_c = 0; grid_c < kGridChannel; grid_c++) {
-                float box_confidence = data[index + 4];
-                if (box_confidence >= threshold_box_confidence_) {
-                    int32_t class_id = 0;
-                    float confidence = 0;
-                    for (int32_t class_index = 0; class_index < kNumberOfClass; class_index++) {
-                        float confidence_of_class = data[index + 5 + class_index];
-                        if (confidence_of_class > confidence) {
-                            confidence = confidence_of_class;
-                            class_id = class_index;
-                        }
-                    }
-
-                    if (confidence >= threshold_class_confidence_) {
-                        int32_t cx = static_cast<int32_t>((data[index + 0] + grid_x) * scale_x);
-                        int32_t cy = static_cast<int32_t>((data[index + 1] + grid_y) * scale_y);
-                        int32_t w = static_cast<int32_t>(std::exp(data[index + 2]) * scale_x);
-                        int32_t h = static_cast<int32_t>(std::exp(data[index + 3]) * scale_y);
-                        int32_t x = cx - w / 2;
-                        int32_t y = cy - h / 2;
-                        bbox_list.push_back(BoundingBox(class_id, "", confidence, x, y, w, h));
-                    }
-                }
-                index += kElementNumOfAnchor;
+    /* Adjust bounding box */
+    for (auto& bbox : bbox_list) {
+        bbox.x += crop_x;
+        bbox.y += crop_y;
+        bbox.label = label_list_[bbox.class_id];
+    }
+
+    /* NMS */
+    BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
+}
+
+
+/* Normalize the resized image in the same way as InferenceHelper::PreProcess does for kDataTypeImage, and store it as NCHW */
+void DetectionEngine::ConvertToBlob(const cv::Mat& img_src, float* blob)
+{
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t img_size = img_src.cols * img_src.rows;
+    for (int32_t c = 0; c < 3; c++) {
+        const float mean = input_tensor_info.normalize.mean[c];
+        const float norm = input_tensor_info.normalize.norm[c];
+        float* dst = blob + c * img_size;
+#pragma omp parallel for
+        for (int32_t y = 0; y < img_src.rows; y++) {
+            const uint8_t* src = img_src.ptr<uint8_t>(y);
+            for (int32_t x = 0; x < img_src.cols; x++) {
+                dst[y * img_src.cols + x] = (src[x * 3 + c] / 255.0f - mean) / norm;
             }
         }
     }
 }
 
 
+int32_t DetectionEngine::GetBatchSize() const
+{
+    if (input_tensor_info_list_.empty()) return 1;
+    return (std::max)(1, input_tensor_info_list_[0].GetBatch());
+}
+
+
+int32_t DetectionEngine::Process(const std::vector<cv::Mat>& original_mat_list, std::vector<Result>& result_list)
+{
+    if (!inference_helper_) {
+        PRINT_E("Inference helper is not created\n");
+        return kRetErr;
+    }
+    std::vector<const cv::Mat*> mat_list;
+    std::vector<std::array<int32_t, 4>> crop_list;
+    for (const auto& original_mat : original_mat_list) {
+        mat_list.push_back(&original_mat);
+        crop_list.push_back({ 0, 0, original_mat.cols, original_mat.rows });
+    }
+    return ProcessBatch(mat_list, crop_list, result_list);
+}
+
+
+int32_t DetectionEngine::Process(const cv::Mat& original_mat, const std::vector<cv::Rect>& roi_list, Result& result)
+{
+    if (!inference_helper_) {
+        PRINT_E("Inference helper is not created\n");
+        return kRetErr;
+    }
+    std::vector<const cv::Mat*> mat_list;
+    std::vector<std::array<int32_t, 4>> crop_list;
+    for (const auto& roi : roi_list) {
+        mat_list.push_back(&original_mat);
+        crop_list.push_back({ roi.x, roi.y, roi.width, roi.height });
+    }
+    std::vector<Result> result_list;
+    if (ProcessBatch(mat_list, crop_list, result_list) != kRetOk) {
+        return kRetErr;
+    }
+
+    /* Bounding boxes are already in the frame coordinate. An object on the boundary of ROIs may be detected twice */
+    result = Result();
+    std::vector<BoundingBox> bbox_list;
+    for (const auto& result_roi : result_list) {
+        bbox_list.insert(bbox_list.end(), result_roi.bbox_list.begin(), result_roi.bbox_list.end());
+        result.time_pre_process += result_roi.time_pre_process;
+        result.time_inference += result_roi.time_inference;
+        result.time_post_process += result_roi.time_post_process;
+    }
+    BoundingBoxUtils::Nms(bbox_list, result.bbox_list, threshold_nms_iou_);
+    if (!result_list.empty()) {
+        result.crop = result_list[0].crop;
+    }
+    return kRetOk;
+}
+
+
+int32_t DetectionEngine::ProcessBatch(const std::vector<const cv::Mat*>& original_mat_list, const std::vector<std::array<int32_t, 4>>& crop_list_in, std::vector<Result>& result_list)
+{
+    result_list.clear();
+    result_list.resize(original_mat_list.size());
+
+    /* The model takes one image at a time. Just process them one by one */
+    const int32_t batch_size = GetBatchSize();
+    if (batch_size == 1) {
+        for (size_t i = 0; i < original_mat_list.size(); i++) {
+            const auto& crop = crop_list_in[i];
+            if (ProcessCrop(*original_mat_list[i], crop[0], crop[1], crop[2], crop[3], result_list[i]) != kRetOk) {
+                return kRetErr;
+            }
+        }
+        return kRetOk;
+    }
+
+    /* The model is exported with batch size N (INPUT_DIMS = { N, 3, H, W }). Pack up to N images into one blob */
+    InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t image_element_num = 3 * input_tensor_info.GetHeight() * input_tensor_info.GetWidth();
+    const int32_t output_element_num = output_tensor_info_list_[0].GetElementNum() / batch_size;
+    blob_.resize(static_cast<size_t>(batch_size) * image_element_num);
+    cv::Mat img_src = cv::Mat::zeros(input_tensor_info.GetHeight(), input_tensor_info.GetWidth(), CV_8UC3);
+    for (size_t index_start = 0; index_start < original_mat_list.size(); index_start += batch_size) {
+        const int32_t num = (std::min)(batch_size, static_cast<int32_t>(original_mat_list.size() - index_start));
+
+        /*** PreProcess ***/
+        const auto& t_pre_process0 = std::chrono::steady_clock::now();
+        std::vector<std::array<int32_t, 4>> crop_list(num);
+        for (int32_t b = 0; b < num; b++) {
+            const cv::Mat& original_mat = *original_mat_list[index_start + b];
+            auto& crop = crop_list[b];
+            crop = crop_list_in[index_start + b];
+            img_src = cv::Scalar(0, 0, 0);
+            CommonHelper::CropResizeCvt(original_mat, img_src, crop[0], crop[1], crop[2], crop[3], IS_RGB, CommonHelper::kCropTypeExpand);
+            ConvertToBlob(img_src, blob_.data() + b * image_element_num);
+        }
+        /* Unused slots of the last batch keep the previous data. Their outputs are just ignored */
+        input_tensor_info.data = blob_.data();
+        input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNchw;
+        if (inference_helper_->PreProcess(input_tensor_info_list_) != InferenceHelper::kRetOk) {
+            return kRetErr;
+        }
+        const auto& t_pre_process1 = std::chrono::steady_clock::now();
+
+        /*** Inference ***/
+        const auto& t_inference0 = std::chrono::steady_clock::now();
+        if (inference_helper_->Process(output_tensor_info_list_) != InferenceHelper::kRetOk) {
+            return kRetErr;
+        }
+        const auto& t_inference1 = std::chrono::steady_clock::now();
+
+        /*** PostProcess ***/
+        const auto& t_post_process0 = std::chrono::steady_clock::now();
+        const float* output_data = output_tensor_info_list_[0].GetDataAsFloat();
+        for (int32_t b = 0; b < num; b++) {
+            const cv::Mat& original_mat = *original_mat_list[index_start + b];
+            const auto& crop = crop_list[b];
+            Result& result = result_list[index_start + b];
+            DecodeOutput(output_data + b * output_element_num, crop[0], crop[1], crop[2], crop[3], result.bbox_list);
+            result.crop.x = (std::max)(0, crop[0]);
+            result.crop.y = (std::max)(0, crop[1]);
+            result.crop.w = (std::min)(crop[2], original_mat.cols - result.crop.x);
+            result.crop.h = (std::min)(crop[3], original_mat.rows - result.crop.y);
+        }
+        const auto& t_post_process1 = std::chrono::steady_clock::now();
+
+        /* Processing time is shared by the images in the same batch */
+        for (int32_t b = 0; b < num; b++) {
+            Result& result = result_list[index_start + b];
+            result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0 / num;
+            result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0 / num;
+            result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0 / num;
+        }
+    }
+
+    return kRetOk;
+}
+
+
 int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 {
     if (!inference_helper_) {
         PRINT_E("Inference helper is not created\n");
         return kRetErr;
     }
+    if (GetBatchSize() > 1) {
+        /* kDataTypeImage supports one image only */
+        std::vector<Result> result_list;
+        if (Process(std::vector<cv::Mat>{ original_mat }, result_list) != kRetOk) {
+            return kRetErr;
+        }
+        result = result_list[0];
+        return kRetOk;
+    }
+    return ProcessCrop(original_mat, 0, 0, original_mat.cols, original_mat.rows, result);
+}
+
+
+int32_t DetectionEngine::ProcessCrop(const cv::Mat& original_mat, int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, Result& result)
+{
     /*** PreProcess ***/
     const auto& t_pre_process0 = std::chrono::steady_clock::now();
     InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
     /* do crop, resize and color conversion here because some inference engine doesn't support these operations */
-    int32_t crop_x = 0;
-    int32_t crop_y = 0;
-    int32_t crop_w = original_mat.cols;
-    int32_t crop_h = original_mat.rows;
     cv::Mat img_src = cv::Mat::zeros(input_tensor_info.GetHeight(), input_tensor_info.GetWidth(), CV_8UC3);
     //CommonHelper::CropResizeCvt(original_mat, img_src, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeStretch);
     //CommonHelper::CropResizeCvt(original_mat, img_src, crop_x, crop_y, crop_w, crop_h, IS_RGB, CommonHelper::kCropTypeCut);
@@ -197,30 +390,8 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 
     /*** PostProcess ***/
     const auto& t_post_process0 = std::chrono::steady_clock::now();
-    /* Get boundig box */
-    std::vector<BoundingBox> bbox_list;
-    float* output_data = output_tensor_info_list_[0].GetDataAsFloat();
-    for (const auto& grid_scale : kGridScaleList) {
-        int32_t grid_w = input_tensor_info.GetWidth() / grid_scale;
-        int32_t grid_h = input_tensor_info.GetHeight() / grid_scale;
-        float scale_x = static_cast<float>(grid_scale) * crop_w / input_tensor_info.GetWidth();      /* scale to original image */
-        float scale_y = static_cast<float>(grid_scale) * crop_h / input_tensor_info.GetHeight();
-        GetBoundingBox(output_data, scale_x, scale_y, grid_w, grid_h, bbox_list);
-        output_data += grid_w * grid_h * kGridChannel * kElementNumOfAnchor;
-    }
-
-
-    /* Adjust bounding box */
-    for (auto& bbox : bbox_list) {
-        bbox.x += crop_x;  
-        bbox.y += crop_y;
-        bbox.label = label_list_[bbox.class_id];
-    }
-
-    /* NMS */
     std::vector<BoundingBox> bbox_nms_list;
-    BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
-
+    DecodeOutput(output_tensor_info_list_[0].GetDataAsFloat(), crop_x, crop_y, crop_w, crop_h, bbox_nms_list);
     const auto& t_post_process1 = std::chrono::steady_clock::now();
 
     /* Return the results */
@@ -237,6 +408,99 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 }
 
 
+int32_t DetectionEngine::PreProcessStage(const cv::Mat& original_mat, Job& job)
+{
+    if (!inference_helper_) {
+        PRINT_E("Inference helper is not created\n");
+        return kRetErr;
+    }
+    const auto& t_pre_process0 = std::chrono::steady_clock::now();
+    const InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    job.original_w = original_mat.cols;
+    job.original_h = original_mat.rows;
+    job.crop_x = 0;
+    job.crop_y = 0;
+    job.crop_w = original_mat.cols;
+    job.crop_h = original_mat.rows;
+    job.img_src = cv::Mat::zeros(input_tensor_info.GetHeight(), input_tensor_info.GetWidth(), CV_8UC3);
+    CommonHelper::CropResizeCvt(original_mat, job.img_src, job.crop_x, job.crop_y, job.crop_w, job.crop_h, IS_RGB, CommonHelper::kCropTypeExpand);
+    const auto& t_pre_process1 = std::chrono::steady_clock::now();
+    job.result = Result();
+    job.result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+    return kRetOk;
+}
+
+
+int32_t DetectionEngine::InferenceStage(Job& job)
+{
+    if (!inference_helper_) {
+        PRINT_E("Inference helper is not created\n");
+        return kRetErr;
+    }
+
+    /*** PreProcess (set the input tensor) ***/
+    const auto& t_pre_process0 = std::chrono::steady_clock::now();
+    InputTensorInfo& input_tensor_info = input_tensor_info_list_[0];
+    const int32_t batch_size = GetBatchSize();
+    if (batch_size == 1) {
+        input_tensor_info.data = job.img_src.data;
+        input_tensor_info.data_type = InputTensorInfo::kDataTypeImage;
+        input_tensor_info.image_info.width = job.img_src.cols;
+        input_tensor_info.image_info.height = job.img_src.rows;
+        input_tensor_info.image_info.channel = job.img_src.channels();
+        input_tensor_info.image_info.crop_x = 0;
+        input_tensor_info.image_info.crop_y = 0;
+        input_tensor_info.image_info.crop_width = job.img_src.cols;
+        input_tensor_info.image_info.crop_height = job.img_src.rows;
+        input_tensor_info.image_info.is_bgr = false;
+        input_tensor_info.image_info.swap_color = false;
+    } else {
+        /* Use the first slot of the batch only */
+        const int32_t image_element_num = 3 * input_tensor_info.GetHeight() * input_tensor_info.GetWidth();
+        blob_.resize(static_cast<size_t>(batch_size) * image_element_num);
+        ConvertToBlob(job.img_src, blob_.data());
+        input_tensor_info.data = blob_.data();
+        input_tensor_info.data_type = InputTensorInfo::kDataTypeBlobNchw;
+    }
+    if (inference_helper_->PreProcess(input_tensor_info_list_) != InferenceHelper::kRetOk) {
+        return kRetErr;
+    }
+    const auto& t_pre_process1 = std::chrono::steady_clock::now();
+
+    /*** Inference ***/
+    const auto& t_inference0 = std::chrono::steady_clock::now();
+    if (inference_helper_->Process(output_tensor_info_list_) != InferenceHelper::kRetOk) {
+        return kRetErr;
+    }
+
+    /* The output tensor is overwritten by the next inference */
+    const float* output_data = output_tensor_info_list_[0].GetDataAsFloat();
+    const int32_t output_element_num = output_tensor_info_list_[0].GetElementNum() / batch_size;
+    job.output.assign(output_data, output_data + output_element_num);
+    const auto& t_inference1 = std::chrono::steady_clock::now();
+
+    job.result.time_pre_process += static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+    job.result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
+    return kRetOk;
+}
+
+
+int32_t DetectionEngine::PostProcessStage(Job& job)
+{
+    const auto& t_post_process0 = std::chrono::steady_clock::now();
+    Result& result = job.result;
+    result.bbox_list.clear();
+    DecodeOutput(job.output.data(), job.crop_x, job.crop_y, job.crop_w, job.crop_h, result.bbox_list);
+    result.crop.x = (std::max)(0, job.crop_x);
+    result.crop.y = (std::max)(0, job.crop_y);
+    result.crop.w = (std::min)(job.crop_w, job.original_w - result.crop.x);
+    result.crop.h = (std::min)(job.crop_h, job.original_h - result.crop.y);
+    const auto& t_post_process1 = std::chrono::steady_clock::now();
+    result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;
+    return kRetOk;
+}
+
+
 int32_t DetectionEngine::ReadLabel(const std::string& filename, std::vector<std::string>& label_list)
 {
     std::ifstream ifs(filename);
@@ -54,6 +54,20 @@ public:
         {}
     } Result;
 
+    /* Working data of a frame for the stage functions */
+    typedef struct Job_ {
+        cv::Mat             img_src;            // cropped and resized input image
+        int32_t             crop_x;
+        int32_t             crop_y;
+        int32_t             crop_w;
+        int32_t             crop_h;
+        int32_t             original_w;
+        int32_t             original_h;
+        std::vector<float>  output;             // copy of the output tensor
+        Result              result;
+        Job_() : crop_x(0), crop_y(0), crop_w(0), crop_h(0), original_w(0), original_h(0) {}
+    } Job;
+
 public:
     DetectionEngine() {
         threshold_box_confidence_ = 0.4f;
@@ -64,6 +78,16 @@ public:
     int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
     int32_t Finalize(void);
     int32_t Process(const cv::Mat& original_mat, Result& result);
+    int32_t Process(const std::vector<cv::Mat>& original_mat_list, std::vector<Result>& result_list);
+    int32_t Process(const cv::Mat& original_mat, const std::vector<cv::Rect>& roi_list, Result& result);  /* run detection on the regions only */
+    int32_t GetBatchSize() const;
+    void GetInputSize(int32_t& width, int32_t& height) const;
+
+    /* Process() split into stages for pipelining. Stages of different frames can run in different threads at the same time,
+     * but each stage must be called in the order of frames, and not from multiple threads at the same time */
+    int32_t PreProcessStage(const cv::Mat& original_mat, Job& job);     /* crop, resize and color conversion */
+    int32_t InferenceStage(Job& job);                                   /* set the input tensor, run inference and copy the output */
+    int32_t PostProcessStage(Job& job);                                 /* decode the output into job.result */
     void SetThreshold(float threshold_box_confidence, float threshold_class_confidence, float threshold_nms_iou) {
         threshold_box_confidence_ = threshold_box_confidence;
         threshold_class_confidence_ = threshold_class_confidence;
@@ -72,13 +96,17 @@ public:
 
 private:
     int32_t ReadLabel(const std::string& filename, std::vector<std::string>& label_list);
-    void GetBoundingBox(const float* data, float scale_x, float  scale_y, int32_t grid_w, int32_t grid_h, std::vector<BoundingBox>& bbox_list);
+    void ConvertToBlob(const cv::Mat& img_src, float* blob);
+    int32_t ProcessCrop(const cv::Mat& original_mat, int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, Result& result);
+    int32_t ProcessBatch(const std::vector<const cv::Mat*>& original_mat_list, const std::vector<std::array<int32_t, 4>>& crop_list, std::vector<Result>& result_list);
+    void DecodeOutput(const float* output_data, int32_t crop_x, int32_t crop_y, int32_t crop_w, int32_t crop_h, std::vector<BoundingBox>& bbox_nms_list);
 
 private:
     std::unique_ptr<InferenceHelper> inference_helper_;
     std::vector<InputTensorInfo> input_tensor_info_list_;
     std::vector<OutputTensorInfo> output_tensor_info_list_;
     std::vector<std::string> label_list_;
+    std::vector<float> blob_;   /* input buffer for batch processing (NCHW) */
 
     float threshold_box_confidence_;
     float threshold_class_confidence_;
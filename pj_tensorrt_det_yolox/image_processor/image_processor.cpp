@@ -25,6 +25,11 @@ limitations under the License.
 #include <chrono>
 #include <fstream>
 #include <memory>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
@@ -32,6 +37,10 @@ limitations under the License.
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "motion_gate.h"
+#include "blocking_queue.h"
+#include "compact_result.h"
+#include "columnar_archive.h"
 #include "bounding_box.h"
 #include "detection_engine.h"
 #include "tracker.h"
@@ -43,14 +52,79 @@ limitations under the License.
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
 /*** Global variable ***/
-std::unique_ptr<DetectionEngine> s_engine;
-Tracker s_tracker;
+/* For detection interval */
+static constexpr double kNominalFps = 30.0;                 /* dt for the tracker is 1.0 at this frame rate */
+static constexpr double kAdaptiveUncertaintyRatio = 0.1;    /* run detection when the position uncertainty exceeds this ratio of the object size */
+
+/* For ROI re-detection */
+static constexpr float kRoiMarginRatio = 0.5F;      /* margin around the predicted position for each side, relative to the object size */
+static constexpr int32_t kRoiMinSize = 96;          /* [px] */
+static constexpr double kRoiMaxAreaRatio = 0.5;     /* use full frame detection when ROIs cover more than this ratio of the frame */
+
+/* For asynchronous processing */
+static constexpr int32_t kDefaultAsyncMaxInFlight = 3;     /* one frame for each stage (pre process, inference, post process) */
+
+/*** Type ***/
+/* A frame submitted by ProcessAsync. mat and result are owned by the caller */
+struct AsyncJob {
+    cv::Mat* mat;
+    ImageProcessor::Result* result;
+    int64_t frame_index;
+    double timestamp_ms;
+    float dt;
+    int32_t ret;
+    DetectionEngine::Job engine_job;
+    std::promise<int32_t> promise;
+    std::function<void(int32_t)> callback;     /* promise is used if empty */
+    AsyncJob() : mat(nullptr), result(nullptr), frame_index(0), timestamp_ms(0), dt(1.0F), ret(0) {}
+};
+typedef std::shared_ptr<AsyncJob> AsyncJobPtr;
+
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<DetectionEngine> engine;
+    Tracker tracker;
+    MotionGate motion_gate;
+    DetectionEngine::Result det_result_previous;
+
+    /* For detection interval */
+    int32_t detection_interval;
+    bool is_adaptive_detection_interval;
+    int32_t frame_cnt_from_detection;
+    double timestamp_previous;
+
+    /* For ROI re-detection */
+    bool is_roi_redetection;
+
+    int64_t frame_index;
+
+    /* For archive of the tracking result */
+    std::unique_ptr<ColumnarArchive::Writer> archive_writer;
+    CompactResult archive_result;
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    /* For asynchronous processing. Each stage has its own thread, so frames are completed in the submitted order */
+    int32_t async_max_in_flight;
+    std::vector<std::thread> async_thread_list;
+    BlockingQueue<AsyncJobPtr> queue_pre_process;
+    BlockingQueue<AsyncJobPtr> queue_inference;
+    BlockingQueue<AsyncJobPtr> queue_post_process;
+    std::mutex mutex_in_flight;
+    std::condition_variable cv_in_flight;
+    int32_t in_flight_num;
+
+    Context() : detection_interval(1), is_adaptive_detection_interval(false), frame_cnt_from_detection(0), timestamp_previous(-1), is_roi_redetection(false), frame_index(-1), time_previous(std::chrono::steady_clock::now()),
+        async_max_in_flight(kDefaultAsyncMaxInFlight), in_flight_num(0) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -61,79 +135,80 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
 static cv::Scalar GetColorForId(int32_t id)
 {
     static constexpr int32_t kMaxNum = 100;
-    static std::vector<cv::Scalar> color_list;
-    if (color_list.empty()) {
+    /* created only once even when called from multiple threads */
+    static const std::vector<cv::Scalar> color_list = []() {
+        std::vector<cv::Scalar> list;
         std::srand(123);
         for (int32_t i = 0; i < kMaxNum; i++) {
-            color_list.push_back(CommonHelper::CreateCvColor(std::rand() % 255, std::rand() % 255, std::rand() % 255));
+            list.push_back(CommonHelper::CreateCvColor(std::rand() % 255, std::rand() % 255, std::rand() % 255));
         }
-    }
+        return list;
+    }();
     return color_list[id % kMaxNum];
 }
 
-int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+static bool IsDetectionFrame(ImageProcessor::Context* context)
 {
-    if (s_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
-    }
-
-    s_engine.reset(new DetectionEngine());
-    if (s_engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
-        s_engine->Finalize();
-        s_engine.reset();
-        return -1;
+    if (context->frame_cnt_from_detection + 1 >= context->detection_interval) return true;
+    if (context->is_adaptive_detection_interval) {
+        for (auto& track : context->tracker.GetTrackList()) {
+            /* confirm a new track as soon as possible */
+            if (track.GetDetectedCount() < 2) return true;
+            /* the predicted position is not reliable any more */
+            const auto& bbox = track.GetLatestBoundingBox();
+            if (track.GetPositionUncertainty() > kAdaptiveUncertaintyRatio * (std::min)(bbox.w, bbox.h)) return true;
+        }
     }
-    return 0;
+    return false;
 }
 
-int32_t ImageProcessor::Finalize(void)
+static void CreateRoiList(ImageProcessor::Context* context, float dt, int32_t image_w, int32_t image_h, std::vector<cv::Rect>& roi_list)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
-        return -1;
+    /* Expand the predicted position with margin for the prediction error */
+    roi_list.clear();
+    const cv::Rect rect_image(0, 0, image_w, image_h);
+    for (const auto& track : context->tracker.GetTrackList()) {
+        const BoundingBox bbox = track.GetPredictedBoundingBox(dt);
+        const int32_t margin = static_cast<int32_t>(kRoiMarginRatio * (std::max)(bbox.w, bbox.h) + 3 * track.GetPositionUncertainty());
+        const int32_t w = (std::max)(bbox.w + 2 * margin, kRoiMinSize);
+        const int32_t h = (std::max)(bbox.h + 2 * margin, kRoiMinSize);
+        const cv::Rect roi = cv::Rect(bbox.x + bbox.w / 2 - w / 2, bbox.y + bbox.h / 2 - h / 2, w, h) & rect_image;
+        if (roi.area() > 0) roi_list.push_back(roi);
     }
 
-    if (s_engine->Finalize() != DetectionEngine::kRetOk) {
-        return -1;
+    /* Merge overlapping ROIs so that the same area is not processed twice */
+    for (bool is_merged = true; is_merged;) {
+        is_merged = false;
+        for (size_t i = 0; i < roi_list.size() && !is_merged; i++) {
+            for (size_t j = i + 1; j < roi_list.size(); j++) {
+                if ((roi_list[i] & roi_list[j]).area() > 0) {
+                    roi_list[i] |= roi_list[j];
+                    roi_list.erase(roi_list.begin() + j);
+                    is_merged = true;
+                    break;
+                }
+            }
+        }
     }
-
-    return 0;
 }
 
-
-int32_t ImageProcessor::Command(int32_t cmd)
+/* timestamp_ms is replaced with the current time if it's negative */
+static float CalculateDt(ImageProcessor::Context* context, double& timestamp_ms)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
-        return -1;
+    /* Time from the previous frame for the tracker */
+    if (timestamp_ms < 0) {
+        timestamp_ms = static_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now().time_since_epoch()).count();
     }
-
-    switch (cmd) {
-    case 0:
-    default:
-        PRINT_E("command(%d) is not supported\n", cmd);
-        return -1;
+    float dt = 1.0F;
+    if (context->timestamp_previous >= 0 && timestamp_ms > context->timestamp_previous) {
+        dt = static_cast<float>((timestamp_ms - context->timestamp_previous) * kNominalFps / 1000.0);
     }
+    context->timestamp_previous = timestamp_ms;
+    return dt;
 }
 
-
-
-int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
+static void DrawResult(ImageProcessor::Context* context, cv::Mat& mat, const DetectionEngine::Result& det_result, bool is_detection_run)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
-        return -1;
-    }
-
-    DetectionEngine::Result det_result;
-    if (s_engine->Process(mat, det_result) != DetectionEngine::kRetOk) {
-        return -1;
-    }
-
-    /* Display target area  */
-    cv::rectangle(mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
-
     /* Display detection result (black rectangle) */
     int32_t num_det = 0;
     for (const auto& bbox : det_result.bbox_list) {
@@ -142,9 +217,8 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     }
 
     /* Display tracking result  */
-    s_tracker.Update(det_result.bbox_list);
     int32_t num_track = 0;
-    auto& track_list = s_tracker.GetTrackList();
+    auto& track_list = context->tracker.GetTrackList();
     for (auto& track : track_list) {
         if (track.GetDetectedCount() < 2) continue;
         const auto& bbox = track.GetLatestData().bbox;
@@ -161,13 +235,15 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
         }
         num_track++;
     }
-    CommonHelper::DrawText(mat, "DET: " + std::to_string(num_det) + ", TRACK: " + std::to_string(num_track), cv::Point(0, 20), 0.7, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
+    CommonHelper::DrawText(mat, "DET: " + (is_detection_run ? std::to_string(num_det) : std::string("-")) + ", TRACK: " + std::to_string(num_track), cv::Point(0, 20), 0.7, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
 
-    DrawFps(mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    DrawFps(context->time_previous, mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+}
 
-    /* Return the results */
+static void SetResult(ImageProcessor::Context* context, const DetectionEngine::Result& det_result, ImageProcessor::Result& result)
+{
     int32_t bbox_num = 0;
-    for (auto& track : track_list) {
+    for (auto& track : context->tracker.GetTrackList()) {
         const auto& bbox = track.GetLatestData().bbox;
         result.object_list[bbox_num].class_id = bbox.class_id;
         snprintf(result.object_list[bbox_num].label, sizeof(result.object_list[bbox_num].label), "%s", bbox.label.c_str());
@@ -184,7 +260,403 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     result.time_pre_process = det_result.time_pre_process;
     result.time_inference = det_result.time_inference;
     result.time_post_process = det_result.time_post_process;
+}
+
+static void SetCompactResult(ImageProcessor::Context* context, int64_t frame_index, double timestamp_ms, const DetectionEngine::Result& det_result, CompactResult& result)
+{
+    result.Clear();
+    result.header.frame_index = frame_index;
+    result.header.timestamp_ms = timestamp_ms;
+    result.header.time_pre_process = static_cast<float>(det_result.time_pre_process);
+    result.header.time_inference = static_cast<float>(det_result.time_inference);
+    result.header.time_post_process = static_cast<float>(det_result.time_post_process);
+    for (auto& track : context->tracker.GetTrackList()) {
+        const auto& bbox = track.GetLatestData().bbox;
+        CompactResult::Object object;
+        object.track_id = track.GetId();
+        object.class_id = static_cast<int16_t>(bbox.class_id);
+        object.flags = bbox.score == 0 ? CompactResult::kFlagPredicted : 0;
+        object.score = bbox.score;
+        object.x = static_cast<float>(bbox.x);
+        object.y = static_cast<float>(bbox.y);
+        object.w = static_cast<float>(bbox.w);
+        object.h = static_cast<float>(bbox.h);
+        result.object_list.push_back(object);
+    }
+}
+
+static void ArchiveResult(ImageProcessor::Context* context, int64_t frame_index, double timestamp_ms, const DetectionEngine::Result& det_result)
+{
+    if (!context->archive_writer) return;
+    SetCompactResult(context, frame_index, timestamp_ms, det_result, context->archive_result);
+    context->archive_writer->Append(context->archive_result);
+}
+
+static void CompleteAsyncJob(ImageProcessor::Context* context, AsyncJobPtr job)
+{
+    if (job->callback) {
+        job->callback(job->ret);
+    } else {
+        job->promise.set_value(job->ret);
+    }
+    std::lock_guard<std::mutex> lock(context->mutex_in_flight);
+    context->in_flight_num--;
+    context->cv_in_flight.notify_all();
+}
+
+static void ThreadPreProcess(ImageProcessor::Context* context)
+{
+    AsyncJobPtr job;
+    while (context->queue_pre_process.Pop(job)) {
+        if (context->engine->PreProcessStage(*job->mat, job->engine_job) != DetectionEngine::kRetOk) job->ret = -1;
+        context->queue_inference.Push(job);
+    }
+}
 
+static void ThreadInference(ImageProcessor::Context* context)
+{
+    AsyncJobPtr job;
+    while (context->queue_inference.Pop(job)) {
+        if (job->ret == 0 && context->engine->InferenceStage(job->engine_job) != DetectionEngine::kRetOk) job->ret = -1;
+        context->queue_post_process.Push(job);
+    }
+}
+
+static void ThreadPostProcess(ImageProcessor::Context* context)
+{
+    AsyncJobPtr job;
+    while (context->queue_post_process.Pop(job)) {
+        if (job->ret == 0 && context->engine->PostProcessStage(job->engine_job) != DetectionEngine::kRetOk) job->ret = -1;
+        if (job->ret == 0) {
+            /* Frames come in the submitted order, so the tracker is updated in order */
+            const DetectionEngine::Result& det_result = job->engine_job.result;
+            context->tracker.Update(det_result.bbox_list, job->dt);
+            cv::rectangle(*job->mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
+            DrawResult(context, *job->mat, det_result, true);
+            SetResult(context, det_result, *job->result);
+            ArchiveResult(context, job->frame_index, job->timestamp_ms, det_result);
+            job->result->is_skipped = 0;
+            job->result->time_gate = 0;
+        }
+        job->engine_job = DetectionEngine::Job();   /* release buffers before the caller gets the result */
+        CompleteAsyncJob(context, job);
+    }
+}
+
+static void StartAsync(ImageProcessor::Context* context)
+{
+    if (!context->async_thread_list.empty()) return;
+    context->queue_pre_process.Open();
+    context->queue_inference.Open();
+    context->queue_post_process.Open();
+    context->async_thread_list.push_back(std::thread(ThreadPreProcess, context));
+    context->async_thread_list.push_back(std::thread(ThreadInference, context));
+    context->async_thread_list.push_back(std::thread(ThreadPostProcess, context));
+}
+
+static void StopAsync(ImageProcessor::Context* context)
+{
+    if (context->async_thread_list.empty()) return;
+    ImageProcessor::Flush(context);
+    context->queue_pre_process.Close();
+    context->queue_inference.Close();
+    context->queue_post_process.Close();
+    for (auto& thread : context->async_thread_list) thread.join();
+    context->async_thread_list.clear();
+}
+
+static int32_t SubmitAsync(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms, AsyncJobPtr job)
+{
+    StartAsync(context);
+
+    /* Wait while too many frames are in the pipeline */
+    {
+        std::unique_lock<std::mutex> lock(context->mutex_in_flight);
+        context->cv_in_flight.wait(lock, [context] { return context->in_flight_num < context->async_max_in_flight; });
+        context->in_flight_num++;
+    }
+
+    /* Frame index and time stamp are decided here, because the post process thread must not read the context values of newer frames */
+    context->frame_index++;
+    job->mat = &mat;
+    job->result = &result;
+    job->frame_index = context->frame_index;
+    job->dt = CalculateDt(context, timestamp_ms);
+    job->timestamp_ms = timestamp_ms;
+    context->queue_pre_process.Push(job);
     return 0;
 }
 
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
+{
+    std::unique_ptr<Context> context(new Context());
+    context->detection_interval = (std::max)(1, input_param.detection_interval);
+    context->is_adaptive_detection_interval = input_param.is_adaptive_detection_interval != 0;
+    context->is_roi_redetection = input_param.is_roi_redetection != 0;
+    if (input_param.async_max_in_flight > 0) context->async_max_in_flight = input_param.async_max_in_flight;
+
+    MotionGate::Config motion_gate_config;
+    motion_gate_config.max_interval = input_param.motion_gate_max_interval;
+    motion_gate_config.threshold_diff = input_param.motion_gate_threshold;
+    context->motion_gate.SetConfig(motion_gate_config);
+
+    context->engine.reset(new DetectionEngine());
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
+    }
+
+    if (input_param.archive_path[0] != '\0') {
+        context->archive_writer.reset(new ColumnarArchive::Writer());
+        if (context->archive_writer->Open(input_param.archive_path) != ColumnarArchive::Writer::kRetOk) {
+            context->engine->Finalize();
+            return nullptr;
+        }
+    }
+    return context.release();
+}
+
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    StopAsync(context);
+
+    int32_t ret = 0;
+    if (context->engine->Finalize() != DetectionEngine::kRetOk) {
+        ret = -1;
+    }
+    delete context;
+    return ret;
+}
+
+
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    switch (cmd) {
+    case 0:
+    default:
+        PRINT_E("command(%d) is not supported\n", cmd);
+        return -1;
+    }
+}
+
+int32_t ImageProcessor::GetInputSize(ImageProcessor::Context* context, int32_t& width, int32_t& height)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+    context->engine->GetInputSize(width, height);
+    return 0;
+}
+
+
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+{
+    if (s_context) {
+        PRINT_E("Already initialized\n");
+        return -1;
+    }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
+}
+
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
+}
+
+int32_t ImageProcessor::Command(int32_t cmd)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    return Command(s_context, cmd);
+}
+
+int32_t ImageProcessor::GetInputSize(int32_t& width, int32_t& height)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    return GetInputSize(s_context, width, height);
+}
+
+int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    return Process(s_context, mat, result, timestamp_ms);
+}
+
+
+/* timestamp_ms is replaced with the current time if it's negative */
+static int32_t ProcessFrame(ImageProcessor::Context* context, cv::Mat& mat, double& timestamp_ms, DetectionEngine::Result& det_result, bool& is_skipped, double& time_gate)
+{
+    /* Frames submitted by ProcessAsync must be done before using the tracker here */
+    ImageProcessor::Flush(context);
+
+    context->frame_index++;
+    const float dt = CalculateDt(context, timestamp_ms);
+
+    /* Run detection every N frames. Otherwise, run detection around the tracked objects only, or the tracker just predicts the position */
+    std::vector<cv::Rect> roi_list;
+    bool is_detection_frame = IsDetectionFrame(context);
+    if (!is_detection_frame && context->is_roi_redetection) {
+        CreateRoiList(context, dt, mat.cols, mat.rows, roi_list);
+        int32_t roi_area = 0;
+        for (const auto& roi : roi_list) roi_area += roi.area();
+        if (roi_area > kRoiMaxAreaRatio * mat.cols * mat.rows) {
+            is_detection_frame = true;
+            roi_list.clear();
+        }
+    }
+    bool is_inference_needed = true;
+    if (is_detection_frame) {
+        /* Reuse the previous result while the scene is static */
+        is_inference_needed = context->motion_gate.Check(mat);
+        if (is_inference_needed) {
+            if (context->engine->Process(mat, det_result) != DetectionEngine::kRetOk) {
+                return -1;
+            }
+            context->det_result_previous = det_result;
+        } else {
+            det_result = context->det_result_previous;
+            det_result.time_pre_process = 0;
+            det_result.time_inference = 0;
+            det_result.time_post_process = 0;
+        }
+        context->tracker.Update(det_result.bbox_list, dt);
+        context->frame_cnt_from_detection = 0;
+
+        /* Display target area  */
+        cv::rectangle(mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
+    } else if (!roi_list.empty()) {
+        if (context->engine->Process(mat, roi_list, det_result) != DetectionEngine::kRetOk) {
+            return -1;
+        }
+        context->tracker.Update(det_result.bbox_list, dt);
+        context->frame_cnt_from_detection++;
+
+        /* Display target area  */
+        for (const auto& roi : roi_list) {
+            cv::rectangle(mat, roi, CommonHelper::CreateCvColor(0, 0, 0), 2);
+        }
+    } else {
+        context->tracker.Predict(dt);
+        context->frame_cnt_from_detection++;
+    }
+
+    DrawResult(context, mat, det_result, is_detection_frame || !roi_list.empty());
+    ArchiveResult(context, context->frame_index, timestamp_ms, det_result);
+
+    is_skipped = !is_inference_needed;
+    time_gate = is_detection_frame ? context->motion_gate.GetTimeCheck() : 0;
+
+    return 0;
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    DetectionEngine::Result det_result;
+    bool is_skipped = false;
+    double time_gate = 0;
+    if (ProcessFrame(context, mat, timestamp_ms, det_result, is_skipped, time_gate) != 0) {
+        return -1;
+    }
+
+    SetResult(context, det_result, result);
+    result.is_skipped = is_skipped ? 1 : 0;
+    result.time_gate = time_gate;
+    return 0;
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, CompactResult& result, double timestamp_ms)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    DetectionEngine::Result det_result;
+    bool is_skipped = false;
+    double time_gate = 0;
+    if (ProcessFrame(context, mat, timestamp_ms, det_result, is_skipped, time_gate) != 0) {
+        return -1;
+    }
+
+    SetCompactResult(context, context->frame_index, timestamp_ms, det_result, result);
+    result.header.flags = is_skipped ? CompactResult::kFlagSkipped : 0;
+    result.header.time_gate = static_cast<float>(time_gate);
+    return 0;
+}
+
+
+std::future<int32_t> ImageProcessor::ProcessAsync(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    AsyncJobPtr job(new AsyncJob());
+    std::future<int32_t> future = job->promise.get_future();
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        job->promise.set_value(-1);
+        return future;
+    }
+    SubmitAsync(context, mat, result, timestamp_ms, job);
+    return future;
+}
+
+int32_t ImageProcessor::ProcessAsync(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result, const std::function<void(int32_t ret)>& callback, double timestamp_ms)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+    AsyncJobPtr job(new AsyncJob());
+    job->callback = callback;
+    return SubmitAsync(context, mat, result, timestamp_ms, job);
+}
+
+int32_t ImageProcessor::Flush(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(context->mutex_in_flight);
+    context->cv_in_flight.wait(lock, [context] { return context->in_flight_num == 0; });
+    return 0;
+}
+
+std::future<int32_t> ImageProcessor::ProcessAsync(cv::Mat& mat, ImageProcessor::Result& result, double timestamp_ms)
+{
+    return ProcessAsync(s_context, mat, result, timestamp_ms);
+}
+
+int32_t ImageProcessor::Flush(void)
+{
+    return Flush(s_context);
+}
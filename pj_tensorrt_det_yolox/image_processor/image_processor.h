@@ -21,6 +21,11 @@ limitations under the License.
 #include <string>
 #include <vector>
 #include <array>
+#include <functional>
+#include <future>
+
+/* for My modules */
+#include "compact_result.h"
 
 namespace cv {
     class Mat;
@@ -34,6 +39,13 @@ namespace ImageProcessor
 typedef struct {
     char     work_dir[256];
     int32_t  num_threads;
+    int32_t  detection_interval;                /* run detection every N frames, and use the position predicted by the tracker in between. 0, 1 = every frame */
+    int32_t  is_adaptive_detection_interval;    /* 1: run detection earlier than N frames when tracks become uncertain */
+    int32_t  is_roi_redetection;                /* 1: between full frame detections, run detection only on the regions around the tracked objects */
+    int32_t  motion_gate_max_interval;          /* reuse the previous result while the scene is static, up to this number of frames. 0 = disable */
+    float    motion_gate_threshold;             /* [0 - 255] luminance difference of a block to be regarded as changed */
+    int32_t  async_max_in_flight;               /* the max number of frames in the pipeline for ProcessAsync. 0 = default (3) */
+    char     archive_path[256];                 /* append the tracking result of each frame to this file (ColumnarArchive). "" = disable */
 } InputParam;
 
 typedef struct {
@@ -50,12 +62,36 @@ typedef struct {
     double time_pre_process;   // [msec]
     double time_inference;    // [msec]
     double time_post_process;  // [msec]
+    int32_t is_skipped;        // 1: inference was skipped and the previous result was reused
+    double time_gate;          // [msec] time to check the scene change
 } Result;
 
+/* Handle of a pipeline. Create one for each pipeline to run multiple pipelines in parallel threads */
+struct Context;
+
+Context* Create(const InputParam& input_param);     /* return nullptr on error */
+int32_t Destroy(Context* context);
+int32_t Process(Context* context, cv::Mat& mat, Result& result, double timestamp_ms = -1);    /* timestamp_ms < 0: use the current time */
+int32_t Process(Context* context, cv::Mat& mat, CompactResult& result, double timestamp_ms = -1);     /* variable length result without labels */
+int32_t Command(Context* context, int32_t cmd);
+int32_t GetInputSize(Context* context, int32_t& width, int32_t& height);    /* input size of the model, to prepare frames close to it */
+
+/* Asynchronous version of Process. Pre process, inference and post process of different frames run in parallel.
+ * Frames are completed in the submitted order. The call waits while async_max_in_flight frames are in the pipeline.
+ * mat and result must be kept until the frame is completed. The callback is called in a worker thread.
+ * Detection interval, ROI re-detection and motion gate are not used (every frame runs full frame detection) */
+std::future<int32_t> ProcessAsync(Context* context, cv::Mat& mat, Result& result, double timestamp_ms = -1);
+int32_t ProcessAsync(Context* context, cv::Mat& mat, Result& result, const std::function<void(int32_t ret)>& callback, double timestamp_ms = -1);
+int32_t Flush(Context* context);    /* wait until all the submitted frames are completed */
+
+/* Use the default instance */
 int32_t Initialize(const InputParam& input_param);
-int32_t Process(cv::Mat& mat, Result& result);
+int32_t Process(cv::Mat& mat, Result& result, double timestamp_ms = -1);
+std::future<int32_t> ProcessAsync(cv::Mat& mat, Result& result, double timestamp_ms = -1);
+int32_t Flush(void);
 int32_t Finalize(void);
 int32_t Command(int32_t cmd);
+int32_t GetInputSize(int32_t& width, int32_t& height);
 
 }
 
@@ -0,0 +1,281 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "bounding_box.h"
+#include "tracker.h"
+#include "detection_engine.h"
+#include "stream_scheduler.h"
+
+/*** Macro ***/
+#define TAG "StreamScheduler"
+#define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
+#define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
+
+/*** Function ***/
+StreamScheduler::StreamScheduler()
+    : stream_index_to_start_(0), num_pending_(0), num_processing_(0), is_exit_(false)
+{
+}
+
+StreamScheduler::~StreamScheduler()
+{
+    if (thread_.joinable()) {
+        Finalize();
+    }
+}
+
+int32_t StreamScheduler::Initialize(const std::string& work_dir, const int32_t num_threads, const Config& config)
+{
+    if (engine_) {
+        PRINT_E("Already initialized\n");
+        return kRetErr;
+    }
+    if (config.max_batch_size < 1 || config.max_queue_per_stream < 1) {
+        PRINT_E("Invalid config\n");
+        return kRetErr;
+    }
+    config_ = config;
+
+    engine_.reset(new DetectionEngine());
+    if (engine_->Initialize(work_dir, num_threads) != DetectionEngine::kRetOk) {
+        engine_->Finalize();
+        engine_.reset();
+        return kRetErr;
+    }
+    if (engine_->GetBatchSize() > 1 && config_.max_batch_size % engine_->GetBatchSize() != 0) {
+        PRINT("max_batch_size(%d) is not a multiple of the model batch size(%d)\n", config_.max_batch_size, engine_->GetBatchSize());
+    }
+
+    is_exit_ = false;
+    thread_ = std::thread(&StreamScheduler::ThreadLoop, this);
+    return kRetOk;
+}
+
+int32_t StreamScheduler::Finalize(void)
+{
+    if (!engine_) {
+        PRINT_E("Not initialized\n");
+        return kRetErr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_exit_ = true;
+    }
+    cond_pending_.notify_all();
+    cond_done_.notify_all();
+    if (thread_.joinable()) thread_.join();
+
+    engine_->Finalize();
+    engine_.reset();
+    stream_list_.clear();
+    return kRetOk;
+}
+
+int32_t StreamScheduler::AddStream(Callback callback)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unique_ptr<Stream> stream(new Stream());
+    stream->callback = callback;
+    stream_list_.push_back(std::move(stream));
+    return static_cast<int32_t>(stream_list_.size()) - 1;
+}
+
+int32_t StreamScheduler::Submit(int32_t stream_id, const cv::Mat& mat)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!engine_ || is_exit_) {
+        PRINT_E("Not initialized\n");
+        return kRetErr;
+    }
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_list_.size())) {
+        PRINT_E("Invalid stream id: %d\n", stream_id);
+        return kRetErr;
+    }
+
+    Stream& stream = *stream_list_[stream_id];
+    if (static_cast<int32_t>(stream.queue.size()) >= config_.max_queue_per_stream) {
+        if (config_.drop_oldest) {
+            stream.queue.pop_front();
+            stream.dropped_cnt++;
+            num_pending_--;
+        } else {
+            cond_done_.wait(lock, [&] { return is_exit_ || static_cast<int32_t>(stream.queue.size()) < config_.max_queue_per_stream; });
+            if (is_exit_) return kRetErr;
+        }
+    }
+
+    Request request;
+    request.frame_index = stream.frame_cnt++;
+    request.mat = mat;
+    request.time_submit = std::chrono::steady_clock::now();
+    stream.queue.push_back(request);
+    num_pending_++;
+    lock.unlock();
+    cond_pending_.notify_one();
+    return kRetOk;
+}
+
+int32_t StreamScheduler::Flush(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_done_.wait(lock, [&] { return is_exit_ || (num_pending_ == 0 && num_processing_ == 0); });
+    return kRetOk;
+}
+
+int64_t StreamScheduler::GetDroppedNum(int32_t stream_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_list_.size())) return 0;
+    return stream_list_[stream_id]->dropped_cnt;
+}
+
+int32_t StreamScheduler::ResetStream(int32_t stream_id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stream_id < 0 || stream_id >= static_cast<int32_t>(stream_list_.size())) {
+        PRINT_E("Invalid stream id: %d\n", stream_id);
+        return kRetErr;
+    }
+    Stream& stream = *stream_list_[stream_id];
+    num_pending_ -= static_cast<int32_t>(stream.queue.size());
+    stream.queue.clear();
+    stream.tracker.Reset();
+    stream.frame_cnt = 0;
+    stream.dropped_cnt = 0;
+    cond_done_.notify_all();
+    return kRetOk;
+}
+
+int32_t StreamScheduler::GetPendingNum(void)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_pending_;
+}
+
+bool StreamScheduler::IsBatchReady(void)
+{
+    if (num_pending_ == 0) return false;
+    if (num_pending_ >= config_.max_batch_size) return true;
+    const auto time_oldest = GetOldestSubmitTime();
+    if (time_oldest == std::chrono::steady_clock::time_point::max()) return false;
+    return std::chrono::steady_clock::now() >= time_oldest + std::chrono::milliseconds(config_.max_wait_ms);
+}
+
+std::chrono::steady_clock::time_point StreamScheduler::GetOldestSubmitTime(void)
+{
+    auto time_oldest = std::chrono::steady_clock::time_point::max();
+    for (const auto& stream : stream_list_) {
+        if (!stream->queue.empty()) {
+            time_oldest = (std::min)(time_oldest, stream->queue.front().time_submit);
+        }
+    }
+    return time_oldest;
+}
+
+void StreamScheduler::ThreadLoop(void)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        /*** Wait until enough frames are pending, or the oldest frame has waited long enough ***/
+        cond_pending_.wait(lock, [&] { return is_exit_ || num_pending_ > 0; });
+        if (is_exit_) break;
+        while (!is_exit_ && num_pending_ > 0 && !IsBatchReady()) {
+            const auto time_oldest = GetOldestSubmitTime();
+            if (time_oldest == std::chrono::steady_clock::time_point::max()) {
+                cond_pending_.wait(lock);       /* no frame in queue. don't overflow the deadline */
+            } else {
+                cond_pending_.wait_until(lock, time_oldest + std::chrono::milliseconds(config_.max_wait_ms));
+            }
+        }
+        if (is_exit_) break;
+        if (num_pending_ == 0) continue;    /* frames were removed by ResetStream while waiting */
+
+        /*** Take frames from each stream in round robin so that one busy stream doesn't starve others ***/
+        std::vector<int32_t> batch_stream_id_list;
+        std::vector<Stream*> batch_stream_list;
+        std::vector<Request> batch_request_list;
+        const int32_t stream_num = static_cast<int32_t>(stream_list_.size());
+        while (static_cast<int32_t>(batch_request_list.size()) < config_.max_batch_size && num_pending_ > 0) {
+            for (int32_t i = 0; i < stream_num && static_cast<int32_t>(batch_request_list.size()) < config_.max_batch_size; i++) {
+                const int32_t stream_id = (stream_index_to_start_ + i) % stream_num;
+                Stream* stream = stream_list_[stream_id].get();
+                if (stream->queue.empty()) continue;
+                batch_stream_id_list.push_back(stream_id);
+                batch_stream_list.push_back(stream);
+                batch_request_list.push_back(stream->queue.front());
+                stream->queue.pop_front();
+                num_pending_--;
+            }
+        }
+        stream_index_to_start_ = (stream_index_to_start_ + 1) % stream_num;
+        num_processing_ = static_cast<int32_t>(batch_request_list.size());
+        lock.unlock();
+        cond_done_.notify_all();
+
+        /*** Run the batch ***/
+        const auto& time_batch_start = std::chrono::steady_clock::now();
+        std::vector<cv::Mat> mat_list;
+        for (const auto& request : batch_request_list) mat_list.push_back(request.mat);
+        std::vector<DetectionEngine::Result> det_result_list;
+        if (engine_->Process(mat_list, det_result_list) != DetectionEngine::kRetOk) {
+            PRINT_E("Failed to process the batch\n");
+            det_result_list.assign(mat_list.size(), DetectionEngine::Result());
+        }
+
+        /*** Route the results to each stream. Frames of the same stream are in the submitted order in the batch ***/
+        for (size_t i = 0; i < batch_request_list.size(); i++) {
+            Stream& stream = *batch_stream_list[i];
+            const Request& request = batch_request_list[i];
+            const DetectionEngine::Result& det_result = det_result_list[i];
+            stream.tracker.Update(det_result.bbox_list);
+
+            StreamResult result;
+            result.stream_id = batch_stream_id_list[i];
+            result.frame_index = request.frame_index;
+            result.mat = request.mat;
+            result.bbox_list = det_result.bbox_list;
+            result.batch_size = static_cast<int32_t>(batch_request_list.size());
+            result.time_wait = static_cast<std::chrono::duration<double>>(time_batch_start - request.time_submit).count() * 1000.0;
+            result.time_latency = static_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - request.time_submit).count() * 1000.0;
+            result.time_pre_process = det_result.time_pre_process;
+            result.time_inference = det_result.time_inference;
+            result.time_post_process = det_result.time_post_process;
+            if (stream.callback) stream.callback(result, stream.tracker.GetTrackList());
+        }
+
+        lock.lock();
+        num_processing_ = 0;
+        cond_done_.notify_all();
+    }
+}
@@ -0,0 +1,127 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef STREAM_SCHEDULER_
+#define STREAM_SCHEDULER_
+
+/* for general */
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "bounding_box.h"
+#include "tracker.h"
+#include "detection_engine.h"
+
+/*
+ * Collect frames from multiple streams, run them on one shared DetectionEngine as a batch,
+ * then return the results to each stream. Each stream has its own Tracker.
+ * A batch is started when max_batch_size frames are pending or the oldest pending frame has waited for max_wait_ms.
+ * Bigger max_batch_size / max_wait_ms gives better throughput, smaller ones give lower latency.
+ * Submit doesn't copy pixels. The scheduler keeps a reference to the pixels of the submitted mat until the callback returns,
+ * so the caller must not write to the buffer until then (use a new mat for each frame, or clone it if the buffer is reused).
+ */
+class StreamScheduler {
+public:
+    enum {
+        kRetOk = 0,
+        kRetErr = -1,
+    };
+
+    typedef struct Config_ {
+        int32_t max_batch_size;         // the max number of frames processed at once
+        int32_t max_wait_ms;            // [msec] the max time the oldest pending frame waits for other frames
+        int32_t max_queue_per_stream;   // the max number of pending frames for each stream
+        bool    drop_oldest;            // when the queue is full, true: drop the oldest frame (for camera), false: Submit waits (for file)
+        Config_() : max_batch_size(4), max_wait_ms(10), max_queue_per_stream(4), drop_oldest(false)
+        {}
+    } Config;
+
+    typedef struct StreamResult_ {
+        int32_t                  stream_id;
+        int64_t                  frame_index;
+        cv::Mat                  mat;                   // the submitted mat (shares the pixels)
+        std::vector<BoundingBox> bbox_list;
+        int32_t                  batch_size;            // the number of frames processed together
+        double                   time_wait;             // [msec] Submit -> batch start
+        double                   time_latency;          // [msec] Submit -> callback
+        double                   time_pre_process;      // [msec] (shared by the frames in the batch)
+        double                   time_inference;        // [msec] (shared by the frames in the batch)
+        double                   time_post_process;     // [msec] (shared by the frames in the batch)
+        StreamResult_() : stream_id(-1), frame_index(0), batch_size(0), time_wait(0), time_latency(0), time_pre_process(0), time_inference(0), time_post_process(0)
+        {}
+    } StreamResult;
+
+    /* Called in the scheduler thread, in the submitted order for each stream. track_list is the stream's tracker state */
+    typedef std::function<void(const StreamResult& result, std::vector<Track>& track_list)> Callback;
+
+public:
+    StreamScheduler();
+    ~StreamScheduler();
+    int32_t Initialize(const std::string& work_dir, const int32_t num_threads, const Config& config);
+    int32_t Finalize(void);
+    int32_t AddStream(Callback callback);     // return stream_id (>= 0)
+    int32_t Submit(int32_t stream_id, const cv::Mat& mat);     // mat is referenced without copy until the callback. Don't reuse its buffer
+    int32_t Flush(void);                      // wait until all the submitted frames are processed
+    int64_t GetDroppedNum(int32_t stream_id);
+    int32_t ResetStream(int32_t stream_id);   // drop the pending frames and clear the tracker, to reuse the stream for a new source. Call it when no frame of the stream is in a batch
+    int32_t GetPendingNum(void);              // the number of frames waiting for a batch
+
+private:
+    typedef struct Request_ {
+        int64_t frame_index;
+        cv::Mat mat;
+        std::chrono::steady_clock::time_point time_submit;
+    } Request;
+
+    typedef struct Stream_ {
+        std::deque<Request> queue;
+        Tracker  tracker;
+        Callback callback;
+        int64_t  frame_cnt;
+        int64_t  dropped_cnt;
+        Stream_() : frame_cnt(0), dropped_cnt(0) {}
+    } Stream;
+
+    void ThreadLoop(void);
+    bool IsBatchReady(void);
+    std::chrono::steady_clock::time_point GetOldestSubmitTime(void);
+
+private:
+    Config config_;
+    std::unique_ptr<DetectionEngine> engine_;
+    std::vector<std::unique_ptr<Stream>> stream_list_;
+    int32_t stream_index_to_start_;     // for round robin
+    int32_t num_pending_;
+    int32_t num_processing_;
+    bool is_exit_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_pending_;      // notified when a frame is submitted
+    std::condition_variable cond_done_;         // notified when frames are taken / processed
+};
+
+#endif
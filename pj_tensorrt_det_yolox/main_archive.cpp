@@ -0,0 +1,104 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+/* for My modules */
+#include "columnar_archive.h"
+
+/*** Type ***/
+typedef struct TrackSummary_ {
+    int32_t class_id;
+    int64_t row_num;
+    int64_t predicted_num;
+    double  timestamp_first;
+    double  timestamp_last;
+    double  total_score;
+    TrackSummary_() : class_id(-1), row_num(0), predicted_num(0), timestamp_first(0), timestamp_last(0), total_score(0) {}
+} TrackSummary;
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage: ./main_archive archive_file [-c class_id] [-t start_sec end_sec]\n");
+    printf("  Print the tracks of the class in the time range (e.g. -c 2 -t 600 1200 for class 2 in minute 10-20)\n");
+}
+
+int32_t main(int argc, char* argv[])
+{
+    /*** Parse arguments ***/
+    std::string filename;
+    int32_t class_id = -1;
+    double timestamp_min = -std::numeric_limits<double>::max();
+    double timestamp_max = std::numeric_limits<double>::max();
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            class_id = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 2 < argc) {
+            timestamp_min = std::atof(argv[++i]) * 1000.0;
+            timestamp_max = std::atof(argv[++i]) * 1000.0;
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return -1;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename.empty()) {
+        PrintUsage();
+        return -1;
+    }
+
+    /*** Query ***/
+    ColumnarArchive::Reader reader;
+    if (reader.Open(filename) != ColumnarArchive::Reader::kRetOk) {
+        return -1;
+    }
+    const auto& time0 = std::chrono::steady_clock::now();
+    std::map<int32_t, TrackSummary> track_summary_map;
+    const int64_t matched_num = reader.Select(timestamp_min, timestamp_max, class_id, [&track_summary_map](const ColumnarArchive::Reader::Row& row) {
+        TrackSummary& summary = track_summary_map[row.object.track_id];
+        if (summary.row_num == 0) {
+            summary.class_id = row.object.class_id;
+            summary.timestamp_first = row.timestamp_ms;
+        }
+        summary.row_num++;
+        if (row.object.flags & CompactResult::kFlagPredicted) summary.predicted_num++;
+        summary.timestamp_first = (std::min)(summary.timestamp_first, row.timestamp_ms);
+        summary.timestamp_last = (std::max)(summary.timestamp_last, row.timestamp_ms);
+        summary.total_score += row.object.score;
+    });
+    const auto& time1 = std::chrono::steady_clock::now();
+
+    /*** Print result ***/
+    printf("track_id,class_id,rows,predicted_rows,first_sec,last_sec,score_avg\n");
+    for (const auto& item : track_summary_map) {
+        const TrackSummary& summary = item.second;
+        printf("%d,%d,%lld,%lld,%.3f,%.3f,%.3f\n", item.first, summary.class_id, static_cast<long long>(summary.row_num), static_cast<long long>(summary.predicted_num),
+            summary.timestamp_first / 1000.0, summary.timestamp_last / 1000.0, summary.total_score / summary.row_num);
+    }
+    fprintf(stderr, "blocks: %d, rows: %lld, matched rows: %lld, tracks: %zu, query: %.3lf [msec]\n", reader.GetBlockNum(), static_cast<long long>(reader.GetRowNum()),
+        static_cast<long long>(matched_num), track_summary_map.size(), (time1 - time0).count() / 1000000.0);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper_cv.h"
+#include "raw_frame_file.h"
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage: ./main_convert_raw input output.raw [max_frame_num]\n");
+    printf("  input = video file, camera, image file, or directory (all *.jpg, *.png, *.bmp in it)\n");
+    printf("  Decode the input and save the frames as they are, so that main can be benchmarked without decode time\n");
+}
+
+static bool IsImage(const std::string& name)
+{
+    return name.find(".jpg") != std::string::npos || name.find(".png") != std::string::npos || name.find(".bmp") != std::string::npos;
+}
+
+static bool IsDirectory(const std::string& name)
+{
+    /* Others (video file, camera id, "jetson") are handled by FindSourceImage */
+    const bool is_video = name.find(".mp4") != std::string::npos || name.find(".avi") != std::string::npos || name.find(".webm") != std::string::npos;
+    const bool is_camera = name == "jetson" || name.find_first_not_of("0123456789") == std::string::npos;
+    return !is_video && !is_camera;
+}
+
+int32_t main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        PrintUsage();
+        return -1;
+    }
+    const std::string input_name = argv[1];
+    const std::string output_name = argv[2];
+    const int64_t max_frame_num = (argc > 3) ? std::atoll(argv[3]) : -1;
+
+    /* Image list for directory input */
+    std::vector<std::string> image_list;
+    cv::VideoCapture cap;
+    if (IsImage(input_name)) {
+        image_list.push_back(input_name);
+    } else if (IsDirectory(input_name)) {
+        std::vector<cv::String> file_list;
+        cv::glob(input_name + "/*", file_list, false);
+        for (const auto& file : file_list) {
+            if (IsImage(file)) image_list.push_back(file);
+        }
+        std::sort(image_list.begin(), image_list.end());
+        if (image_list.empty()) {
+            printf("Invalid input source: %s\n", input_name.c_str());
+            return -1;
+        }
+    } else if (!CommonHelper::FindSourceImage(input_name, cap)) {
+        return -1;
+    }
+
+    RawFrameFile::Writer writer;
+    if (writer.Open(output_name) != RawFrameFile::Writer::kRetOk) {
+        return -1;
+    }
+    for (int64_t frame_index = 0; max_frame_num < 0 || frame_index < max_frame_num; frame_index++) {
+        cv::Mat image;
+        double timestamp_ms = -1;
+        if (cap.isOpened()) {
+            if (!cap.read(image)) break;
+            timestamp_ms = cap.get(cv::CAP_PROP_POS_MSEC);
+        } else {
+            if (frame_index >= static_cast<int64_t>(image_list.size())) break;
+            image = cv::imread(image_list[frame_index]);
+            if (image.empty()) {
+                printf("Invalid input source: %s\n", image_list[frame_index].c_str());
+                continue;
+            }
+        }
+        if (writer.Write(image, frame_index, timestamp_ms) != RawFrameFile::Writer::kRetOk) break;
+    }
+    const int64_t frame_num = writer.GetFrameNum();
+    writer.Close();
+    printf("Saved %lld frames to %s\n", static_cast<long long>(frame_num), output_name.c_str());
+    return 0;
+}
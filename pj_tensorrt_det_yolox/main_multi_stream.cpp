@@ -0,0 +1,154 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper_cv.h"
+#include "stream_scheduler.h"
+
+/*** Macro ***/
+#define WORK_DIR                      RESOURCE_DIR
+#define DEFAULT_INPUT_IMAGE           RESOURCE_DIR"/kite.jpg"
+#define LOOP_NUM_FOR_TIME_MEASUREMENT 10
+
+/*** Type ***/
+typedef struct StreamStatistics_ {
+    std::string input_name;
+    int64_t frame_cnt;
+    int32_t max_track_num;
+    double total_time_latency;
+    double total_time_wait;
+    double total_batch_size;
+    StreamStatistics_() : frame_cnt(0), max_track_num(0), total_time_latency(0), total_time_wait(0), total_batch_size(0) {}
+} StreamStatistics;
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage: ./main_multi_stream [-b max_batch_size] [-w max_wait_ms] [-q max_queue_per_stream] [-d] input0 [input1 ...]\n");
+    printf("  -d: drop the oldest frame when the queue is full (for camera)\n");
+}
+
+static void ReadStream(StreamScheduler& scheduler, int32_t stream_id, const std::string& input_name)
+{
+    cv::VideoCapture cap;   /* if cap is not opened, src is still image */
+    if (!CommonHelper::FindSourceImage(input_name, cap)) {
+        return;
+    }
+    for (int32_t frame_cnt = 0; cap.isOpened() || frame_cnt < LOOP_NUM_FOR_TIME_MEASUREMENT; frame_cnt++) {
+        cv::Mat image;      /* new buffer for each frame, because the scheduler refers to it until the callback */
+        if (cap.isOpened()) {
+            cap.read(image);
+        } else {
+            image = cv::imread(input_name);
+        }
+        if (image.empty()) break;
+        if (scheduler.Submit(stream_id, image) != StreamScheduler::kRetOk) break;
+    }
+}
+
+int32_t main(int argc, char* argv[])
+{
+    /*** Parse arguments ***/
+    StreamScheduler::Config config;
+    std::vector<std::string> input_name_list;
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            config.max_batch_size = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            config.max_wait_ms = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            config.max_queue_per_stream = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            config.drop_oldest = true;
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return -1;
+        } else {
+            input_name_list.push_back(argv[i]);
+        }
+    }
+    if (input_name_list.empty()) input_name_list.push_back(DEFAULT_INPUT_IMAGE);
+    printf("streams = %zu, max_batch_size = %d, max_wait_ms = %d, max_queue_per_stream = %d, drop_oldest = %d\n",
+        input_name_list.size(), config.max_batch_size, config.max_wait_ms, config.max_queue_per_stream, config.drop_oldest);
+
+    /*** Initialize ***/
+    StreamScheduler scheduler;
+    if (scheduler.Initialize(WORK_DIR, 4, config) != StreamScheduler::kRetOk) {
+        printf("Initialization Error\n");
+        return -1;
+    }
+
+    /* Callbacks are called in the scheduler thread only, so statistics don't need a lock until the end */
+    std::vector<StreamStatistics> statistics_list(input_name_list.size());
+    for (size_t i = 0; i < input_name_list.size(); i++) {
+        StreamStatistics& statistics = statistics_list[i];
+        statistics.input_name = input_name_list[i];
+        scheduler.AddStream([&statistics](const StreamScheduler::StreamResult& result, std::vector<Track>& track_list) {
+            statistics.frame_cnt++;
+            statistics.max_track_num = (std::max)(statistics.max_track_num, static_cast<int32_t>(track_list.size()));
+            statistics.total_time_latency += result.time_latency;
+            statistics.total_time_wait += result.time_wait;
+            statistics.total_batch_size += result.batch_size;
+            printf("[stream %d][frame %5lld] DET: %2zu, TRACK: %2zu, batch: %d, wait: %7.3lf [msec], latency: %7.3lf [msec]\n",
+                result.stream_id, static_cast<long long>(result.frame_index), result.bbox_list.size(), track_list.size(), result.batch_size, result.time_wait, result.time_latency);
+        });
+    }
+
+    /*** Read each stream in its own thread ***/
+    const auto& time_start = std::chrono::steady_clock::now();
+    std::vector<std::thread> thread_list;
+    for (size_t i = 0; i < input_name_list.size(); i++) {
+        thread_list.push_back(std::thread(ReadStream, std::ref(scheduler), static_cast<int32_t>(i), input_name_list[i]));
+    }
+    for (auto& thread : thread_list) thread.join();
+    scheduler.Flush();
+    const auto& time_end = std::chrono::steady_clock::now();
+
+    /*** Print statistics ***/
+    double time_total = static_cast<std::chrono::duration<double>>(time_end - time_start).count();
+    int64_t frame_num_total = 0;
+    printf("=== Statistics ===\n");
+    for (size_t i = 0; i < statistics_list.size(); i++) {
+        const auto& statistics = statistics_list[i];
+        frame_num_total += statistics.frame_cnt;
+        if (statistics.frame_cnt == 0) continue;
+        printf("[stream %zu] %s\n", i, statistics.input_name.c_str());
+        printf("  Frames:            %9lld (dropped: %lld)\n", static_cast<long long>(statistics.frame_cnt), static_cast<long long>(scheduler.GetDroppedNum(static_cast<int32_t>(i))));
+        printf("  Max tracks:        %9d\n", statistics.max_track_num);
+        printf("  Average batch:     %9.3lf\n", statistics.total_batch_size / statistics.frame_cnt);
+        printf("  Average wait:      %9.3lf [msec]\n", statistics.total_time_wait / statistics.frame_cnt);
+        printf("  Average latency:   %9.3lf [msec]\n", statistics.total_time_latency / statistics.frame_cnt);
+    }
+    printf("Total:               %9lld frames in %.3lf [sec] (%.1lf FPS)\n", static_cast<long long>(frame_num_total), time_total, frame_num_total / time_total);
+
+    /*** Finalize ***/
+    scheduler.Finalize();
+
+    return 0;
+}
@@ -0,0 +1,362 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper.h"
+#include "bounding_box.h"
+#include "tracker.h"
+#include "work_stealing_queue.h"
+#include "track_stitcher.h"
+#include "detection_engine.h"
+
+/*** Macro ***/
+#define WORK_DIR                      RESOURCE_DIR
+#define DEFAULT_OUTPUT_DIR            "output"
+#define DEFAULT_WORKER_NUM            2
+#define DEFAULT_CHUNK_OVERLAP_FRAME   30
+
+/*** Type ***/
+typedef struct Item_ {
+    int32_t     index;
+    std::string input_name;
+    bool        is_video;
+    int32_t     chunk_index;    // -1 = not split
+    int64_t     frame_start;    // for chunk
+    int64_t     frame_end;      // for chunk (including the overlap with the next chunk)
+    Item_() : index(0), is_video(false), chunk_index(-1), frame_start(0), frame_end(0) {}
+    Item_(int32_t _index, const std::string& _input_name, bool _is_video) : index(_index), input_name(_input_name), is_video(_is_video), chunk_index(-1), frame_start(0), frame_end(0) {}
+} Item;
+
+typedef struct WorkerStatistics_ {
+    int32_t item_cnt;
+    int32_t stolen_cnt;
+    int64_t frame_cnt;
+    double  total_time_pre_process;
+    double  total_time_inference;
+    double  total_time_post_process;
+    WorkerStatistics_() : item_cnt(0), stolen_cnt(0), frame_cnt(0), total_time_pre_process(0), total_time_inference(0), total_time_post_process(0) {}
+} WorkerStatistics;
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage: ./main_offline [-j worker_num] [-o output_dir] [-c chunk_sec] [-l overlap_frame] input0 [input1 ...]\n");
+    printf("  input = directory (all *.jpg, *.png, *.bmp in it), video file, image file, or *.txt (list of inputs, one per line)\n");
+    printf("  -c: split each video into chunks of chunk_sec seconds, process them in parallel, then stitch tracks\n");
+}
+
+static bool IsVideo(const std::string& name)
+{
+    return name.find(".mp4") != std::string::npos || name.find(".avi") != std::string::npos || name.find(".webm") != std::string::npos;
+}
+
+static bool IsImage(const std::string& name)
+{
+    return name.find(".jpg") != std::string::npos || name.find(".png") != std::string::npos || name.find(".bmp") != std::string::npos;
+}
+
+static void MakeDirectory(const std::string& dir)
+{
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+}
+
+static std::string GetBaseName(const std::string& path)
+{
+    std::string name = path.substr(path.find_last_of("/\\") + 1);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+static void AddInput(const std::string& input_name, std::vector<Item>& item_list)
+{
+    if (input_name.size() > 4 && input_name.substr(input_name.size() - 4) == ".txt") {
+        std::ifstream ifs(input_name);
+        std::string line;
+        while (std::getline(ifs, line)) {
+            if (!line.empty()) AddInput(line, item_list);
+        }
+    } else if (IsVideo(input_name)) {
+        item_list.push_back(Item(static_cast<int32_t>(item_list.size()), input_name, true));
+    } else if (IsImage(input_name)) {
+        item_list.push_back(Item(static_cast<int32_t>(item_list.size()), input_name, false));
+    } else {
+        std::vector<cv::String> file_list;
+        cv::glob(input_name + "/*", file_list, false);
+        std::sort(file_list.begin(), file_list.end());
+        for (const auto& file : file_list) {
+            if (IsImage(file)) item_list.push_back(Item(static_cast<int32_t>(item_list.size()), file, false));
+        }
+    }
+}
+
+static void ProcessImage(DetectionEngine& engine, const Item& item, FILE* fp, WorkerStatistics& statistics)
+{
+    cv::Mat image = cv::imread(item.input_name);
+    if (image.empty()) {
+        printf("Invalid input source: %s\n", item.input_name.c_str());
+        return;
+    }
+    DetectionEngine::Result det_result;
+    if (engine.Process(image, det_result) != DetectionEngine::kRetOk) return;
+
+    fprintf(fp, "class_id,label,score,x,y,w,h\n");
+    for (const auto& bbox : det_result.bbox_list) {
+        fprintf(fp, "%d,%s,%.3f,%d,%d,%d,%d\n", bbox.class_id, bbox.label.c_str(), bbox.score, bbox.x, bbox.y, bbox.w, bbox.h);
+    }
+    statistics.frame_cnt++;
+    statistics.total_time_pre_process += det_result.time_pre_process;
+    statistics.total_time_inference += det_result.time_inference;
+    statistics.total_time_post_process += det_result.time_post_process;
+}
+
+static void SplitVideo(const Item& item, double chunk_sec, int32_t overlap_frame, std::vector<Item>& chunk_list)
+{
+    cv::VideoCapture cap(item.input_name);
+    const int64_t frame_num = static_cast<int64_t>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+    const double fps = cap.get(cv::CAP_PROP_FPS);
+    const int64_t chunk_frame = (std::max)(static_cast<int64_t>(chunk_sec * fps), static_cast<int64_t>(overlap_frame) + 1);
+    if (!cap.isOpened() || frame_num <= 0 || fps <= 0) {
+        chunk_list.push_back(item);     /* unable to split. process the whole video in one chunk */
+        chunk_list.back().chunk_index = 0;
+        chunk_list.back().frame_end = INT64_MAX;
+        return;
+    }
+    for (int64_t frame_start = 0; frame_start < frame_num; frame_start += chunk_frame) {
+        Item chunk = item;
+        chunk.chunk_index = static_cast<int32_t>(chunk_list.size());
+        chunk.frame_start = frame_start;
+        chunk.frame_end = (std::min)(frame_start + chunk_frame + overlap_frame, frame_num);
+        chunk_list.push_back(chunk);
+    }
+}
+
+static void ProcessVideo(DetectionEngine& engine, const Item& item, std::vector<TrackStitcher::Record>& record_list, WorkerStatistics& statistics)
+{
+    cv::VideoCapture cap(item.input_name);
+    if (!cap.isOpened()) {
+        printf("Invalid input source: %s\n", item.input_name.c_str());
+        return;
+    }
+    const bool is_chunk = item.chunk_index >= 0;
+    if (is_chunk && item.frame_start > 0) {
+        cap.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(item.frame_start));
+    }
+
+    Tracker tracker;
+    cv::Mat image;
+    for (int64_t frame_index = item.frame_start; (!is_chunk || frame_index < item.frame_end) && cap.read(image) && !image.empty(); frame_index++) {
+        DetectionEngine::Result det_result;
+        if (engine.Process(image, det_result) != DetectionEngine::kRetOk) break;
+        tracker.Update(det_result.bbox_list);
+        for (auto& track : tracker.GetTrackList()) {
+            record_list.push_back({ frame_index, track.GetId(), track.GetLatestData().bbox });
+        }
+        statistics.frame_cnt++;
+        statistics.total_time_pre_process += det_result.time_pre_process;
+        statistics.total_time_inference += det_result.time_inference;
+        statistics.total_time_post_process += det_result.time_post_process;
+    }
+}
+
+static void WriteTrackRecords(FILE* fp, const std::vector<TrackStitcher::Record>& record_list)
+{
+    /* score = 0 means the object was not detected but predicted by the tracker */
+    fprintf(fp, "frame,track_id,class_id,label,score,x,y,w,h\n");
+    for (const auto& record : record_list) {
+        const auto& bbox = record.bbox;
+        fprintf(fp, "%lld,%d,%d,%s,%.3f,%d,%d,%d,%d\n", static_cast<long long>(record.frame_index), record.track_id, bbox.class_id, bbox.label.c_str(), bbox.score, bbox.x, bbox.y, bbox.w, bbox.h);
+    }
+}
+
+static std::string GetOutputFilename(const std::string& output_dir, const Item& item)
+{
+    char output_name[32];
+    snprintf(output_name, sizeof(output_name), "%05d_", item.index);
+    return output_dir + "/" + output_name + GetBaseName(item.input_name) + ".txt";
+}
+
+/* chunk_storage[item index][chunk index] is written only by the worker which processes the chunk */
+static void WorkerLoop(int32_t worker_id, DetectionEngine& engine, WorkStealingQueue<Item>& queue, const std::string& output_dir, std::vector<std::vector<TrackStitcher::Chunk>>& chunk_storage, WorkerStatistics& statistics)
+{
+    Item item;
+    bool is_stolen = false;
+    while (queue.Pop(worker_id, item, &is_stolen)) {
+        if (item.chunk_index >= 0) {
+            TrackStitcher::Chunk& chunk = chunk_storage[item.index][item.chunk_index];
+            chunk.frame_start = item.frame_start;
+            chunk.frame_end = item.frame_end;
+            ProcessVideo(engine, item, chunk.record_list, statistics);
+        } else {
+            std::string output_filename = GetOutputFilename(output_dir, item);
+            FILE* fp = fopen(output_filename.c_str(), "w");
+            if (!fp) {
+                printf("Unable to open output file: %s\n", output_filename.c_str());
+                continue;
+            }
+            if (item.is_video) {
+                std::vector<TrackStitcher::Record> record_list;
+                ProcessVideo(engine, item, record_list, statistics);
+                WriteTrackRecords(fp, record_list);
+            } else {
+                ProcessImage(engine, item, fp, statistics);
+            }
+            fclose(fp);
+        }
+        statistics.item_cnt++;
+        if (is_stolen) statistics.stolen_cnt++;
+    }
+}
+
+int32_t main(int argc, char* argv[])
+{
+    /*** Parse arguments ***/
+    int32_t worker_num = DEFAULT_WORKER_NUM;
+    std::string output_dir = DEFAULT_OUTPUT_DIR;
+    double chunk_sec = 0;
+    int32_t overlap_frame = DEFAULT_CHUNK_OVERLAP_FRAME;
+    std::vector<Item> item_list;
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            worker_num = (std::max)(1, std::atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            chunk_sec = std::atof(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            overlap_frame = (std::max)(1, std::atoi(argv[++i]));
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return -1;
+        } else {
+            AddInput(argv[i], item_list);
+        }
+    }
+    if (item_list.empty()) {
+        PrintUsage();
+        return -1;
+    }
+    MakeDirectory(output_dir);
+
+    /*** Initialize engines. Each worker has its own engine ***/
+    std::vector<std::unique_ptr<DetectionEngine>> engine_list;
+    for (int32_t i = 0; i < worker_num; i++) {
+        std::unique_ptr<DetectionEngine> engine(new DetectionEngine());
+        if (engine->Initialize(WORK_DIR, 1) != DetectionEngine::kRetOk) {
+            printf("Initialization Error\n");
+            return -1;
+        }
+        engine_list.push_back(std::move(engine));
+    }
+
+    /*** Split videos into chunks with overlap ***/
+    std::vector<std::vector<TrackStitcher::Chunk>> chunk_storage(item_list.size());
+    std::vector<Item> work_list;
+    for (const auto& item : item_list) {
+        if (item.is_video && chunk_sec > 0) {
+            std::vector<Item> chunk_list;
+            SplitVideo(item, chunk_sec, overlap_frame, chunk_list);
+            chunk_storage[item.index].resize(chunk_list.size());
+            work_list.insert(work_list.end(), chunk_list.begin(), chunk_list.end());
+        } else {
+            work_list.push_back(item);
+        }
+    }
+
+    /*** Distribute items in round robin. Workers steal items from others when they finish their own ***/
+    WorkStealingQueue<Item> queue(worker_num);
+    for (size_t i = 0; i < work_list.size(); i++) {
+        queue.Push(static_cast<int32_t>(i % worker_num), work_list[i]);
+    }
+
+    const auto& time_start = std::chrono::steady_clock::now();
+    std::vector<WorkerStatistics> statistics_list(worker_num);
+    std::vector<std::thread> thread_list;
+    for (int32_t i = 0; i < worker_num; i++) {
+        thread_list.push_back(std::thread(WorkerLoop, i, std::ref(*engine_list[i]), std::ref(queue), std::cref(output_dir), std::ref(chunk_storage), std::ref(statistics_list[i])));
+    }
+    for (auto& thread : thread_list) thread.join();
+
+    /*** Stitch tracks of chunks into one timeline for each video ***/
+    TrackStitcher stitcher;
+    for (const auto& item : item_list) {
+        if (chunk_storage[item.index].empty()) continue;
+        std::vector<TrackStitcher::Record> record_list;
+        stitcher.Stitch(chunk_storage[item.index], record_list);
+        std::string output_filename = GetOutputFilename(output_dir, item);
+        FILE* fp = fopen(output_filename.c_str(), "w");
+        if (!fp) {
+            printf("Unable to open output file: %s\n", output_filename.c_str());
+            continue;
+        }
+        WriteTrackRecords(fp, record_list);
+        fclose(fp);
+        printf("%s: stitched %zu chunks\n", item.input_name.c_str(), chunk_storage[item.index].size());
+    }
+    const auto& time_end = std::chrono::steady_clock::now();
+
+    /*** Print statistics ***/
+    double time_total = static_cast<std::chrono::duration<double>>(time_end - time_start).count();
+    WorkerStatistics total;
+    printf("=== Statistics ===\n");
+    printf("Work items:          %9zu\n", work_list.size());
+    for (int32_t i = 0; i < worker_num; i++) {
+        const auto& statistics = statistics_list[i];
+        printf("[worker %d] items: %d (stolen: %d), frames: %lld\n", i, statistics.item_cnt, statistics.stolen_cnt, static_cast<long long>(statistics.frame_cnt));
+        total.item_cnt += statistics.item_cnt;
+        total.frame_cnt += statistics.frame_cnt;
+        total.total_time_pre_process += statistics.total_time_pre_process;
+        total.total_time_inference += statistics.total_time_inference;
+        total.total_time_post_process += statistics.total_time_post_process;
+    }
+    if (total.frame_cnt > 0) {
+        printf("Items:               %9d\n", total.item_cnt);
+        printf("Frames:              %9lld\n", static_cast<long long>(total.frame_cnt));
+        printf("Time:                %9.3lf [sec]\n", time_total);
+        printf("Throughput:          %9.1lf [FPS]\n", total.frame_cnt / time_total);
+        printf("  Pre processing:    %9.3lf [msec/frame]\n", total.total_time_pre_process / total.frame_cnt);
+        printf("  Inference:         %9.3lf [msec/frame]\n", total.total_time_inference / total.frame_cnt);
+        printf("  Post processing:   %9.3lf [msec/frame]\n", total.total_time_post_process / total.frame_cnt);
+    }
+    printf("Results are saved in %s\n", output_dir.c_str());
+
+    /*** Finalize ***/
+    for (auto& engine : engine_list) engine->Finalize();
+
+    return 0;
+}
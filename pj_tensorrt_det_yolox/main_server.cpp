@@ -0,0 +1,508 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* for socket */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "bounding_box.h"
+#include "tracker.h"
+#include "compact_result.h"
+#include "stream_scheduler.h"
+#include "server_protocol.h"
+
+/*** Macro ***/
+#define WORK_DIR                      RESOURCE_DIR
+#define DEFAULT_INPUT_IMAGE           RESOURCE_DIR"/kite.jpg"
+#define LATENCY_HISTORY_NUM           1024
+
+/*** Type ***/
+/* A client connection. Frames are processed one by one, so one result is enough */
+typedef struct Connection_ {
+    int32_t  stream_id;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool     is_done;
+    CompactResult result;
+    Connection_() : stream_id(-1), is_done(false) {}
+} Connection;
+
+typedef struct Metrics_ {
+    int64_t request_num;
+    int64_t error_num;
+    int64_t frame_num;
+    int64_t total_batch_size;
+    double  total_time_wait;
+    double  total_time_latency;
+    double  max_time_latency;
+    std::vector<double> latency_history;    // the latest LATENCY_HISTORY_NUM latencies, for percentiles
+    Metrics_() : request_num(0), error_num(0), frame_num(0), total_batch_size(0), total_time_wait(0), total_time_latency(0), max_time_latency(0) {}
+} Metrics;
+
+typedef struct Server_ {
+    StreamScheduler scheduler;
+
+    /* Streams are reused by later connections, because StreamScheduler can't remove them */
+    std::mutex mutex;
+    std::vector<Connection*> connection_list;       // indexed by stream_id. nullptr = free
+    std::vector<int> fd_list;                       // sockets of the connections, to shut down at exit
+    int32_t connection_num;
+    std::condition_variable cond_connection;        // notified when a connection is closed
+    Metrics metrics;
+    Server_() : connection_num(0) {}
+} Server;
+
+/*** Global variable ***/
+static std::atomic<bool> s_is_exit(false);
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage:\n");
+    printf("  ./main_server serve [-s socket] [-b max_batch_size] [-w max_wait_ms]  : run the server\n");
+    printf("  ./main_server client [-s socket] [-r] image0 [image1 ...]  : send images and print results (-r: send decoded pixels)\n");
+    printf("  ./main_server metrics [-s socket]  : print the server metrics\n");
+}
+
+static void HandleSignal(int)
+{
+    s_is_exit = true;
+}
+
+static bool ReadAll(int fd, void* buffer, size_t size)
+{
+    uint8_t* p = static_cast<uint8_t*>(buffer);
+    while (size > 0) {
+        const ssize_t ret = recv(fd, p, size, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        p += ret;
+        size -= static_cast<size_t>(ret);
+    }
+    return true;
+}
+
+static bool WriteAll(int fd, const void* buffer, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    while (size > 0) {
+        const ssize_t ret = send(fd, p, size, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+        p += ret;
+        size -= static_cast<size_t>(ret);
+    }
+    return true;
+}
+
+static bool SendResponse(int fd, int32_t status, const void* data, uint32_t data_size)
+{
+    ServerProtocol::ResponseHeader header = { ServerProtocol::kMagic, status, data_size, 0 };
+    return WriteAll(fd, &header, sizeof(header)) && (data_size == 0 || WriteAll(fd, data, data_size));
+}
+
+static int ConnectSocket(const std::string& socket_path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path.c_str());
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*** Server ***/
+/* Called in the scheduler thread */
+static void OnResult(Server& server, const StreamScheduler::StreamResult& stream_result, std::vector<Track>& track_list)
+{
+    Connection* connection = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(server.mutex);
+        connection = server.connection_list[stream_result.stream_id];
+        Metrics& metrics = server.metrics;
+        metrics.frame_num++;
+        metrics.total_batch_size += stream_result.batch_size;
+        metrics.total_time_wait += stream_result.time_wait;
+        metrics.total_time_latency += stream_result.time_latency;
+        metrics.max_time_latency = (std::max)(metrics.max_time_latency, stream_result.time_latency);
+        if (metrics.latency_history.size() < LATENCY_HISTORY_NUM) {
+            metrics.latency_history.push_back(stream_result.time_latency);
+        } else {
+            metrics.latency_history[metrics.frame_num % LATENCY_HISTORY_NUM] = stream_result.time_latency;
+        }
+    }
+    if (!connection) return;
+
+    /* The connection is kept until its frame is done, because the connection thread waits for it */
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    CompactResult& result = connection->result;
+    result.Clear();
+    result.header.frame_index = stream_result.frame_index;
+    result.header.time_pre_process = static_cast<float>(stream_result.time_pre_process);
+    result.header.time_inference = static_cast<float>(stream_result.time_inference);
+    result.header.time_post_process = static_cast<float>(stream_result.time_post_process);
+    for (auto& track : track_list) {
+        const auto& bbox = track.GetLatestData().bbox;
+        CompactResult::Object object;
+        object.track_id = track.GetId();
+        object.class_id = static_cast<int16_t>(bbox.class_id);
+        object.flags = bbox.score == 0 ? CompactResult::kFlagPredicted : 0;
+        object.score = bbox.score;
+        object.x = static_cast<float>(bbox.x);
+        object.y = static_cast<float>(bbox.y);
+        object.w = static_cast<float>(bbox.w);
+        object.h = static_cast<float>(bbox.h);
+        result.object_list.push_back(object);
+    }
+    connection->is_done = true;
+    connection->cond.notify_one();
+}
+
+static int32_t AttachStream(Server& server, Connection* connection)
+{
+    std::lock_guard<std::mutex> lock(server.mutex);
+    for (size_t i = 0; i < server.connection_list.size(); i++) {
+        if (server.connection_list[i] == nullptr) {
+            server.connection_list[i] = connection;
+            return static_cast<int32_t>(i);
+        }
+    }
+    const int32_t stream_id = server.scheduler.AddStream([&server](const StreamScheduler::StreamResult& stream_result, std::vector<Track>& track_list) {
+        OnResult(server, stream_result, track_list);
+    });
+    server.connection_list.push_back(connection);
+    return stream_id;
+}
+
+static void DetachStream(Server& server, int32_t stream_id)
+{
+    server.scheduler.ResetStream(stream_id);
+    std::lock_guard<std::mutex> lock(server.mutex);
+    server.connection_list[stream_id] = nullptr;
+}
+
+static std::string CreateMetricsText(Server& server)
+{
+    const int32_t queue_depth = server.scheduler.GetPendingNum();
+    std::lock_guard<std::mutex> lock(server.mutex);
+    const Metrics& metrics = server.metrics;
+    std::vector<double> latency_list = metrics.latency_history;
+    std::sort(latency_list.begin(), latency_list.end());
+    const double frame_num = (std::max)(int64_t(1), metrics.frame_num);
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer),
+        "connection_num %d\n"
+        "request_num %lld\n"
+        "error_num %lld\n"
+        "frame_num %lld\n"
+        "queue_depth %d\n"
+        "batch_size_avg %.3f\n"
+        "wait_ms_avg %.3f\n"
+        "latency_ms_avg %.3f\n"
+        "latency_ms_p50 %.3f\n"
+        "latency_ms_p99 %.3f\n"
+        "latency_ms_max %.3f\n",
+        server.connection_num, static_cast<long long>(metrics.request_num), static_cast<long long>(metrics.error_num), static_cast<long long>(metrics.frame_num),
+        queue_depth, metrics.total_batch_size / frame_num, metrics.total_time_wait / frame_num, metrics.total_time_latency / frame_num,
+        latency_list.empty() ? 0 : latency_list[latency_list.size() / 2],
+        latency_list.empty() ? 0 : latency_list[latency_list.size() * 99 / 100],
+        metrics.max_time_latency);
+    return buffer;
+}
+
+/* Decode the request data into a frame. Return a status of ServerProtocol */
+static int32_t ReadFrame(int fd, const ServerProtocol::RequestHeader& header, std::vector<uint8_t>& data, cv::Mat& mat)
+{
+    if (header.data_size > ServerProtocol::kMaxDataSize) return ServerProtocol::kStatusInvalidRequest;
+    data.resize(header.data_size);
+    if (header.data_size > 0 && !ReadAll(fd, data.data(), data.size())) return ServerProtocol::kStatusInvalidRequest;
+
+    if (header.type == ServerProtocol::kRequestEncoded) {
+        mat = cv::imdecode(data, cv::IMREAD_COLOR);
+        if (mat.empty()) return ServerProtocol::kStatusDecodeError;
+    } else {
+        if (header.width <= 0 || header.height <= 0 || static_cast<int64_t>(header.width) * header.height * 3 != static_cast<int64_t>(header.data_size)) return ServerProtocol::kStatusInvalidRequest;
+        /* The scheduler keeps the mat until the batch is done, so it must not share the receive buffer which is reused */
+        mat = cv::Mat(header.height, header.width, CV_8UC3, data.data()).clone();
+    }
+    return ServerProtocol::kStatusOk;
+}
+
+static void HandleConnection(Server& server, int fd)
+{
+    Connection connection;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> response;
+    while (!s_is_exit) {
+        ServerProtocol::RequestHeader header;
+        if (!ReadAll(fd, &header, sizeof(header))) break;
+        if (header.magic != ServerProtocol::kMagic) {
+            SendResponse(fd, ServerProtocol::kStatusInvalidRequest, nullptr, 0);
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.metrics.request_num++;
+        }
+
+        if (header.type == ServerProtocol::kRequestMetrics) {
+            const std::string& text = CreateMetricsText(server);
+            if (!SendResponse(fd, ServerProtocol::kStatusOk, text.data(), static_cast<uint32_t>(text.size()))) break;
+            continue;
+        }
+
+        int32_t status = ServerProtocol::kStatusInvalidRequest;
+        cv::Mat mat;
+        if (header.type == ServerProtocol::kRequestEncoded || header.type == ServerProtocol::kRequestRaw) {
+            status = ReadFrame(fd, header, data, mat);
+        }
+        if (status == ServerProtocol::kStatusOk) {
+            /* The stream is assigned at the first frame, so that connections only for metrics don't use a stream */
+            if (connection.stream_id < 0) connection.stream_id = AttachStream(server, &connection);
+            connection.is_done = false;
+            if (server.scheduler.Submit(connection.stream_id, mat) != StreamScheduler::kRetOk) {
+                status = ServerProtocol::kStatusProcessError;
+            } else {
+                std::unique_lock<std::mutex> lock(connection.mutex);
+                connection.cond.wait(lock, [&] { return connection.is_done; });
+                response.clear();
+                connection.result.Serialize(response);
+            }
+        }
+
+        if (status != ServerProtocol::kStatusOk) {
+            {
+                std::lock_guard<std::mutex> lock(server.mutex);
+                server.metrics.error_num++;
+            }
+            if (!SendResponse(fd, status, nullptr, 0) || status == ServerProtocol::kStatusInvalidRequest) break;   /* the stream may be broken */
+            continue;
+        }
+        if (!SendResponse(fd, ServerProtocol::kStatusOk, response.data(), static_cast<uint32_t>(response.size()))) break;
+    }
+
+    if (connection.stream_id >= 0) DetachStream(server, connection.stream_id);
+}
+
+static int32_t RunServer(const std::string& socket_path, const StreamScheduler::Config& config)
+{
+    Server server;
+    if (server.scheduler.Initialize(WORK_DIR, 4, config) != StreamScheduler::kRetOk) {
+        printf("Initialization Error\n");
+        return -1;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path.c_str());
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+        printf("Failed to listen on %s\n", socket_path.c_str());
+        if (listen_fd >= 0) close(listen_fd);
+        server.scheduler.Finalize();
+        return -1;
+    }
+    printf("Listening on %s (max_batch_size = %d, max_wait_ms = %d)\n", socket_path.c_str(), config.max_batch_size, config.max_wait_ms);
+
+    /* One thread per connection. Clients are local and few, and a connection handles one frame at a time */
+    while (!s_is_exit) {
+        struct pollfd poll_fd = { listen_fd, POLLIN, 0 };
+        if (poll(&poll_fd, 1, 100) <= 0) continue;
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) continue;
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.fd_list.push_back(fd);
+            server.connection_num++;
+        }
+        std::thread([&server, fd] {
+            HandleConnection(server, fd);
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.fd_list.erase(std::find(server.fd_list.begin(), server.fd_list.end(), fd));
+            close(fd);
+            server.connection_num--;
+            server.cond_connection.notify_all();
+        }).detach();
+    }
+
+    /* Stop accepting, then wait for the connections. Blocking recv of clients is woken up by the shutdown of their sockets */
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    printf("\n%s", CreateMetricsText(server).c_str());
+    {
+        std::unique_lock<std::mutex> lock(server.mutex);
+        for (int fd : server.fd_list) shutdown(fd, SHUT_RDWR);
+        server.cond_connection.wait(lock, [&] { return server.connection_num == 0; });
+    }
+    server.scheduler.Finalize();
+    return 0;
+}
+
+/*** Client ***/
+static int32_t SendRequest(int fd, uint32_t type, int32_t width, int32_t height, const uint8_t* data, uint32_t data_size, std::vector<uint8_t>& response, int32_t& status)
+{
+    ServerProtocol::RequestHeader request_header = { ServerProtocol::kMagic, type, width, height, data_size, 0 };
+    if (!WriteAll(fd, &request_header, sizeof(request_header)) || (data_size > 0 && !WriteAll(fd, data, data_size))) return -1;
+    ServerProtocol::ResponseHeader response_header;
+    if (!ReadAll(fd, &response_header, sizeof(response_header)) || response_header.magic != ServerProtocol::kMagic || response_header.data_size > ServerProtocol::kMaxDataSize) return -1;
+    status = response_header.status;
+    response.resize(response_header.data_size);
+    if (response_header.data_size > 0 && !ReadAll(fd, response.data(), response.size())) return -1;
+    return 0;
+}
+
+static int32_t RunClient(const std::string& socket_path, const std::vector<std::string>& input_name_list, bool is_raw)
+{
+    int fd = ConnectSocket(socket_path);
+    if (fd < 0) {
+        printf("Failed to connect to %s\n", socket_path.c_str());
+        return -1;
+    }
+
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> response;
+    for (const auto& input_name : input_name_list) {
+        int32_t width = 0;
+        int32_t height = 0;
+        uint32_t type = ServerProtocol::kRequestEncoded;
+        if (is_raw) {
+            cv::Mat mat = cv::imread(input_name);
+            if (mat.empty()) {
+                printf("Invalid input source: %s\n", input_name.c_str());
+                continue;
+            }
+            if (!mat.isContinuous()) mat = mat.clone();
+            data.assign(mat.data, mat.data + mat.total() * mat.elemSize());
+            width = mat.cols;
+            height = mat.rows;
+            type = ServerProtocol::kRequestRaw;
+        } else {
+            /* Send the file as it is. The server decodes it */
+            std::ifstream ifs(input_name, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        }
+
+        const auto& time0 = std::chrono::steady_clock::now();
+        int32_t status = 0;
+        if (SendRequest(fd, type, width, height, data.data(), static_cast<uint32_t>(data.size()), response, status) != 0) {
+            printf("Disconnected\n");
+            break;
+        }
+        const auto& time1 = std::chrono::steady_clock::now();
+        CompactResultView view;
+        if (status != ServerProtocol::kStatusOk || !view.Set(response.data(), response.size())) {
+            printf("%s: error (%d)\n", input_name.c_str(), status);
+            continue;
+        }
+        printf("%s: objects: %u, round trip: %.3lf [msec], inference: %.3f [msec]\n", input_name.c_str(), view.GetObjectNum(), (time1 - time0).count() / 1000000.0, view.GetHeader().time_inference);
+        const CompactResult::Object* object_list = view.GetObjectList();
+        for (uint32_t i = 0; i < view.GetObjectNum(); i++) {
+            const auto& object = object_list[i];
+            printf("    track %4d, class %3d, score %.3f, (%.0f, %.0f, %.0f, %.0f)\n", object.track_id, object.class_id, object.score, object.x, object.y, object.w, object.h);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int32_t RunMetrics(const std::string& socket_path)
+{
+    int fd = ConnectSocket(socket_path);
+    if (fd < 0) {
+        printf("Failed to connect to %s\n", socket_path.c_str());
+        return -1;
+    }
+    std::vector<uint8_t> response;
+    int32_t status = 0;
+    const int32_t ret = SendRequest(fd, ServerProtocol::kRequestMetrics, 0, 0, nullptr, 0, response, status);
+    close(fd);
+    if (ret != 0 || status != ServerProtocol::kStatusOk) return -1;
+    printf("%s", std::string(response.begin(), response.end()).c_str());
+    return 0;
+}
+
+int32_t main(int argc, char* argv[])
+{
+    /*** Parse arguments ***/
+    if (argc < 2) {
+        PrintUsage();
+        return -1;
+    }
+    const std::string mode = argv[1];
+    std::string socket_path = ServerProtocol::kDefaultSocketPath;
+    StreamScheduler::Config config;
+    bool is_raw = false;
+    std::vector<std::string> input_name_list;
+    for (int32_t i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            config.max_batch_size = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            config.max_wait_ms = std::atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            is_raw = true;
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return -1;
+        } else {
+            input_name_list.push_back(argv[i]);
+        }
+    }
+    if (input_name_list.empty()) input_name_list.push_back(DEFAULT_INPUT_IMAGE);
+
+    if (mode == "serve") {
+        signal(SIGINT, HandleSignal);
+        signal(SIGTERM, HandleSignal);
+        return RunServer(socket_path, config);
+    } else if (mode == "client") {
+        return RunClient(socket_path, input_name_list, is_raw);
+    } else if (mode == "metrics") {
+        return RunMetrics(socket_path);
+    }
+    PrintUsage();
+    return -1;
+}
@@ -0,0 +1,272 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+/*** Include ***/
+/* for general */
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+/* for OpenCV */
+#include <opencv2/opencv.hpp>
+
+/* for My modules */
+#include "common_helper_cv.h"
+#include "shm_ring_buffer.h"
+#include "compact_result.h"
+#include "image_processor.h"
+
+/*** Macro ***/
+#define WORK_DIR                      RESOURCE_DIR
+#define DEFAULT_INPUT_IMAGE           RESOURCE_DIR"/kite.jpg"
+#define DEFAULT_FRAME_SHM_NAME        "/pj_yolox_frame"
+#define DEFAULT_RESULT_SHM_NAME       "/pj_yolox_result"
+#define DEFAULT_SLOT_NUM              4
+#define MAX_OBJECT_NUM_IN_RESULT      256
+#define OPEN_RETRY_MS                 10000
+
+/*** Type ***/
+/* Put at the top of each frame slot. Pixels follow it (aligned to 64 bytes) */
+typedef struct FrameHeader_ {
+    int32_t width;
+    int32_t height;
+    int32_t type;       // cv::Mat type
+    int32_t step;       // bytes per row
+    double  timestamp_ms;
+} FrameHeader;
+
+static constexpr size_t kFramePixelOffset = 64;
+static_assert(sizeof(FrameHeader) <= kFramePixelOffset, "FrameHeader is too big");
+
+/*** Function ***/
+static void PrintUsage(void)
+{
+    printf("Usage:\n");
+    printf("  ./main_shm capture [-d] [-n frame_shm] input  : put frames into the frame ring buffer\n");
+    printf("  ./main_shm process [-s] [-n frame_shm] [-r result_shm]  : run detection on the frame ring buffer, and put results into the result ring buffer\n");
+    printf("  ./main_shm print [-r result_shm]  : print results in the result ring buffer\n");
+    printf("  -d: drop frames when the ring buffer is full (for camera). Otherwise wait\n");
+    printf("  -s: show the processed frame\n");
+}
+
+static int32_t OpenWithRetry(ShmRingBuffer& ring_buffer, const std::string& name)
+{
+    const auto& time_start = std::chrono::steady_clock::now();
+    while (ring_buffer.Open(name) != ShmRingBuffer::kRetOk) {
+        if (std::chrono::steady_clock::now() - time_start > std::chrono::milliseconds(OPEN_RETRY_MS)) {
+            printf("Failed to open %s\n", name.c_str());
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return 0;
+}
+
+static int32_t RunCapture(const std::string& input_name, const std::string& frame_shm_name, bool is_drop)
+{
+    cv::VideoCapture cap;
+    std::string name = input_name;
+    if (!CommonHelper::FindSourceImage(name, cap)) {
+        return -1;
+    }
+    cv::Mat image = cap.isOpened() ? cv::Mat() : cv::imread(name);
+    if (cap.isOpened()) cap.read(image);
+    if (image.empty()) return -1;
+
+    /* Slot size is fixed by the first frame */
+    const size_t frame_size = image.total() * image.elemSize();
+    ShmRingBuffer ring_buffer;
+    if (ring_buffer.Create(frame_shm_name, DEFAULT_SLOT_NUM, static_cast<uint32_t>(kFramePixelOffset + frame_size)) != ShmRingBuffer::kRetOk) {
+        return -1;
+    }
+
+    int64_t frame_cnt = 0;
+    int64_t drop_cnt = 0;
+    for (; !image.empty(); frame_cnt++) {
+        uint8_t* slot = ring_buffer.AcquireWrite();
+        while (!slot && !is_drop) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            slot = ring_buffer.AcquireWrite();
+        }
+        if (slot && image.total() * image.elemSize() == frame_size) {
+            FrameHeader* header = reinterpret_cast<FrameHeader*>(slot);
+            header->width = image.cols;
+            header->height = image.rows;
+            header->type = image.type();
+            header->step = static_cast<int32_t>(image.cols * image.elemSize());
+            header->timestamp_ms = cap.isOpened() ? cap.get(cv::CAP_PROP_POS_MSEC) : -1;
+            /* VideoCapture decodes into its own buffer, so this is the only copy of pixels b/w capture and inference */
+            cv::Mat mat_slot(image.rows, image.cols, image.type(), slot + kFramePixelOffset, header->step);
+            image.copyTo(mat_slot);
+            ring_buffer.CommitWrite(static_cast<uint32_t>(kFramePixelOffset + frame_size), static_cast<uint64_t>(frame_cnt));
+        } else {
+            drop_cnt++;
+        }
+
+        if (!cap.isOpened()) break;
+        cap.read(image);
+    }
+
+    /* The name is removed in Finalize. A consumer which has not opened the buffer yet can't find it after that,
+     * so wait until the consumer opens it and reads all the frames (a consumer already opened can read after Finalize) */
+    ring_buffer.Close();
+    if (!ring_buffer.WaitForConsumer(OPEN_RETRY_MS)) {
+        printf("Frames were not read by the consumer\n");
+    }
+    printf("Captured %lld frames (dropped %lld)\n", static_cast<long long>(frame_cnt), static_cast<long long>(drop_cnt));
+    return 0;
+}
+
+static int32_t RunProcess(const std::string& frame_shm_name, const std::string& result_shm_name, bool is_show)
+{
+    ShmRingBuffer frame_ring_buffer;
+    if (OpenWithRetry(frame_ring_buffer, frame_shm_name) != 0) return -1;
+
+    CompactResult result;
+    result.object_list.resize(MAX_OBJECT_NUM_IN_RESULT);
+    ShmRingBuffer result_ring_buffer;
+    if (result_ring_buffer.Create(result_shm_name, DEFAULT_SLOT_NUM * 4, static_cast<uint32_t>(result.GetSerializedSize())) != ShmRingBuffer::kRetOk) {
+        return -1;
+    }
+
+    ImageProcessor::InputParam input_param = { WORK_DIR, 4, 1, 0, 0, 0, 10.0F, 0 };
+    ImageProcessor::Context* context = ImageProcessor::Create(input_param);
+    if (!context) {
+        printf("Initialization Error\n");
+        return -1;
+    }
+
+    int64_t frame_cnt = 0;
+    int64_t lost_frame_cnt = 0;
+    int64_t dropped_result_cnt = 0;
+    uint64_t sequence_expected = 0;
+    double total_time_image_process = 0;
+    while (!frame_ring_buffer.IsClosed()) {
+        uint32_t data_size = 0;
+        uint64_t sequence = 0;
+        uint8_t* slot = frame_ring_buffer.AcquireRead(data_size, sequence, 100);
+        if (!slot) continue;
+        if (sequence != sequence_expected) lost_frame_cnt += static_cast<int64_t>(sequence - sequence_expected);
+        sequence_expected = sequence + 1;
+
+        /* Use the pixels in the shared memory as they are. The slot is not reused by the producer until ReleaseRead */
+        const FrameHeader* header = reinterpret_cast<const FrameHeader*>(slot);
+        cv::Mat image(header->height, header->width, header->type, slot + kFramePixelOffset, header->step);
+
+        const auto& time_image_process0 = std::chrono::steady_clock::now();
+        if (ImageProcessor::Process(context, image, result, header->timestamp_ms) != 0) {
+            frame_ring_buffer.ReleaseRead();
+            break;
+        }
+        const auto& time_image_process1 = std::chrono::steady_clock::now();
+        total_time_image_process += (time_image_process1 - time_image_process0).count() / 1000000.0;
+        result.header.frame_index = static_cast<int64_t>(sequence);     /* frame number in the capture process */
+
+        /* Serialize the result directly into the slot. Drop it if the reader is too slow */
+        if (result.object_list.size() > MAX_OBJECT_NUM_IN_RESULT) result.object_list.resize(MAX_OBJECT_NUM_IN_RESULT);
+        uint8_t* result_slot = result_ring_buffer.AcquireWrite();
+        if (result_slot) {
+            const size_t size = result.Serialize(result_slot, result_ring_buffer.GetSlotSize());
+            result_ring_buffer.CommitWrite(static_cast<uint32_t>(size), sequence);
+        } else {
+            dropped_result_cnt++;
+        }
+
+        if (is_show) {
+            cv::imshow("test", image);
+            cv::waitKey(1);
+        }
+        frame_ring_buffer.ReleaseRead();
+        frame_cnt++;
+    }
+
+    result_ring_buffer.Close();
+    ImageProcessor::Destroy(context);
+
+    printf("Processed %lld frames (lost %lld frames, dropped %lld results)\n", static_cast<long long>(frame_cnt), static_cast<long long>(lost_frame_cnt), static_cast<long long>(dropped_result_cnt));
+    if (frame_cnt > 0) printf("Image processing:  %9.3lf [msec]\n", total_time_image_process / frame_cnt);
+    return 0;
+}
+
+static int32_t RunPrint(const std::string& result_shm_name)
+{
+    ShmRingBuffer ring_buffer;
+    if (OpenWithRetry(ring_buffer, result_shm_name) != 0) return -1;
+
+    CompactResultView view;
+    while (!ring_buffer.IsClosed()) {
+        uint32_t data_size = 0;
+        uint64_t sequence = 0;
+        const uint8_t* slot = ring_buffer.AcquireRead(data_size, sequence, 100);
+        if (!slot) continue;
+        if (view.Set(slot, data_size)) {
+            const auto& header = view.GetHeader();
+            printf("[frame %5lld] objects: %2u, inference: %7.3f [msec]\n", static_cast<long long>(header.frame_index), view.GetObjectNum(), header.time_inference);
+            const CompactResult::Object* object_list = view.GetObjectList();
+            for (uint32_t i = 0; i < view.GetObjectNum(); i++) {
+                const auto& object = object_list[i];
+                printf("    track %4d, class %3d, score %.3f, (%.0f, %.0f, %.0f, %.0f)%s\n", object.track_id, object.class_id, object.score, object.x, object.y, object.w, object.h,
+                    (object.flags & CompactResult::kFlagPredicted) ? " predicted" : "");
+            }
+        }
+        ring_buffer.ReleaseRead();
+    }
+    return 0;
+}
+
+int32_t main(int argc, char* argv[])
+{
+    /*** Parse arguments ***/
+    if (argc < 2) {
+        PrintUsage();
+        return -1;
+    }
+    const std::string mode = argv[1];
+    std::string frame_shm_name = DEFAULT_FRAME_SHM_NAME;
+    std::string result_shm_name = DEFAULT_RESULT_SHM_NAME;
+    std::string input_name = DEFAULT_INPUT_IMAGE;
+    bool is_drop = false;
+    bool is_show = false;
+    for (int32_t i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            frame_shm_name = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            result_shm_name = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0) {
+            is_drop = true;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            is_show = true;
+        } else if (argv[i][0] == '-') {
+            PrintUsage();
+            return -1;
+        } else {
+            input_name = argv[i];
+        }
+    }
+
+    if (mode == "capture") {
+        return RunCapture(input_name, frame_shm_name, is_drop);
+    } else if (mode == "process") {
+        return RunProcess(frame_shm_name, result_shm_name, is_show);
+    } else if (mode == "print") {
+        return RunPrint(result_shm_name);
+    }
+    PrintUsage();
+    return -1;
+}
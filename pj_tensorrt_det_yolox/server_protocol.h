@@ -0,0 +1,70 @@
+/* Copyright 2021 iwatake2222
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+#ifndef SERVER_PROTOCOL_
+#define SERVER_PROTOCOL_
+
+/* for general */
+#include <cstdint>
+
+/*
+ * Protocol of main_server on a Unix domain socket (SOCK_STREAM). All values are in the host byte order.
+ * A client sends RequestHeader + data, and the server returns ResponseHeader + data, one by one on a connection.
+ * Frames on the same connection are tracked as one stream, so track ids are kept while the connection is open.
+ *   kRequestEncoded : data = encoded image (jpg, png, etc.), response data = serialized CompactResult
+ *   kRequestRaw     : data = BGR pixels (width x height x 3, no padding), response data = serialized CompactResult
+ *   kRequestMetrics : no data, response data = text ("name value" per line)
+ */
+namespace ServerProtocol
+{
+
+static constexpr uint32_t kMagic = 0x52534A50;      /* "PJSR" */
+static constexpr uint32_t kMaxDataSize = 64 * 1024 * 1024;
+static constexpr const char* kDefaultSocketPath = "/tmp/pj_yolox.sock";
+
+enum {
+    kRequestEncoded = 1,
+    kRequestRaw = 2,
+    kRequestMetrics = 3,
+};
+
+enum {
+    kStatusOk = 0,
+    kStatusInvalidRequest = -1,
+    kStatusDecodeError = -2,
+    kStatusProcessError = -3,
+};
+
+typedef struct RequestHeader_ {
+    uint32_t magic;
+    uint32_t type;
+    int32_t  width;         // for kRequestRaw
+    int32_t  height;        // for kRequestRaw
+    uint32_t data_size;
+    uint32_t reserved;
+} RequestHeader;
+
+typedef struct ResponseHeader_ {
+    uint32_t magic;
+    int32_t  status;
+    uint32_t data_size;
+    uint32_t reserved;
+} ResponseHeader;
+
+static_assert(sizeof(RequestHeader) == 24, "Binary format of RequestHeader is changed");
+static_assert(sizeof(ResponseHeader) == 16, "Binary format of ResponseHeader is changed");
+
+}
+
+#endif
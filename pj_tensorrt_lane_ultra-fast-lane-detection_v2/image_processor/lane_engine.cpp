@@ -78,6 +78,7 @@ static constexpr int32_t kNumRow = 72;
 static constexpr int32_t kNumCol = 81;
 static constexpr float kCropRatio = 0.8;
 #endif
+static constexpr int32_t kMaxNumCls = (kNumRow > kNumCol) ? kNumRow : kNumCol;
 
 void LaneEngine::GenerateAnchor()
 {
@@ -161,110 +162,84 @@ int32_t LaneEngine::Finalize()
     return kRetOk;
 }
 
-static std::vector<int32_t> argmax_1(const std::vector<float>& v, const std::vector<int32_t>& dims)
+/* ArgMax along the 2nd axis of 1xNxCxL tensor at (c, l). data points to [0, 0, c, l] and step is C * L. Returns 0 if all values are <= 0 */
+static inline int32_t ArgMax1(const float* data, int32_t num, int32_t step)
 {
-    std::vector<int32_t> ret;
-    ret.resize(dims[0] * dims[2] * dims[3]);
-
-    for (int32_t i = 0; i < dims[2]; i++) {
-        for (int32_t j = 0; j < dims[3]; j++) {
-            int32_t offset = dims[3] * i + j;
-            float max_val = 0;
-            int32_t max_index = 0;
-            for (int32_t k = 0; k < dims[1]; k++) {
-                size_t index = k * dims[2] * dims[3] + offset;
-                if (v[index] > max_val) {
-                    max_val = v[index];
-                    max_index = k;
-                }
-            }
-            ret[offset] = max_index;
+    float max_val = 0;
+    int32_t max_index = 0;
+    for (int32_t k = 0; k < num; k++) {
+        if (data[k * step] > max_val) {
+            max_val = data[k * step];
+            max_index = k;
         }
     }
-    return ret;
+    return max_index;
 }
 
-static int32_t sum_valid(const std::vector<int32_t>& v, int32_t num, int32_t interval, int32_t offset)
+/* Decode one lane. Existence of all the anchors is checked at first, and location is calculated only when the lane exists */
+static void DecodeLane(const float* loc, const std::vector<int32_t>& loc_dims, const float* exist, const std::vector<int32_t>& exist_dims,
+    int32_t lane, int32_t min_valid_num, const std::vector<float>& anchor, bool is_row, LaneEngine::Line<float>& line)
 {
-    int32_t sum = 0;
-    for (int32_t i = 0; i < num; i++) {
-        sum += v[i * interval + offset];
+    const int32_t num_grid = loc_dims[1];   /* 200 */
+    const int32_t num_cls = loc_dims[2];    /* 72 */
+    const int32_t num_lane = loc_dims[3];   /* 4 */
+    const int32_t num_exist = exist_dims[1];
+    const int32_t step = num_cls * num_lane;
+
+    /* num_cls is the number of anchors (checked in Process) */
+    std::array<bool, kMaxNumCls> is_valid_list;
+    int32_t valid_num = 0;
+    for (int32_t k = 0; k < num_cls; k++) {
+        is_valid_list[k] = ArgMax1(exist + k * num_lane + lane, num_exist, step) != 0;
+        if (is_valid_list[k]) valid_num++;
+    }
+    if (valid_num <= min_valid_num) return;
+
+    for (int32_t k = 0; k < num_cls; k++) {
+        if (!is_valid_list[k]) continue;
+        const int32_t index = k * num_lane + lane;
+
+        /* all_ind = torch.tensor(list(range(max(0,max_indices_row[0,k,i] - local_width), min(num_grid_row-1, max_indices_row[0,k,i] + local_width) + 1))) */
+        const int32_t max_index = ArgMax1(loc + index, num_grid, step);
+        const int32_t ind_start = (std::max)(0, max_index - 1);
+        const int32_t ind_end = (std::min)(num_grid - 1, max_index + 1);
+        float pred_all_list[3];
+        float pred_all_list_softmax[3];
+        const int32_t pred_num = ind_end - ind_start + 1;
+        for (int32_t l = 0; l < pred_num; l++) {
+            pred_all_list[l] = loc[(ind_start + l) * step + index];
+        }
+        CommonHelper::SoftMaxFast(pred_all_list, pred_all_list_softmax, pred_num);
+        float out_temp = 0;
+        for (int32_t l = 0; l < pred_num; l++) {
+            out_temp += pred_all_list_softmax[l] * (ind_start + l);
+        }
+        const float pos = (out_temp + 0.5) / (num_grid - 1.0);
+        if (is_row) {
+            line.push_back(std::pair<float, float>(pos, anchor[k]));
+        } else {
+            line.push_back(std::pair<float, float>(anchor[k], pos));
+        }
     }
-    return sum;
 }
 
 
-std::vector<LaneEngine::Line<float>> LaneEngine::Pred2Coords(const std::vector<float>& loc_row, const std::vector<int32_t>& loc_row_dims, const std::vector<float>& exist_row, const std::vector<int32_t>& exist_row_dims,
-                             const std::vector<float>& loc_col, const std::vector<int32_t>& loc_col_dims, const std::vector<float>& exist_col, const std::vector<int32_t>& exist_col_dims)
+std::vector<LaneEngine::Line<float>> LaneEngine::Pred2Coords(const float* loc_row, const std::vector<int32_t>& loc_row_dims, const float* exist_row, const std::vector<int32_t>& exist_row_dims,
+                             const float* loc_col, const std::vector<int32_t>& loc_col_dims, const float* exist_col, const std::vector<int32_t>& exist_col_dims)
 {
     std::vector<Line<float>> line_list(4);
 
-    int32_t num_grid_row = loc_row_dims[1]; /* 200 */
-    int32_t num_cls_row = loc_row_dims[2];  /* 72 */
-    int32_t num_lane_row = loc_row_dims[3]; /* 4 */
-    int32_t num_grid_col = loc_col_dims[1];
-    int32_t num_cls_col = loc_col_dims[2];
-    int32_t num_lane_col = loc_col_dims[3];
-
-    auto max_indices_row = argmax_1(loc_row, loc_row_dims);  /* 1x200x72x4 -> 1x72x4 */
-    auto valid_row = argmax_1(exist_row, exist_row_dims);
-    auto max_indices_col = argmax_1(loc_col, loc_col_dims);
-    auto valid_col = argmax_1(exist_col, exist_col_dims);
-
+    /* Lane 1 and 2 use row anchors, lane 0 and 3 use column anchors */
     for (int32_t i : { 1, 2 }) {
-        if (sum_valid(valid_row, num_cls_row, num_lane_row, i) > num_cls_row / 2) {
-            for (int32_t k = 0; k < num_cls_row; k++) {
-                int32_t index = k * num_lane_row + i;
-                if (valid_row[index] != 0) {
-                    /* all_ind = torch.tensor(list(range(max(0,max_indices_row[0,k,i] - local_width), min(num_grid_row-1, max_indices_row[0,k,i] + local_width) + 1))) */
-                    std::vector<float> pred_all_list;
-                    std::vector<int32_t> all_ind_list;
-                    for (int32_t all_ind = std::max(0, max_indices_row[index] - 1); all_ind <= std::min(num_grid_row - 1, max_indices_row[index] + 1); all_ind++) {
-                        pred_all_list.push_back(loc_row[all_ind * num_cls_row * num_lane_row + index]);
-                        all_ind_list.push_back(all_ind);
-                    }
-                    std::vector<float> pred_all_list_softmax(pred_all_list.size());
-                    CommonHelper::SoftMaxFast(pred_all_list.data(), pred_all_list_softmax.data(), pred_all_list.size());
-                    float out_temp = 0;
-                    for (int32_t l = 0; l < pred_all_list.size(); l++) {
-                        out_temp += pred_all_list_softmax[l] * all_ind_list[l];
-                    }
-                    float x = (out_temp + 0.5) / (num_grid_row - 1.0);
-                    float y = row_anchor_[k];
-                    line_list[i].push_back(std::pair<float, float>(x, y));
-                }
-            }
-        }
+        DecodeLane(loc_row, loc_row_dims, exist_row, exist_row_dims, i, loc_row_dims[2] / 2, row_anchor_, true, line_list[i]);
     }
-
-    for (int32_t i : {0, 3}) {
-        if (sum_valid(valid_col, num_cls_col, num_lane_col, i) > num_cls_col / 8) {
-            for (int32_t k = 0; k < num_cls_col; k++) {
-                int32_t index = k * num_lane_col + i;
-                if (valid_col[index] != 0) {
-                    std::vector<float> pred_all_list;
-                    std::vector<int32_t> all_ind_list;
-                    for (int32_t all_ind = std::max(0, max_indices_col[index] - 1); all_ind <= std::min(num_grid_col - 1, max_indices_col[index] + 1); all_ind++) {
-                        pred_all_list.push_back(loc_col[all_ind * num_cls_col * num_lane_col + index]);
-                        all_ind_list.push_back(all_ind);
-                    }
-                    std::vector<float> pred_all_list_softmax(pred_all_list.size());
-                    CommonHelper::SoftMaxFast(pred_all_list.data(), pred_all_list_softmax.data(), pred_all_list.size());
-                    float out_temp = 0;
-                    for (int32_t l = 0; l < pred_all_list.size(); l++) {
-                        out_temp += pred_all_list_softmax[l] * all_ind_list[l];
-                    }
-                    float y = (out_temp + 0.5) / (num_grid_col - 1.0);
-                    float x = col_anchor_[k];
-                    line_list[i].push_back(std::pair<float, float>(x, y));
-                }
-            }
-        }
+    for (int32_t i : { 0, 3 }) {
+        DecodeLane(loc_col, loc_col_dims, exist_col, exist_col_dims, i, loc_col_dims[2] / 8, col_anchor_, false, line_list[i]);
     }
 
     return line_list;
 }
-    
+
 
 
 int32_t LaneEngine::Process(const cv::Mat& original_mat, Result& result)
@@ -318,14 +293,32 @@ int32_t LaneEngine::Process(const cv::Mat& original_mat, Result& result)
 
     /*** PostProcess ***/
     const auto& t_post_process0 = std::chrono::steady_clock::now();
-    std::vector<float> loc_row(output_tensor_info_list_[0].GetDataAsFloat(), output_tensor_info_list_[0].GetDataAsFloat() + output_tensor_info_list_[0].GetElementNum());
-    std::vector<float> loc_col(output_tensor_info_list_[1].GetDataAsFloat(), output_tensor_info_list_[1].GetDataAsFloat() + output_tensor_info_list_[1].GetElementNum());
-    std::vector<float> exist_row(output_tensor_info_list_[2].GetDataAsFloat(), output_tensor_info_list_[2].GetDataAsFloat() + output_tensor_info_list_[2].GetElementNum());
-    std::vector<float> exist_col(output_tensor_info_list_[3].GetDataAsFloat(), output_tensor_info_list_[3].GetDataAsFloat() + output_tensor_info_list_[3].GetElementNum());
-    std::vector<int32_t> loc_row_dims = output_tensor_info_list_[0].tensor_dims;
-    std::vector<int32_t> loc_col_dims = output_tensor_info_list_[1].tensor_dims;
-    std::vector<int32_t> exist_row_dims = output_tensor_info_list_[2].tensor_dims;
-    std::vector<int32_t> exist_col_dims = output_tensor_info_list_[3].tensor_dims;
+    /* Outputs are read in the output buffers directly */
+    for (int32_t i = 0; i < 4; i++) {
+        const auto& dims = output_tensor_info_list_[i].tensor_dims;
+        if (dims.size() != 4 || dims[3] != 4 || output_tensor_info_list_[i].GetElementNum() != dims[0] * dims[1] * dims[2] * dims[3]) {
+            PRINT_E("Unexpected shape of %s\n", output_tensor_info_list_[i].name.c_str());
+            return kRetErr;
+        }
+    }
+    /* exist_xxx must have the same anchors and lanes as loc_xxx, and the anchors must be the same as the model parameters */
+    for (int32_t i = 0; i < 2; i++) {
+        const auto& loc_dims = output_tensor_info_list_[i].tensor_dims;
+        const auto& exist_dims = output_tensor_info_list_[i + 2].tensor_dims;
+        const size_t anchor_num = (i == 0) ? row_anchor_.size() : col_anchor_.size();
+        if (exist_dims[2] != loc_dims[2] || exist_dims[3] != loc_dims[3] || loc_dims[2] != static_cast<int32_t>(anchor_num)) {
+            PRINT_E("Unexpected shape of %s\n", output_tensor_info_list_[i + 2].name.c_str());
+            return kRetErr;
+        }
+    }
+    const float* loc_row = output_tensor_info_list_[0].GetDataAsFloat();
+    const float* loc_col = output_tensor_info_list_[1].GetDataAsFloat();
+    const float* exist_row = output_tensor_info_list_[2].GetDataAsFloat();
+    const float* exist_col = output_tensor_info_list_[3].GetDataAsFloat();
+    const std::vector<int32_t>& loc_row_dims = output_tensor_info_list_[0].tensor_dims;
+    const std::vector<int32_t>& loc_col_dims = output_tensor_info_list_[1].tensor_dims;
+    const std::vector<int32_t>& exist_row_dims = output_tensor_info_list_[2].tensor_dims;
+    const std::vector<int32_t>& exist_col_dims = output_tensor_info_list_[3].tensor_dims;
 
     auto line_list = Pred2Coords(loc_row, loc_row_dims, exist_row, exist_row_dims, loc_col, loc_col_dims, exist_col, exist_col_dims);
 
@@ -25,12 +25,22 @@ limitations under the License.
 #include <chrono>
 #include <fstream>
 
+/* for SIMD. SSE2 is always available on x64, and NEON on aarch64. Otherwise scalar */
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SEG_USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SEG_USE_NEON
+#endif
+
 /* for OpenCV */
 #include <opencv2/opencv.hpp>
 
 /* for My modules */
 #include "common_helper.h"
 #include "common_helper_cv.h"
+#include "anchor_decoder.h"
 #include "inference_helper.h"
 #include "detection_engine.h"
 
@@ -43,7 +53,7 @@ limitations under the License.
 #define MODEL_NAME  "yolopv2_384x640.onnx"
 #define TENSORTYPE  TensorInfo::kTensorTypeFp32
 #define INPUT_NAME  "input"
-#define INPUT_DIMS  { 1, 3, 384, 640 }
+#define INPUT_DIMS  { 1, 3, kInputHeight, kInputWidth }
 #define IS_NCHW     true
 #define IS_RGB      true
 #define OUTPUT_NAME_0 "seg"
@@ -52,16 +62,111 @@ limitations under the License.
 #define OUTPUT_NAME_3 "pred1"
 #define OUTPUT_NAME_4 "pred2"
 
+static constexpr int32_t kInputWidth = 640;
+static constexpr int32_t kInputHeight = 384;
+
+/* reference: https://github.com/CAIC-AD/YOLOPv2/blob/main/utils/utils.py#L170 */
+/* [1,255,48,80] = [1, 3, 85, 48, 80] = [1, 3, (x, y, w, h, prob, prob x80), ny nx] in logit. The score is prob only (class is always Car) */
+typedef AnchorDecoder::Decoder<80, AnchorDecoder::Layout::kChannelMajor, AnchorDecoder::Activation::kSigmoid, AnchorDecoder::BoxEncoding::kGridAnchor, AnchorDecoder::Score::kObjectness> Decoder;
+
 /* from model_105_anchor_grid.npy */
 static constexpr float kAnchorGrid8[3][2] = { { 12, 16 }, { 19, 36 }, { 40, 28 } };
 static constexpr float kAnchorGrid16[3][2] = { { 36, 75 }, { 76, 55 }, { 72, 146 } };
 static constexpr float kAnchorGrid32[3][2] = { { 142, 110 }, { 192, 243 }, { 459, 401 } };
 
+/* Decoder of each head (pred0, pred1, pred2), specialized with the stride. The heads are decoded in parallel */
+template <int32_t kStride>
+static void DecodeHead(const float* data, const AnchorDecoder::Param& param, std::vector<BoundingBox>& bbox_list)
+{
+    static constexpr const float (*kAnchorGrid)[2] = (kStride == 8) ? kAnchorGrid8 : (kStride == 16) ? kAnchorGrid16 : kAnchorGrid32;
+    Decoder::Decode<kStride, kInputWidth / kStride, kInputHeight / kStride, 3>(data, param, kAnchorGrid, bbox_list);
+}
+
+typedef void (*DecodeHeadFunc)(const float* data, const AnchorDecoder::Param& param, std::vector<BoundingBox>& bbox_list);
+static constexpr int32_t kHeadNum = 3;
+static constexpr DecodeHeadFunc kDecodeHeadList[kHeadNum] = { DecodeHead<8>, DecodeHead<16>, DecodeHead<32> };
+static constexpr int32_t kHeadElementNumList[kHeadNum] = {
+    3 * Decoder::kElementNum * (kInputWidth / 8) * (kInputHeight / 8),
+    3 * Decoder::kElementNum * (kInputWidth / 16) * (kInputHeight / 16),
+    3 * Decoder::kElementNum * (kInputWidth / 32) * (kInputHeight / 32),
+};
+
 static const std::vector<std::string> kLabelListDet{ "Car" };
 static const std::vector<std::string> kLabelListSeg{ "Background", "Road", "Line" };
 
 
 /*** Function ***/
+/* Segmentation label of each pixel in a row: 1 (Road) if the drivable area score > max(background score, 0), then 2 (Line) if the lane line score > threshold_ll, otherwise 0 (Background).
+ * Every step-th pixel of the input row is used for the output of width pixels. The number of pixels of each label is added to pixel_num */
+static void ConvertSegRow(const float* seg_bg, const float* seg_road, const float* ll, int32_t width, int32_t step, float threshold_ll, uint8_t* dst, int32_t pixel_num[3])
+{
+    int32_t x = 0;
+    int32_t num_road = 0;
+    int32_t num_line = 0;
+#if defined(SEG_USE_SSE2)
+    auto load = [step](const float* p) { return (step == 1) ? _mm_loadu_ps(p) : _mm_set_ps(p[3 * step], p[2 * step], p[step], p[0]); };
+    const __m128 v_zero = _mm_setzero_ps();
+    const __m128 v_threshold_ll = _mm_set1_ps(threshold_ll);
+    const __m128i v_one = _mm_set1_epi32(1);
+    const __m128i v_two = _mm_set1_epi32(2);
+    __m128i v_num_road = _mm_setzero_si128();
+    __m128i v_num_line = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+        const int32_t offset = x * step;
+        const __m128i is_road = _mm_castps_si128(_mm_cmpgt_ps(load(seg_road + offset), _mm_max_ps(load(seg_bg + offset), v_zero)));
+        const __m128i is_line = _mm_castps_si128(_mm_cmpgt_ps(load(ll + offset), v_threshold_ll));
+        const __m128i is_road_only = _mm_andnot_si128(is_line, is_road);
+        const __m128i label = _mm_or_si128(_mm_and_si128(is_line, v_two), _mm_and_si128(is_road_only, v_one));
+        const __m128i label_u8 = _mm_packus_epi16(_mm_packs_epi32(label, label), _mm_setzero_si128());
+        const int32_t label4 = _mm_cvtsi128_si32(label_u8);
+        std::memcpy(dst + x, &label4, 4);
+        v_num_road = _mm_sub_epi32(v_num_road, is_road_only);   /* mask is -1 */
+        v_num_line = _mm_sub_epi32(v_num_line, is_line);
+    }
+    int32_t num_list[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(num_list), v_num_road);
+    num_road += num_list[0] + num_list[1] + num_list[2] + num_list[3];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(num_list), v_num_line);
+    num_line += num_list[0] + num_list[1] + num_list[2] + num_list[3];
+#elif defined(SEG_USE_NEON)
+    auto load = [step](const float* p) {
+        if (step == 1) return vld1q_f32(p);
+        float32x4_t v = vdupq_n_f32(p[0]);
+        v = vld1q_lane_f32(p + step, v, 1);
+        v = vld1q_lane_f32(p + 2 * step, v, 2);
+        return vld1q_lane_f32(p + 3 * step, v, 3);
+    };
+    const float32x4_t v_zero = vdupq_n_f32(0);
+    const float32x4_t v_threshold_ll = vdupq_n_f32(threshold_ll);
+    uint32x4_t v_num_road = vdupq_n_u32(0);
+    uint32x4_t v_num_line = vdupq_n_u32(0);
+    for (; x + 4 <= width; x += 4) {
+        const int32_t offset = x * step;
+        const uint32x4_t is_road = vcgtq_f32(load(seg_road + offset), vmaxq_f32(load(seg_bg + offset), v_zero));
+        const uint32x4_t is_line = vcgtq_f32(load(ll + offset), v_threshold_ll);
+        const uint32x4_t is_road_only = vbicq_u32(is_road, is_line);
+        const uint32x4_t label = vorrq_u32(vandq_u32(is_line, vdupq_n_u32(2)), vandq_u32(is_road_only, vdupq_n_u32(1)));
+        const uint8x8_t label_u8 = vmovn_u16(vcombine_u16(vmovn_u32(label), vdup_n_u16(0)));
+        vst1_lane_u32(reinterpret_cast<uint32_t*>(dst + x), vreinterpret_u32_u8(label_u8), 0);
+        v_num_road = vsubq_u32(v_num_road, is_road_only);       /* mask is 0xFFFFFFFF */
+        v_num_line = vsubq_u32(v_num_line, is_line);
+    }
+    num_road += static_cast<int32_t>(vaddvq_u32(v_num_road));
+    num_line += static_cast<int32_t>(vaddvq_u32(v_num_line));
+#endif
+    for (; x < width; x++) {
+        const int32_t offset = x * step;
+        uint8_t label = (seg_road[offset] > (std::max)(seg_bg[offset], 0.0f)) ? 1 : 0;
+        if (ll[offset] > threshold_ll) label = 2;
+        dst[x] = label;
+        if (label == 1) num_road++;
+        if (label == 2) num_line++;
+    }
+    pixel_num[0] += width - num_road - num_line;
+    pixel_num[1] += num_road;
+    pixel_num[2] += num_line;
+}
+
 int32_t DetectionEngine::Initialize(const std::string& work_dir, const int32_t num_threads)
 {
     /* Set model information */
@@ -118,49 +223,18 @@ int32_t DetectionEngine::Finalize()
     return kRetOk;
 }
 
-/* reference: https://github.com/CAIC-AD/YOLOPv2/blob/main/utils/utils.py#L170 */
-/* [1,255,48,80] = [1, 3, 85, 48, 80] = [1, 3, (x, y, w, h, prob, prob x80), ny nx] */
-std::vector<BoundingBox> DetectionEngine::GetBoundingBox(std::vector<float> pred, int32_t input_width, int32_t input_height, int32_t st, const float anchor_grid[3][2], float scale_w, float scale_h)
+int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
 {
-    std::vector<BoundingBox> bbox_list;
-    size_t nx = input_width / st;
-    size_t ny = input_height / st;
-    for (size_t n = 0; n < 3; n++) {
-        size_t offset_n = n * 85 * ny * nx;
-        for (size_t y = 0; y < ny; y++) {
-            for (size_t x = 0; x < nx; x++) {
-                size_t offset_xy = x + y * nx;
-                size_t index_prob = offset_n + 4 * ny * nx + offset_xy;
-                float prob = CommonHelper::Sigmoid(pred[index_prob]);
-                if (prob > threshold_class_confidence_) {
-                    size_t index_x = offset_n + 0 * ny * nx + offset_xy;
-                    size_t index_y = offset_n + 1 * ny * nx + offset_xy;
-                    size_t index_w = offset_n + 2 * ny * nx + offset_xy;
-                    size_t index_h = offset_n + 3 * ny * nx + offset_xy;
-                    float cx = (CommonHelper::Sigmoid(pred[index_x]) * 2 - 0.5 + x) * st;
-                    float cy = (CommonHelper::Sigmoid(pred[index_y]) * 2 - 0.5 + y) * st;
-                    float w = std::pow(CommonHelper::Sigmoid(pred[index_w]) * 2, 2) * anchor_grid[n][0];
-                    float h = std::pow(CommonHelper::Sigmoid(pred[index_h]) * 2, 2) * anchor_grid[n][1];
-
-                    /* Store the detected box */
-                    auto bbox = BoundingBox{
-                        static_cast<int32_t>(0),
-                        kLabelListDet[0],
-                        prob,
-                        static_cast<int32_t>((cx - w / 2.0) * scale_w),
-                        static_cast<int32_t>((cy - h / 2.0) * scale_h),
-                        static_cast<int32_t>(w * scale_w),
-                        static_cast<int32_t>(h * scale_h)
-                    };
-                    bbox_list.push_back(bbox);
-                }
-            }
-        }
-    }
-    return bbox_list;
+    if (ProcessInference(original_mat, result) != kRetOk) return kRetErr;
+    const auto& t_post_process0 = std::chrono::steady_clock::now();
+    if (PostProcessSegmentation(result) != kRetOk) return kRetErr;
+    if (PostProcessDetection(result) != kRetOk) return kRetErr;
+    const auto& t_post_process1 = std::chrono::steady_clock::now();
+    result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;
+    return kRetOk;
 }
 
-int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
+int32_t DetectionEngine::ProcessInference(const cv::Mat& original_mat, Result& result)
 {
     if (!inference_helper_) {
         PRINT_E("Inference helper is not created\n");
@@ -202,71 +276,89 @@ int32_t DetectionEngine::Process(const cv::Mat& original_mat, Result& result)
     }
     const auto& t_inference1 = std::chrono::steady_clock::now();
 
-    /*** PostProcess ***/
-    const auto& t_post_process0 = std::chrono::steady_clock::now();
-    /* Retrieve the result */
-    std::vector<float> output_seg_list(output_tensor_info_list_[0].GetDataAsFloat(), output_tensor_info_list_[0].GetDataAsFloat() + output_tensor_info_list_[0].GetElementNum());
-    std::vector<float> output_ll_list(output_tensor_info_list_[1].GetDataAsFloat(), output_tensor_info_list_[1].GetDataAsFloat() + output_tensor_info_list_[1].GetElementNum());
-    std::vector<float> output_pred0_list(output_tensor_info_list_[2].GetDataAsFloat(), output_tensor_info_list_[2].GetDataAsFloat() + output_tensor_info_list_[2].GetElementNum());
-    std::vector<float> output_pred1_list(output_tensor_info_list_[3].GetDataAsFloat(), output_tensor_info_list_[3].GetDataAsFloat() + output_tensor_info_list_[3].GetElementNum());
-    std::vector<float> output_pred2_list(output_tensor_info_list_[4].GetDataAsFloat(), output_tensor_info_list_[4].GetDataAsFloat() + output_tensor_info_list_[4].GetElementNum());
-
-    /* Get Segmentation result. ArgMax */
-    cv::Mat mat_seg_max = cv::Mat::zeros(input_tensor_info.GetHeight(), input_tensor_info.GetWidth(), CV_8UC1);
-#pragma omp parallel for
-    for (int32_t y = 0; y < input_tensor_info.GetHeight(); y++) {
-        for (int32_t x = 0; x < input_tensor_info.GetWidth(); x++) {
-            int32_t class_index_max = 0;
-            float class_score_max = 0;
-            for (int32_t class_index = 0; class_index < 2; class_index++) {
-                float score = output_seg_list[class_index * input_tensor_info.GetHeight() * input_tensor_info.GetWidth() + input_tensor_info.GetWidth() * y + x];
-                if (score > class_score_max) {
-                    class_score_max = score;
-                    class_index_max = class_index;
-                }
-            }
-            /* Overwrite if ll score is high */
-            float score_ll = output_ll_list[input_tensor_info.GetWidth() * y + x];
-            if (score_ll > threshold_seg_ll_) {
-                class_index_max = 2;    /* 2 = line */
-            }
-            mat_seg_max.at<uint8_t>(cv::Point(x, y)) = static_cast<uint8_t>(class_index_max);
+    /* Return the results */
+    result.crop.x = (std::max)(0, crop_x);
+    result.crop.y = (std::max)(0, crop_y);
+    result.crop.w = (std::min)(crop_w, original_mat.cols - result.crop.x);
+    result.crop.h = (std::min)(crop_h, original_mat.rows - result.crop.y);
+    result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
+    result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
+
+    return kRetOk;
+}
+
+int32_t DetectionEngine::PostProcessSegmentation(Result& result)
+{
+    /* Get Segmentation result. ArgMax of drivable area (2 planes) and lane line (1 plane) into labels, at 1/seg_scale_ size */
+    const int32_t seg_width = kInputWidth / seg_scale_;
+    const int32_t seg_height = kInputHeight / seg_scale_;
+    if (output_tensor_info_list_[0].GetElementNum() != 2 * kInputWidth * kInputHeight || output_tensor_info_list_[1].GetElementNum() != kInputWidth * kInputHeight) {
+        PRINT_E("Unexpected size of segmentation output\n");
+        return kRetErr;
+    }
+    const float* output_seg = output_tensor_info_list_[0].GetDataAsFloat();
+    const float* output_ll = output_tensor_info_list_[1].GetDataAsFloat();
+    cv::Mat mat_seg_max = cv::Mat(seg_height, seg_width, CV_8UC1);
+    int32_t seg_pixel_num_0 = 0;
+    int32_t seg_pixel_num_1 = 0;
+    int32_t seg_pixel_num_2 = 0;
+#pragma omp parallel for reduction(+:seg_pixel_num_0, seg_pixel_num_1, seg_pixel_num_2)
+    for (int32_t y = 0; y < seg_height; y++) {
+        const int32_t offset = y * seg_scale_ * kInputWidth;
+        int32_t pixel_num[3] = { 0, 0, 0 };
+        ConvertSegRow(output_seg + offset, output_seg + kInputWidth * kInputHeight + offset, output_ll + offset, seg_width, seg_scale_, threshold_seg_ll_, mat_seg_max.ptr<uint8_t>(y), pixel_num);
+        seg_pixel_num_0 += pixel_num[0];
+        seg_pixel_num_1 += pixel_num[1];
+        seg_pixel_num_2 += pixel_num[2];
+    }
+
+    /* Return the results */
+    result.mat_seg_max = mat_seg_max;
+    result.seg_pixel_num[0] = seg_pixel_num_0;
+    result.seg_pixel_num[1] = seg_pixel_num_1;
+    result.seg_pixel_num[2] = seg_pixel_num_2;
+
+    return kRetOk;
+}
+
+int32_t DetectionEngine::PostProcessDetection(Result& result)
+{
+    /* Detection heads are read in the output buffers directly */
+    for (int32_t i = 0; i < kHeadNum; i++) {
+        if (output_tensor_info_list_[2 + i].GetElementNum() != kHeadElementNumList[i]) {
+            PRINT_E("Unexpected size of %s: %d\n", output_tensor_info_list_[2 + i].name.c_str(), output_tensor_info_list_[2 + i].GetElementNum());
+            return kRetErr;
         }
     }
 
     /* Get boundig box */
     std::vector<BoundingBox> bbox_list;
-    float scale_w = static_cast<float>(crop_w) / input_tensor_info.GetWidth();
-    float scale_h = static_cast<float>(crop_h) / input_tensor_info.GetHeight();
-    auto bbox_list_8 = GetBoundingBox(output_pred0_list, input_tensor_info.GetWidth(), input_tensor_info.GetHeight(), 8, kAnchorGrid8, scale_w, scale_h);
-    auto bbox_list_16 = GetBoundingBox(output_pred1_list, input_tensor_info.GetWidth(), input_tensor_info.GetHeight(), 16, kAnchorGrid16, scale_w, scale_h);
-    auto bbox_list_32 = GetBoundingBox(output_pred2_list, input_tensor_info.GetWidth(), input_tensor_info.GetHeight(), 32, kAnchorGrid32, scale_w, scale_h);
-    bbox_list.insert(bbox_list.end(), bbox_list_8.begin(), bbox_list_8.end());
-    bbox_list.insert(bbox_list.end(), bbox_list_16.begin(), bbox_list_16.end());
-    bbox_list.insert(bbox_list.end(), bbox_list_32.begin(), bbox_list_32.end());
+    AnchorDecoder::Param param;
+    param.threshold_objectness = threshold_class_confidence_;
+    param.scale_x = static_cast<float>(result.crop.w) / kInputWidth;
+    param.scale_y = static_cast<float>(result.crop.h) / kInputHeight;
+    std::array<std::vector<BoundingBox>, kHeadNum> bbox_list_of_head;
+#pragma omp parallel for
+    for (int32_t i = 0; i < kHeadNum; i++) {
+        kDecodeHeadList[i](output_tensor_info_list_[2 + i].GetDataAsFloat(), param, bbox_list_of_head[i]);
+    }
+    for (const auto& bbox_list_part : bbox_list_of_head) {
+        bbox_list.insert(bbox_list.end(), bbox_list_part.begin(), bbox_list_part.end());
+    }
 
     /* Adjust bounding box */
     for (auto& bbox : bbox_list) {
-        bbox.x += crop_x;  
-        bbox.y += crop_y;
+        bbox.x += result.crop.x;
+        bbox.y += result.crop.y;
+        bbox.label = kLabelListDet[bbox.class_id];
     }
 
     /* NMS */
     std::vector<BoundingBox> bbox_nms_list;
     BoundingBoxUtils::Nms(bbox_list, bbox_nms_list, threshold_nms_iou_);
 
-    const auto& t_post_process1 = std::chrono::steady_clock::now();
-
     /* Return the results */
-    result.mat_seg_max = mat_seg_max;
     result.bbox_list = bbox_nms_list;
-    result.crop.x = (std::max)(0, crop_x);
-    result.crop.y = (std::max)(0, crop_y);
-    result.crop.w = (std::min)(crop_w, original_mat.cols - result.crop.x);
-    result.crop.h = (std::min)(crop_h, original_mat.rows - result.crop.y);
-    result.time_pre_process = static_cast<std::chrono::duration<double>>(t_pre_process1 - t_pre_process0).count() * 1000.0;
-    result.time_inference = static_cast<std::chrono::duration<double>>(t_inference1 - t_inference0).count() * 1000.0;
-    result.time_post_process = static_cast<std::chrono::duration<double>>(t_post_process1 - t_post_process0).count() * 1000.0;;
 
     return kRetOk;
 }
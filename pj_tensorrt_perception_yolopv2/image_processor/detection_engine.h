@@ -39,7 +39,8 @@ public:
     };
 
     typedef struct Result_ {
-        cv::Mat                  mat_seg_max;          // [height, width, 1]. value is 0 - 2  (uint8_t)
+        cv::Mat                  mat_seg_max;          // [height, width, 1]. value is 0 - 2  (uint8_t). 1/seg_scale of the input size
+        std::array<int32_t, 3>   seg_pixel_num;        // number of pixels of each value in mat_seg_max
         std::vector<BoundingBox> bbox_list;
         struct crop_ {
             int32_t x;
@@ -51,7 +52,7 @@ public:
         double                   time_pre_process;		// [msec]
         double                   time_inference;		// [msec]
         double                   time_post_process;	    // [msec]
-        Result_() : time_pre_process(0), time_inference(0), time_post_process(0)
+        Result_() : seg_pixel_num(), time_pre_process(0), time_inference(0), time_post_process(0)
         {}
     } Result;
 
@@ -60,14 +61,18 @@ public:
         threshold_class_confidence_ = threshold_class_confidence;
         threshold_nms_iou_ = threshold_nms_iou;
         threshold_seg_ll_ = threshold_seg_ll;
+        seg_scale_ = 1;
     }
     ~DetectionEngine() {}
     int32_t Initialize(const std::string& work_dir, const int32_t num_threads);
     int32_t Finalize(void);
     int32_t Process(const cv::Mat& original_mat, Result& result);
-
-private:
-    std::vector<BoundingBox> GetBoundingBox(std::vector<float> pred, int32_t input_width, int32_t input_height, int32_t st, const float anchor_grid[3][2], float scale_w, float scale_h);
+    /* Process = ProcessInference + PostProcessSegmentation + PostProcessDetection */
+    /* The two post processes read different outputs and write different members of result, so they can run concurrently after ProcessInference */
+    int32_t ProcessInference(const cv::Mat& original_mat, Result& result);
+    int32_t PostProcessSegmentation(Result& result);
+    int32_t PostProcessDetection(Result& result);
+    void SetSegScale(int32_t seg_scale) { seg_scale_ = (seg_scale == 2 || seg_scale == 4) ? seg_scale : 1; }     /* output segmentation at 1/seg_scale size (nearest) */
 
 private:
     std::unique_ptr<InferenceHelper> inference_helper_;
@@ -77,6 +82,7 @@ private:
     float threshold_class_confidence_;
     float threshold_nms_iou_;
     float threshold_seg_ll_;
+    int32_t seg_scale_;
 };
 
 #endif
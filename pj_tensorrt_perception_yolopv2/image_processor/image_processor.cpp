@@ -18,6 +18,7 @@ limitations under the License.
 #include <cstdlib>
 #include <cmath>
 #include <cstring>
+#include <climits>
 #include <string>
 #include <vector>
 #include <array>
@@ -36,6 +37,7 @@ limitations under the License.
 #include "bounding_box.h"
 #include "detection_engine.h"
 #include "tracker.h"
+#include "task_graph.h"
 #include "image_processor.h"
 
 /*** Macro ***/
@@ -43,23 +45,48 @@ limitations under the License.
 #define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
-/*** Global variable ***/
-std::unique_ptr<DetectionEngine> s_engine;
-Tracker s_tracker;
-CommonHelper::NiceColorGenerator s_nice_color_generator;
+/*** Type ***/
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<DetectionEngine> engine;
+    Tracker tracker;
+    CommonHelper::NiceColorGenerator nice_color_generator;
+
+    /* For top view transform */
+    bool is_initialized_transform_mat;
+    CameraModel camera_real;
+    CameraModel camera_top;
+    cv::Mat mat_transform_topview;
+    cv::Size size_topview;
+    cv::Mat mat_topview_map;                  /* CV_16SC2. source pixel of each top view pixel (nearest), made from mat_transform_topview */
+    cv::Mat mat_topview_overlay;              /* grid lines and labels on top view, drawn once */
+    cv::Mat mat_topview_overlay_mask;         /* CV_8UC1. non zero where mat_topview_overlay is drawn */
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    /* Post process runs as two branches (segmentation, detection -> tracking) concurrently, and joins in Process */
+    std::unique_ptr<TaskGraph> task_graph;
+    cv::Mat* mat;                             /* the frame being processed. valid only during Process */
+    DetectionEngine::Result det_result;
+    cv::Mat mat_masked;
+    cv::Mat mat_topview;
+    int32_t ret_seg;
+    int32_t ret_det;
+    double time_post_process_seg;
+    double time_post_process_det;
 
-/* For top view transform */
-static CameraModel s_camera_real;
-static CameraModel s_camera_top;
-static cv::Mat s_mat_transform_topview;
-#define COLOR_BG  CommonHelper::CreateCvColor(70, 70, 70)
-static cv::Size s_size_topview;
+    Context() : is_initialized_transform_mat(false), time_previous(std::chrono::steady_clock::now()), mat(nullptr), ret_seg(0), ret_det(0), time_post_process_seg(0), time_post_process_det(0) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void CreateTaskGraph(ImageProcessor::Context* context);
+
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -67,60 +94,127 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
     CommonHelper::DrawText(mat, text, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 }
 
-int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
 {
-    if (s_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
+    std::unique_ptr<Context> context(new Context());
+    context->engine.reset(new DetectionEngine());
+    context->engine->SetSegScale(input_param.seg_scale);
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
     }
+    CreateTaskGraph(context.get());
+    return context.release();
+}
 
-    s_engine.reset(new DetectionEngine());
-    if (s_engine->Initialize(input_param.work_dir, input_param.num_threads) != DetectionEngine::kRetOk) {
-        s_engine->Finalize();
-        s_engine.reset();
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
-    return 0;
+
+    int32_t ret = 0;
+    if (context->engine->Finalize() != DetectionEngine::kRetOk) {
+        ret = -1;
+    }
+    delete context;
+    return ret;
 }
 
-int32_t ImageProcessor::Finalize(void)
+
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
-    if (s_engine->Finalize() != DetectionEngine::kRetOk) {
+    switch (cmd) {
+    case 0:
+    default:
+        PRINT_E("command(%d) is not supported\n", cmd);
         return -1;
     }
+}
 
-    return 0;
+
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
+{
+    if (s_context) {
+        PRINT_E("Already initialized\n");
+        return -1;
+    }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
 }
 
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
+        return -1;
+    }
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
+}
 
 int32_t ImageProcessor::Command(int32_t cmd)
 {
-    if (!s_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    return Command(s_context, cmd);
+}
 
-    switch (cmd) {
-    case 0:
-    default:
-        PRINT_E("command(%d) is not supported\n", cmd);
+int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
         return -1;
     }
+    return Process(s_context, mat, result);
+}
+
+static void CreateTopViewMat(ImageProcessor::Context* context, const cv::Mat& mat_original, cv::Mat& mat_topview)
+{
+    /* Perspective Transform using the precomputed map. Same as cv::warpPerspective(mat_original, mat_topview, context->mat_transform_topview, size, cv::INTER_NEAREST) */
+    cv::remap(mat_original, mat_topview, context->mat_topview_map, cv::Mat(), cv::INTER_NEAREST);
+
+    /* Put grid lines */
+    context->mat_topview_overlay.copyTo(mat_topview, context->mat_topview_overlay_mask);
+}
+
+static void CreateTopViewMap(ImageProcessor::Context* context)
+{
+    /* The same calculation as cv::warpPerspective with cv::INTER_NEAREST. Coordinate out of the source image is filled with 0 by cv::remap */
+    cv::Mat mat_inv;
+    cv::invert(context->mat_transform_topview, mat_inv);
+    const double* m = mat_inv.ptr<double>();
+    context->mat_topview_map = cv::Mat(context->size_topview, CV_16SC2);
+    for (int32_t y = 0; y < context->size_topview.height; y++) {
+        int16_t* map = context->mat_topview_map.ptr<int16_t>(y);
+        for (int32_t x = 0; x < context->size_topview.width; x++) {
+            double w = m[6] * x + m[7] * y + m[8];
+            w = w ? 1.0 / w : 0;
+            const double fx = (std::max)(static_cast<double>(INT_MIN), (std::min)(static_cast<double>(INT_MAX), (m[0] * x + m[1] * y + m[2]) * w));
+            const double fy = (std::max)(static_cast<double>(INT_MIN), (std::min)(static_cast<double>(INT_MAX), (m[3] * x + m[4] * y + m[5]) * w));
+            map[x * 2 + 0] = cv::saturate_cast<int16_t>(cv::saturate_cast<int32_t>(fx));
+            map[x * 2 + 1] = cv::saturate_cast<int16_t>(cv::saturate_cast<int32_t>(fy));
+        }
+    }
 }
 
-static void CreateTopViewMat(const cv::Mat& mat_original, cv::Mat& mat_topview)
+static void CreateTopViewOverlay(ImageProcessor::Context* context)
 {
-    /* Perspective Transform */
-    mat_topview = cv::Mat(cv::Size(s_camera_top.width, s_camera_top.height), CV_8UC3, COLOR_BG);
-    //cv::warpPerspective(mat_original, mat_topview, s_mat_transform_topview, mat_topview.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
-    cv::warpPerspective(mat_original, mat_topview, s_mat_transform_topview, mat_topview.size(), cv::INTER_NEAREST);
+    /* Draw on black, then use drawn pixels as mask. Drawing doesn't use anti-aliasing, so copying with the mask is the same as drawing on each frame */
+    context->mat_topview_overlay = cv::Mat::zeros(context->size_topview, CV_8UC3);
+    context->mat_topview_overlay_mask = cv::Mat::zeros(context->size_topview, CV_8UC1);
+    cv::Mat& mat_overlay = context->mat_topview_overlay;
+    cv::Mat& mat_mask = context->mat_topview_overlay_mask;
 
-#if 1
     /* Display Grid lines */
     static constexpr int32_t kDepthInterval = 5;
     static constexpr int32_t kHorizontalRange = 10;
@@ -130,28 +224,30 @@ static void CreateTopViewMat(const cv::Mat& mat_original, cv::Mat& mat_topview)
         object_point_list.push_back(cv::Point3f(kHorizontalRange, 0, z));
     }
     std::vector<cv::Point2f> image_point_list;
-    cv::projectPoints(object_point_list, s_camera_top.rvec, s_camera_top.tvec, s_camera_top.K, s_camera_top.dist_coeff, image_point_list);
+    cv::projectPoints(object_point_list, context->camera_top.rvec, context->camera_top.tvec, context->camera_top.K, context->camera_top.dist_coeff, image_point_list);
     for (int32_t i = 0; i < static_cast<int32_t>(image_point_list.size()); i++) {
         if (i % 2 != 0) {
-            cv::line(mat_topview, image_point_list[i - 1], image_point_list[i], cv::Scalar(255, 255, 255));
+            cv::line(mat_overlay, image_point_list[i - 1], image_point_list[i], cv::Scalar(255, 255, 255));
+            cv::line(mat_mask, image_point_list[i - 1], image_point_list[i], cv::Scalar(255));
         } else {
-            CommonHelper::DrawText(mat_topview, std::to_string(i / 2 * kDepthInterval) + "[m]", image_point_list[i], 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(255, 255, 255), false);
+            const std::string text = std::to_string(i / 2 * kDepthInterval) + "[m]";
+            CommonHelper::DrawText(mat_overlay, text, image_point_list[i], 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(255, 255, 255), false);
+            CommonHelper::DrawText(mat_mask, text, image_point_list[i], 0.5, 2, cv::Scalar(255), cv::Scalar(255), false);
         }
     }
-#endif
 }
 
-static void CreateTransformMat(int32_t width, int32_t height, float fov_deg)
+static void CreateTransformMat(ImageProcessor::Context* context, int32_t width, int32_t height, float fov_deg)
 {
     /*** Set camera parameters ***/
-    s_size_topview.width = width / 4;
-    s_size_topview.height = height;
-    s_camera_real.SetIntrinsic(width, height, FocalLength(width, fov_deg));
-    s_camera_top.SetIntrinsic(s_size_topview.width, s_size_topview.height, FocalLength(s_size_topview.width, fov_deg));
-    s_camera_real.SetExtrinsic(
+    context->size_topview.width = width / 4;
+    context->size_topview.height = height;
+    context->camera_real.SetIntrinsic(width, height, FocalLength(width, fov_deg));
+    context->camera_top.SetIntrinsic(context->size_topview.width, context->size_topview.height, FocalLength(context->size_topview.width, fov_deg));
+    context->camera_real.SetExtrinsic(
         { 0.0f, 0.0f, 0.0f },    /* rvec [deg] */
         { 0.0f, -1.5f, 0.0f }, true);   /* tvec (Oc - Ow in world coordinate. X+= Right, Y+ = down, Z+ = far) */
-    s_camera_top.SetExtrinsic(
+    context->camera_top.SetExtrinsic(
         { 90.0f, 0.0f, 0.0f },    /* rvec [deg] */
         { 0.0f, -8.0f, 17.0f }, true);   /* tvec (Oc - Ow in world coordinate. X+= Right, Y+ = down, Z+ = far) */
 
@@ -163,41 +259,36 @@ static void CreateTransformMat(int32_t width, int32_t height, float fov_deg)
         {  1.0f, 0,  3.0f },
     };
     std::vector<cv::Point2f> image_point_real_list;
-    cv::projectPoints(object_point_list, s_camera_real.rvec, s_camera_real.tvec, s_camera_real.K, s_camera_real.dist_coeff, image_point_real_list);
+    cv::projectPoints(object_point_list, context->camera_real.rvec, context->camera_real.tvec, context->camera_real.K, context->camera_real.dist_coeff, image_point_real_list);
 
     /* Convert to image points (2D) using the top view camera (virtual camera) */
     std::vector<cv::Point2f> image_point_top_list;
-    cv::projectPoints(object_point_list, s_camera_top.rvec, s_camera_top.tvec, s_camera_top.K, s_camera_top.dist_coeff, image_point_top_list);
+    cv::projectPoints(object_point_list, context->camera_top.rvec, context->camera_top.tvec, context->camera_top.K, context->camera_top.dist_coeff, image_point_top_list);
+
+    context->mat_transform_topview = cv::getPerspectiveTransform(&image_point_real_list[0], &image_point_top_list[0]);
 
-    s_mat_transform_topview = cv::getPerspectiveTransform(&image_point_real_list[0], &image_point_top_list[0]);
+    /*** The transform and the top view camera are fixed from now on, so prepare everything for the top view here ***/
+    CreateTopViewMap(context);
+    CreateTopViewOverlay(context);
 }
 
 
-int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
+/* Segmentation branch: labels -> colored overlay and top view. Reads and writes only context->mat, mat_masked, mat_topview and the segmentation part of det_result */
+static void RunSegmentationBranch(ImageProcessor::Context* context)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
-        return -1;
-    }
+    const auto& t0 = std::chrono::steady_clock::now();
+    context->ret_seg = (context->engine->PostProcessSegmentation(context->det_result) == DetectionEngine::kRetOk) ? 0 : -1;
+    context->time_post_process_seg = static_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - t0).count() * 1000.0;
+    if (context->ret_seg != 0) return;
 
-    /*** Initialize camera parameters for input image size ***/
-    static bool s_is_initialize_transform_mat = false;
-    if (!s_is_initialize_transform_mat) {
-        s_is_initialize_transform_mat = true;
-        CreateTransformMat(mat.cols, mat.rows, 80);
-    }
-
-    /*** Call inference ***/
-    DetectionEngine::Result det_result;
-    if (s_engine->Process(mat, det_result) != DetectionEngine::kRetOk) {
-        return -1;
-    }
+    cv::Mat& mat = *context->mat;
+    const DetectionEngine::Result& det_result = context->det_result;
 
     /*** Draw target area  ***/
     cv::rectangle(mat, cv::Rect(det_result.crop.x, det_result.crop.y, det_result.crop.w, det_result.crop.h), CommonHelper::CreateCvColor(0, 0, 0), 2);
 
     /*** Draw segmentation image for the class of the highest score ***/
-    cv::Mat& mat_seg_max = det_result.mat_seg_max;
+    cv::Mat mat_seg_max = det_result.mat_seg_max;
     cv::Mat mat_seg_max_list[] = { mat_seg_max, mat_seg_max, mat_seg_max };
     cv::merge(mat_seg_max_list, 3, mat_seg_max);
     cv::Mat mat_lut = cv::Mat::zeros(256, 1, CV_8UC3);
@@ -206,11 +297,62 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     mat_lut.at<cv::Vec3b>(2) = cv::Vec3b(0, 0, 255);
     cv::LUT(mat_seg_max, mat_lut, mat_seg_max);
     cv::resize(mat_seg_max, mat_seg_max, mat.size(), 0.0, 0.0, cv::INTER_NEAREST);
-    cv::Mat mat_masked;
-    cv::addWeighted(mat, 0.8, mat_seg_max, 0.5, 0, mat_masked);
+    cv::addWeighted(mat, 0.8, mat_seg_max, 0.5, 0, context->mat_masked);
     //cv::add(mat_seg_max * kResultMixRatio, mat * (1.0f - kResultMixRatio), mat_masked);
     //cv::hconcat(mat, mat_masked, mat);
-    mat = mat_masked;
+
+    /*** Create top view ***/
+    CreateTopViewMat(context, mat_seg_max, context->mat_topview);
+}
+
+/* Detection branch: decode -> NMS -> tracking. Reads and writes only the tracker and the detection part of det_result */
+static void RunDetectionBranch(ImageProcessor::Context* context)
+{
+    const auto& t0 = std::chrono::steady_clock::now();
+    context->ret_det = (context->engine->PostProcessDetection(context->det_result) == DetectionEngine::kRetOk) ? 0 : -1;
+    context->time_post_process_det = static_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - t0).count() * 1000.0;
+    if (context->ret_det != 0) return;
+
+    context->tracker.Update(context->det_result.bbox_list);
+}
+
+static void CreateTaskGraph(ImageProcessor::Context* context)
+{
+    /* The caller of Run executes one branch and the worker thread executes the other */
+    context->task_graph.reset(new TaskGraph(1));
+    context->task_graph->AddTask([context]() { RunSegmentationBranch(context); });
+    context->task_graph->AddTask([context]() { RunDetectionBranch(context); });
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    /*** Initialize camera parameters for input image size ***/
+    if (!context->is_initialized_transform_mat) {
+        context->is_initialized_transform_mat = true;
+        CreateTransformMat(context, mat.cols, mat.rows, 80);
+    }
+
+    /*** Call inference ***/
+    context->mat = &mat;
+    context->det_result = DetectionEngine::Result();
+    if (context->engine->ProcessInference(mat, context->det_result) != DetectionEngine::kRetOk) {
+        return -1;
+    }
+
+    /*** Run segmentation branch and detection branch concurrently ***/
+    context->task_graph->Run();
+    context->mat = nullptr;
+    if (context->ret_seg != 0 || context->ret_det != 0) {
+        return -1;
+    }
+    const DetectionEngine::Result& det_result = context->det_result;
+    mat = context->mat_masked;
+    context->mat_masked.release();      /* don't share the buffer with the caller's mat at the next frame */
 
     /*** Draw detection result (black rectangle) ***/
     int32_t num_det = 0;
@@ -220,14 +362,13 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     }
 
     /*** Draw tracking result ***/
-    s_tracker.Update(det_result.bbox_list);
     int32_t num_track = 0;
-    auto& track_list = s_tracker.GetTrackList();
+    auto& track_list = context->tracker.GetTrackList();
     for (auto& track : track_list) {
         if (track.GetDetectedCount() < 2) continue;
         const auto& bbox = track.GetLatestData().bbox;
         /* Use white rectangle for the object which was not detected but just predicted */
-        cv::Scalar color = bbox.score == 0 ? CommonHelper::CreateCvColor(255, 255, 255) : s_nice_color_generator.Get(track.GetId());
+        cv::Scalar color = bbox.score == 0 ? CommonHelper::CreateCvColor(255, 255, 255) : context->nice_color_generator.Get(track.GetId());
         cv::rectangle(mat, cv::Rect(bbox.x, bbox.y, bbox.w, bbox.h), color, 2);
         CommonHelper::DrawText(mat, std::to_string(track.GetId()) + ": " + bbox.label, cv::Point(bbox.x, bbox.y - 13), 0.35, 1, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
 
@@ -242,8 +383,7 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
     CommonHelper::DrawText(mat, "DET: " + std::to_string(num_det) + ", TRACK: " + std::to_string(num_track), cv::Point(0, 20), 0.7, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(220, 220, 220));
 
     /*** Draw top view ***/
-    cv::Mat mat_topview;
-    CreateTopViewMat(mat_seg_max, mat_topview);
+    cv::Mat& mat_topview = context->mat_topview;
     /* Draw object on top view */
     std::vector<cv::Point2f> normal_points;
     std::vector<cv::Point2f> topview_points;
@@ -252,24 +392,26 @@ int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
         normal_points.push_back({ bbox.x + bbox.w / 2.0f, bbox.y + bbox.h + 0.0f });
     }
     if (normal_points.size() > 0) {
-        cv::perspectiveTransform(normal_points, topview_points, s_mat_transform_topview);
+        cv::perspectiveTransform(normal_points, topview_points, context->mat_transform_topview);
         for (int32_t i = 0; i < static_cast<int32_t>(track_list.size()); i++) {
             auto& track = track_list[i];
             const auto& bbox = track.GetLatestData().bbox;
-            cv::Scalar color = bbox.score == 0 ? CommonHelper::CreateCvColor(255, 255, 255) : s_nice_color_generator.Get(track.GetId());
+            cv::Scalar color = bbox.score == 0 ? CommonHelper::CreateCvColor(255, 255, 255) : context->nice_color_generator.Get(track.GetId());
             cv::Point p(static_cast<int32_t>(topview_points[i].x), static_cast<int32_t>(topview_points[i].y));
             cv::circle(mat_topview, p, 10, color, -1);
             cv::circle(mat_topview, p, 10, cv::Scalar(0, 0, 0), 2);
         }
     }
     cv::hconcat(mat, mat_topview, mat);
+    mat_topview.release();
 
-    DrawFps(mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    DrawFps(context->time_previous, mat, det_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
     /* Return the results */
+    for (int32_t i = 0; i < 3; i++) result.seg_pixel_num[i] = det_result.seg_pixel_num[i];
     result.time_pre_process = det_result.time_pre_process;
     result.time_inference = det_result.time_inference;
-    result.time_post_process = det_result.time_post_process;
+    result.time_post_process = (std::max)(context->time_post_process_seg, context->time_post_process_det);   /* the longer branch */
 
     return 0;
 }
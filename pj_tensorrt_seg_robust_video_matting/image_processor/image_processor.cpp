@@ -39,17 +39,29 @@ limitations under the License.
 #define PRINT(...)   COMMON_HELPER_PRINT(TAG, __VA_ARGS__)
 #define PRINT_E(...) COMMON_HELPER_PRINT_E(TAG, __VA_ARGS__)
 
-/*** Global variable ***/
-static std::unique_ptr<SegmentationEngine> s_engine;
+/*** Type ***/
+/* All the status of one pipeline. Different contexts can be processed in different threads */
+struct ImageProcessor::Context {
+    std::unique_ptr<SegmentationEngine> engine;
 
-static cv::Scalar s_bg_color;
-static float  s_mask_area_border_x_ratio;
+    /* For result image */
+    cv::Scalar bg_color;
+    float mask_area_border_x_ratio;
+    float mask_area_delta;
+    cv::Mat mat_ones;
+
+    /* For FPS display */
+    std::chrono::steady_clock::time_point time_previous;
+
+    Context() : bg_color(0.0, 255.0, 0.0), mask_area_border_x_ratio(1.0f), mask_area_delta(0.01f), time_previous(std::chrono::steady_clock::now()) {}
+};
+
+static ImageProcessor::Context* s_context = nullptr;    /* default instance for the API without context */
 
 /*** Function ***/
-static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
+static void DrawFps(std::chrono::steady_clock::time_point& time_previous, cv::Mat& mat, double time_inference, cv::Point pos, double font_scale, int32_t thickness, cv::Scalar color_front, cv::Scalar color_back, bool is_text_on_rect = true)
 {
     char text[64];
-    static auto time_previous = std::chrono::steady_clock::now();
     auto time_now = std::chrono::steady_clock::now();
     double fps = 1e9 / (time_now - time_previous).count();
     time_previous = time_now;
@@ -58,77 +70,108 @@ static void DrawFps(cv::Mat& mat, double time_inference, cv::Point pos, double f
 }
 
 
-int32_t ImageProcessor::Initialize(const InputParam& input_param)
+ImageProcessor::Context* ImageProcessor::Create(const ImageProcessor::InputParam& input_param)
 {
-    if (s_engine) {
-        PRINT_E("Already initialized\n");
-        return -1;
+    std::unique_ptr<Context> context(new Context());
+    context->engine.reset(new SegmentationEngine());
+    if (context->engine->Initialize(input_param.work_dir, input_param.num_threads) != SegmentationEngine::kRetOk) {
+        context->engine->Finalize();
+        return nullptr;
     }
+    return context.release();
+}
 
-    s_engine.reset(new SegmentationEngine());
-    if (s_engine->Initialize(input_param.work_dir, input_param.num_threads) != SegmentationEngine::kRetOk) {
-        s_engine->Finalize();
-        s_engine.reset();
+int32_t ImageProcessor::Destroy(ImageProcessor::Context* context)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
         return -1;
     }
 
-    s_bg_color = cv::Vec<float, 3>(0.0f, 255.0f, 0.0f);
-    s_mask_area_border_x_ratio = 1.0f;
+    int32_t ret = 0;
+    if (context->engine->Finalize() != SegmentationEngine::kRetOk) {
+        ret = -1;
+    }
+    delete context;
+    return ret;
+}
 
+
+int32_t ImageProcessor::Command(ImageProcessor::Context* context, int32_t cmd)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
+
+    //context->mask_area_border_x_ratio = cmd / 100.0f;
     return 0;
 }
 
-int32_t ImageProcessor::Finalize(void)
+
+int32_t ImageProcessor::Initialize(const ImageProcessor::InputParam& input_param)
 {
-    if (!s_engine) {
-        PRINT_E("Not initialized\n");
+    if (s_context) {
+        PRINT_E("Already initialized\n");
         return -1;
     }
+    s_context = Create(input_param);
+    return s_context ? 0 : -1;
+}
 
-    if (s_engine->Finalize() != SegmentationEngine::kRetOk) {
+int32_t ImageProcessor::Finalize(void)
+{
+    if (!s_context) {
+        PRINT_E("Not initialized\n");
         return -1;
     }
-
-    return 0;
+    int32_t ret = Destroy(s_context);
+    s_context = nullptr;
+    return ret;
 }
 
-
 int32_t ImageProcessor::Command(int32_t cmd)
 {
-    if (!s_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
-
-    //s_mask_area_border_x_ratio = cmd / 100.0f;
-    return 0;
+    return Command(s_context, cmd);
 }
 
-static void UpdateMaskArea()
+static void UpdateMaskArea(ImageProcessor::Context* context)
 {
-    static float delta = 0.01f;
-    s_mask_area_border_x_ratio += delta;
-    if (s_mask_area_border_x_ratio > 1.0) {
-        s_mask_area_border_x_ratio = 1.0;
-        delta *= -1;
+    context->mask_area_border_x_ratio += context->mask_area_delta;
+    if (context->mask_area_border_x_ratio > 1.0) {
+        context->mask_area_border_x_ratio = 1.0;
+        context->mask_area_delta *= -1;
     }
-    if (s_mask_area_border_x_ratio < 0.0) {
-        s_mask_area_border_x_ratio = 0.0;
-        delta *= -1;
+    if (context->mask_area_border_x_ratio < 0.0) {
+        context->mask_area_border_x_ratio = 0.0;
+        context->mask_area_delta *= -1;
     }
 }
 
-int32_t ImageProcessor::Process(cv::Mat& mat, Result& result)
+int32_t ImageProcessor::Process(cv::Mat& mat, ImageProcessor::Result& result)
 {
-    if (!s_engine) {
+    if (!s_context) {
         PRINT_E("Not initialized\n");
         return -1;
     }
+    return Process(s_context, mat, result);
+}
+
+int32_t ImageProcessor::Process(ImageProcessor::Context* context, cv::Mat& mat, ImageProcessor::Result& result)
+{
+    if (!context) {
+        PRINT_E("Invalid context\n");
+        return -1;
+    }
 
     //cv::resize(mat, mat, cv::Size(640, 640 * mat.rows / mat.cols));
 
     SegmentationEngine::Result segmentation_result;
-    if (s_engine->Process(mat, segmentation_result) != SegmentationEngine::kRetOk) {
+    if (context->engine->Process(mat, segmentation_result) != SegmentationEngine::kRetOk) {
         return -1;
     }
 
@@ -147,8 +190,8 @@ int32_t ImageProcessor::Process(cv::Mat& mat, Result& result)
     //cv::threshold(mat_pha, mat_pha, 0.5, 1.0, cv::THRESH_BINARY);
 
     /* Select masking area (just to show a nice demo) */
-    UpdateMaskArea();
-    cv::rectangle(mat_pha, cv::Rect(static_cast<int32_t>(s_mask_area_border_x_ratio * mat_pha.cols), 0, static_cast<int32_t>((1.0f - s_mask_area_border_x_ratio) * mat_pha.cols), mat_pha.rows), cv::Vec<float, 1>(1.0f), -1);
+    UpdateMaskArea(context);
+    cv::rectangle(mat_pha, cv::Rect(static_cast<int32_t>(context->mask_area_border_x_ratio * mat_pha.cols), 0, static_cast<int32_t>((1.0f - context->mask_area_border_x_ratio) * mat_pha.cols), mat_pha.rows), cv::Vec<float, 1>(1.0f), -1);
 
     /* Extact masked area */
     cv::Mat mat_composit;
@@ -159,14 +202,16 @@ int32_t ImageProcessor::Process(cv::Mat& mat, Result& result)
     mat_composit.convertTo(mat_composit, CV_8UC3);
 
     /* draw background */
-    static const cv::Mat kMatOnes = cv::Mat(mat_pha.size(), CV_32FC3, { 1.0f, 1.0f, 1.0f });
-    cv::multiply(kMatOnes - mat_pha, s_bg_color, mat_pha);
+    if (context->mat_ones.size() != mat_pha.size()) {
+        context->mat_ones = cv::Mat(mat_pha.size(), CV_32FC3, { 1.0f, 1.0f, 1.0f });
+    }
+    cv::multiply(context->mat_ones - mat_pha, context->bg_color, mat_pha);
     mat_pha.convertTo(mat_pha, CV_8UC3);
     mat_composit = mat_composit + mat_pha;
 
     cv::hconcat(mat, mat_composit, mat);
 #endif
-    DrawFps(mat, segmentation_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
+    DrawFps(context->time_previous, mat, segmentation_result.time_inference, cv::Point(0, 0), 0.5, 2, CommonHelper::CreateCvColor(0, 0, 0), CommonHelper::CreateCvColor(180, 180, 180), true);
 
     /* Return the results */
     result.time_pre_process = segmentation_result.time_pre_process;